@@ -17,6 +17,13 @@
  *	For the rest we have to go via the C stack which whilst painfulf in
  *	places is helped by the relatively low clocks per instruction.
  *
+ *	With -m6502-static the locals of functions that the front end
+ *	can see do not call themselves or call through a pointer are put
+ *	in static memory instead. This removes the frame set up and turns
+ *	(@sp),y accesses into absolute ones. The user is promising that
+ *	nothing else re-enters such functions (indirect recursion across
+ *	files or calls from interrupt handlers).
+ *
  *	Elements of this design like the separate stack with ZP pointer are
  *	heavily influenced by CC65 and one goal is to use many of the same
  *	support functions. Our pproach to code generation is however quite
@@ -35,6 +42,8 @@
 #define NMOS_6502	0
 #define CMOS_6502	1
 
+#define FEAT_STATIC	1	/* Static frames for non re-entrant functions */
+
 #define BYTE(x)		(((unsigned)(x)) & 0xFF)
 #define WORD(x)		(((unsigned)(x)) & 0xFFFF)
 
@@ -46,6 +55,8 @@ static unsigned sp;		/* Stack pointer offset tracking */
 static unsigned unreachable;	/* Code following an unconditional jump */
 static unsigned xlabel;		/* Internal backend generated branches */
 static unsigned argbase;	/* Track shift between arguments and stack */
+static unsigned static_frame;	/* Size of locals held in static memory */
+static unsigned regsave;	/* Register variables saved on the CPU stack */
 
 /*
  *	Node types we create in rewriting rules
@@ -62,6 +73,11 @@ static unsigned argbase;	/* Track shift between arguments and stack */
 #define T_RDEREF	(T_USER+9)		/* *regptr */
 #define T_REQ		(T_USER+10)		/* *regptr */
 
+/* Register variables are a word each in the zero page block @reg */
+static unsigned zpreg(unsigned r)
+{
+	return 2 * (r - 1);
+}
 
 /*
  *	6502 specifics. We need to track some register values to produce
@@ -424,6 +440,8 @@ static int do_pri8(struct node *n, const char *op, void (*pre)(struct node *__n)
 	case T_LSTORE:
 	case T_NSTORE:
 	case T_LBSTORE:
+	case T_RREF:
+	case T_RSTORE:
 		/* These had the right squashed into them */
 		r = n;
 		break;
@@ -456,10 +474,11 @@ static int do_pri8(struct node *n, const char *op, void (*pre)(struct node *__n)
 		pre(n);
 		output("%s T%d+%d", op,  r->val2, (unsigned)r->value);
 		return 1;
-	/* If we add registers
 	case T_RREF:
-		output("%s __reg%d", op, r->val2);
-		return 1;*/ 
+	case T_RSTORE:
+		pre(n);
+		output("%s @reg+%u", op, zpreg(r->value));
+		return 1;
 	}
 	return 0;
 }
@@ -487,6 +506,8 @@ static int do_pri8hi(struct node *n, const char *op, void (*pre)(struct node *__
 	case T_LSTORE:
 	case T_NSTORE:
 	case T_LBSTORE:
+	case T_RREF:
+	case T_RSTORE:
 		/* These had the right squashed into them */
 		r = n;
 		break;
@@ -517,10 +538,11 @@ static int do_pri8hi(struct node *n, const char *op, void (*pre)(struct node *__
 		pre(n);
 		output("%s T%d+%d", op,  r->val2, (unsigned)r->value + 1);
 		return 1;
-	/* If we add registers
 	case T_RREF:
-		output("%s __reg%d+1", op, r->val2);
-		return 1;*/ 
+	case T_RSTORE:
+		pre(n);
+		output("%s @reg+%u", op, zpreg(r->value) + 1);
+		return 1;
 	}
 	return 0;
 }
@@ -534,13 +556,13 @@ static int do_pri16(struct node *n, const char *op, void (*pre)(struct node *__n
 	case T_LABEL:
 		pre(n);
 		output("%sa #<T%d+%d", op,  n->val2, (unsigned)n->value);
-		output("%sx #>T%d+%d", op,  n->val2, ((unsigned)n->value) >> 8);
+		output("%sx #>T%d+%d", op,  n->val2, (unsigned)n->value);
 		return 1;
 	case T_NAME:
 		pre(n);
 		name = namestr(n->snum);
-		output("%sa #<_%s+%d", op,  n, (unsigned)n->value);
-		output("%sx #>_%s+%d", op,  n, ((unsigned)n->value) >> 8);
+		output("%sa #<_%s+%d", op,  name, (unsigned)n->value);
+		output("%sx #>_%s+%d", op,  name, (unsigned)n->value);
 		return 1;
 	case T_LREF:
 	case T_NREF:
@@ -548,6 +570,8 @@ static int do_pri16(struct node *n, const char *op, void (*pre)(struct node *__n
 	case T_LSTORE:
 	case T_NSTORE:
 	case T_LBSTORE:
+	case T_RREF:
+	case T_RSTORE:
 	case T_CONSTANT:
 		/* These had the right squashed into them */
 		r = n;
@@ -584,12 +608,12 @@ static int do_pri16(struct node *n, const char *op, void (*pre)(struct node *__n
 		output("%sa T%d+%d", op,  r->val2, (unsigned)r->value);
 		output("%sx T%d+%d", op,  r->val2, ((unsigned)r->value) + 1);
 		return 1;
-	/* If we add registers
 	case T_RREF:
+	case T_RSTORE:
 		pre(n);
-		output("%sa __reg%dd", op, r->val2);
-		output("%sx __reg%d + 1", op,  r->val2);
-		return 1;*/ 
+		output("%sa @reg+%u", op, zpreg(r->value));
+		output("%sx @reg+%u", op, zpreg(r->value) + 1);
+		return 1;
 	}
 	return 0;
 }
@@ -711,6 +735,9 @@ static int leftop_memc(struct node *n, const char *op)
 				label("X%d", xlabel);
 			}
 		}
+		/* Any copy of the old value we were tracking is gone */
+		invalidate_a();
+		invalidate_x();
 		if (!nr) {
 			output("lda _%s+%d", name, v);
 			if (sz == 2)
@@ -726,7 +753,9 @@ static int leftop_memc(struct node *n, const char *op)
 				label("X%d", xlabel);
 			}
 		}
-		if (nr == 1) {
+		invalidate_a();
+		invalidate_x();
+		if (!nr) {
 			output("lda T%d+%d", (unsigned)l->val2, v);
 			if (sz == 2)
 				output("ldx T%d+%d", (unsigned)l->val2, v + 1);
@@ -820,7 +849,7 @@ static unsigned is_simple(struct node *n)
 		return 0;
 
 	/* We can use these directly with primary operators on A */
-	if (op == T_CONSTANT || op == T_LABEL || op == T_NAME || (op == T_LREF && n->value < 255))
+	if (op == T_CONSTANT || op == T_LABEL || op == T_NAME || op == T_RREF || (op == T_LREF && n->value < 255))
 		return 10;
 	/* Can go via @tmp */
 	if (op == T_NREF || op == T_LBREF)
@@ -829,6 +858,59 @@ static unsigned is_simple(struct node *n)
 	return 0;
 }
 
+/* The operation an assignment operator performs */
+static unsigned assign_op(unsigned op)
+{
+	switch(op) {
+	case T_PLUSEQ:
+		return T_PLUS;
+	case T_MINUSEQ:
+		return T_MINUS;
+	case T_STAREQ:
+		return T_STAR;
+	case T_SLASHEQ:
+		return T_SLASH;
+	case T_PERCENTEQ:
+		return T_PERCENT;
+	case T_ANDEQ:
+		return T_AND;
+	case T_OREQ:
+		return T_OR;
+	case T_HATEQ:
+		return T_HAT;
+	case T_SHLEQ:
+		return T_LTLT;
+	case T_SHREQ:
+		return T_GTGT;
+	}
+	return 0;
+}
+
+/*
+ *	reg op= x becomes reg = reg op x. Constant adds and subtracts along
+ *	with ++ and -- are left for gen_shortcut to do in place.
+ */
+static struct node *rewrite_reg_op(struct node *n)
+{
+	struct node *l = n->left;
+	struct node *m;
+	unsigned op = assign_op(n->op);
+
+	if (op == 0 || ((op == T_PLUS || op == T_MINUS) && n->right->op == T_CONSTANT))
+		return n;
+	m = new_node();
+	m->op = T_RSTORE;
+	m->type = n->type;
+	m->value = l->value;
+	m->flags = n->flags;
+	m->right = n;
+	n->op = op;
+	n->flags = 0;
+	l->op = T_RREF;
+	l->type = n->type;
+	return m;
+}
+
 /* Chance to rewrite the tree from the top rather than none by node
    upwards. We will use this for 8bit ops at some point and for cconly
    propagation */
@@ -857,18 +939,26 @@ struct node *gen_rewrite_node(struct node *n)
 		- rewrite some reg ops
 	*/
 
+	/* Locals in a static frame are just labelled memory */
+	if (op == T_LOCAL && static_frame) {
+		n->op = T_LABEL;
+		n->val2 = frame_label;
+		return n;
+	}
+
 	/* *regptr */
-	if (op == T_DEREF && r->op == T_RREF) {
-		n->op = T_RDEREF;
-		n->right = NULL;
+	if (op == T_DEREF && r->op == T_RREF && get_size(nt) <= 2) {
+		squash_right(n, T_RDEREF);
 		return n;
 	}
 	/* *regptr = */
-	if (op == T_EQ && l->op == T_RREF) {
-		n->op = T_REQ;
-		n->left = NULL;
+	if (op == T_EQ && l->op == T_RREF && get_size(nt) <= 2) {
+		squash_left(n, T_REQ);
 		return n;
 	}
+	/* Register variables have no address to work on */
+	if (l && l->op == T_REG && op != T_EQ)
+		return rewrite_reg_op(n);
 	/* Rewrite references into a load operation */
 	if (nt == CCHAR || nt == UCHAR || nt == CSHORT || nt == USHORT || PTR(nt)) {
 		if (op == T_DEREF) {
@@ -976,8 +1066,27 @@ void gen_prologue(const char *name)
 /* Generate the stack frame */
 void gen_frame(unsigned size, unsigned aframe)
 {
+	unsigned r;
+
+	/* Save the zero page registers we use on the CPU stack */
+	regsave = func_flags & F_REGMASK;
+	for (r = 1; r <= NUM_REG; r++) {
+		if (func_flags & F_REG(r)) {
+			output("lda @reg+%u", zpreg(r));
+			output("pha");
+			output("lda @reg+%u", zpreg(r) + 1);
+			output("pha");
+		}
+	}
+	invalidate_a();
+
 	frame_len = size;
-	if (size == 0)
+	static_frame = 0;
+	if (size && frame_label && (cpufeat & FEAT_STATIC)) {
+		static_frame = size;
+		frame_len = 0;
+	}
+	if (frame_len == 0)
 		return;
 
 	sp += size;
@@ -995,10 +1104,30 @@ void gen_frame(unsigned size, unsigned aframe)
 
 void gen_epilogue(unsigned size, unsigned argsize)
 {
-	if (sp != size) {
+	if (sp != frame_len) {
 		error("sp");
 	}
-	sp -= size;
+	sp -= frame_len;
+	size = frame_len;
+	/* Restore the zero page registers keeping the return in XA */
+	if (regsave) {
+		unsigned r = NUM_REG;
+		unsigned ret = !(func_flags & F_VOIDRET);
+		if (ret)
+			output("tay");
+		while(r) {
+			if (func_flags & F_REG(r)) {
+				output("pla");
+				output("sta @reg+%u", zpreg(r) + 1);
+				output("pla");
+				output("sta @reg+%u", zpreg(r));
+			}
+			r--;
+		}
+		if (ret)
+			output("tya");
+		invalidate_y();
+	}
 	/* TODO arg removal */
 	if (size > 256) {
 		/* Ugly as we need to preserve AX */
@@ -1014,6 +1143,12 @@ void gen_epilogue(unsigned size, unsigned argsize)
 	}
 	else
 		output("rts");
+	if (static_frame) {
+		output(".bss");
+		label("T%d", frame_label);
+		output(".ds %d", static_frame);
+		output(".code");
+	}
 }
 
 void gen_label(const char *tail, unsigned n)
@@ -1026,7 +1161,7 @@ void gen_label(const char *tail, unsigned n)
 unsigned gen_exit(const char *tail, unsigned n)
 {
 	/* Want to use BRA/BRL if we have it */
-	if (frame_len == 0) {
+	if (frame_len == 0 && regsave == 0) {
 		output("rts");
 		return 1;
 	} else {
@@ -1622,6 +1757,74 @@ unsigned gen_uni_direct(struct node *n)
 	return 0;
 }
 
+/*
+ *	++, --, += and -= of a constant on a register variable. These are
+ *	done in place in zero page. A and X are left alone unless we need
+ *	them for the result.
+ */
+static unsigned reg_incdec(struct node *n)
+{
+	struct node *r = n->right;
+	unsigned sz = get_size(n->type);
+	unsigned nr = n->flags & NORETURN;
+	unsigned reg = zpreg(n->left->value);
+	unsigned v = r->value;
+	unsigned post = (n->op == T_PLUSPLUS || n->op == T_MINUSMINUS);
+	unsigned minus = (n->op == T_MINUSMINUS || n->op == T_MINUSEQ);
+	const char *op = minus ? "sbc" : "adc";
+
+	if (sz > 2)
+		return 0;
+	/* Old value for x++ and x-- */
+	if (post && !nr) {
+		output("lda @reg+%u", reg);
+		if (sz == 2)
+			output("ldx @reg+%u", reg + 1);
+	}
+	if (v <= 2) {
+		while(v--) {
+			if (sz == 1)
+				output("%s @reg+%u", minus ? "dec" : "inc", reg);
+			else if (minus) {
+				output("ldy @reg+%u", reg);
+				output("bne X%d", ++xlabel);
+				output("dec @reg+%u", reg + 1);
+				label("X%d", xlabel);
+				output("dec @reg+%u", reg);
+				invalidate_y();
+			} else {
+				output("inc @reg+%u", reg);
+				output("bne X%d", ++xlabel);
+				output("inc @reg+%u", reg + 1);
+				label("X%d", xlabel);
+			}
+		}
+	} else {
+		if (post && !nr)
+			output("pha");
+		output(minus ? "sec" : "clc");
+		output("lda @reg+%u", reg);
+		output("%s #%u", op, v & 0xFF);
+		output("sta @reg+%u", reg);
+		if (sz == 2) {
+			output("lda @reg+%u", reg + 1);
+			output("%s #%u", op, (v >> 8) & 0xFF);
+			output("sta @reg+%u", reg + 1);
+		}
+		if (post && !nr)
+			output("pla");
+	}
+	/* New value for ++x, --x, += and -= */
+	if (!post && !nr) {
+		output("lda @reg+%u", reg);
+		if (sz == 2)
+			output("ldx @reg+%u", reg + 1);
+	}
+	invalidate_a();
+	invalidate_x();
+	return 1;
+}
+
 /*
  *	Allow the code generator to shortcut trees it knows
  */
@@ -1645,6 +1848,9 @@ unsigned gen_shortcut(struct node *n)
 		codegen_lr(r);
 		return 1;
 	}
+	/* The rewrite leaves only constant adds and subtracts on registers */
+	if (l && l->op == T_REG)
+		return reg_incdec(n);
 	/* The left nay be a complex expression but also may be soemthing
 	   we can directly reference. The right is the amount */
 	if (n->op == T_PLUSPLUS && leftop_memc(n, "inc"))
@@ -1751,6 +1957,7 @@ unsigned gen_node(struct node *n)
 		/* Fall through */
 	case T_NREF:
 	case T_LBREF:
+	case T_RREF:
 		if (size == 1) {
 			if (a_contains(n))
 				return 1;
@@ -1771,6 +1978,7 @@ unsigned gen_node(struct node *n)
 	case T_NSTORE:
 	case T_LBSTORE:
 	case T_LSTORE:
+	case T_RSTORE:
 		if (size == 1 && pri8(n, "sta")) {
 			set_a_node(n); 
 			return 1;
@@ -1784,6 +1992,41 @@ unsigned gen_node(struct node *n)
 		invalidate_regs();
 		output("jsr _%s+%d", namestr(n->snum), n->value);
 		return 1;
+	/* Pointer register variables can be used directly with (zp),y */
+	case T_RDEREF:
+		v = zpreg(n->value);
+		if (size == 1) {
+			load_y(0);
+			output("lda (@reg+%u),y", v);
+		} else {
+			load_y(1);
+			output("lda (@reg+%u),y", v);
+			output("tax");
+			output("dey");
+			output("lda (@reg+%u),y", v);
+			set_reg(R_Y, 0);
+			invalidate_x();
+		}
+		invalidate_a();
+		return 1;
+	case T_REQ:
+		v = zpreg(n->value);
+		load_y(0);
+		output("sta (@reg+%u),y", v);
+		if (size == 2) {
+			if (!nr)
+				output("pha");
+			output("iny");
+			output("txa");
+			output("sta (@reg+%u),y", v);
+			set_reg(R_Y, 1);
+			if (!nr)
+				output("pla");
+			else
+				invalidate_a();
+		}
+		invalidate_mem();
+		return 1;
 	case T_EQ:
 		/* store XA in top of stack addr  .. ugly */
 		if (size > 2) 
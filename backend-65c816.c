@@ -23,18 +23,19 @@
  *	- full register tracking - still very hackish
  *	- need to write 8/16bit accumulator switcher
  *
- *	- A lot of operations work versus offset,x which means that we want
- *	  to rewrite
+ *	- A lot of operations work versus offset,x which means that we
+ *	  rewrite
  *			deref
  *			  |
  *			plus|minus
  *		       /    \
  *		    thing   constoffset
  *
- *	into a derefplus operation that uses lda offset,x
+ *	into a derefplus operation that uses lda offset,x. Where the thing
+ *	is a local we fold it further into an LDEREF/LEQ.
  *
  *	Secondly we can do most operations on n,x which means that
- *	we can rewrite any operation of the form
+ *	we handle any operation of the form
  *
  *			op
  *		       /  \
@@ -42,8 +43,12 @@
  *			      \
  *			     expr
  *
- *	to load the expr into ,x (easy for simple ones, for complex we
- *	probably have to do it into a and tax) then do the op on offset,x
+ *	by loading the expr into ,x (easy for simple ones, for complex we
+ *	have to do it into a and tax) then doing the op on offset,x. The
+ *	assignment operators on *(simple + n) work the same way.
+ *
+ *	X tracks which local pointer it holds so that runs of struct
+ *	accesses via the same pointer only load it once.
  *
  *	For code size we have a few problems. Our deref for locals is
  *	n,y which is a 3 byte instruction, but is offset by the fact we
@@ -51,6 +56,18 @@
  *	as we have to lda, dey dey sta 0,y which is 8 bytes for a value (Z80 is
  *	4 for example)
  *
+ *	With -m65c816-dpframe at -Os we instead point DP at the frame on
+ *	entry (phd tya tcd) so locals become direct page references. This
+ *	requires the C stack is in bank 0 and the direct page variables
+ *	from dp.s are linked at 0. Each DP frame therefore starts with
+ *	DP_SCRATCH bytes which are its @tmp, @hireg etc, and the locals sit
+ *	above them. Helpers and non DP functions we call simply use our
+ *	scratch. On exit we pld, copying @hireg across into the caller's
+ *	direct page if returning a long. Interrupt code that uses the direct
+ *	page must save D and set it to 0 itself, and setjmp/longjmp must
+ *	save and restore D. Offsets that don't fit in the page fall back to
+ *	n,y and we don't use a DP frame at all if the locals don't fit.
+ *
  *	The other nasty is that because we use the CPU stack for some things
  *	we have to do some shuffling on helpers. Thankfully it's a lot easier
  *	with 16bit pointers.
@@ -58,9 +75,6 @@
  *	TODO size:
  *	- turn some ops into helpers in small mode
  *	- pusharg helpers for common small values
- *	- if optsize && dataseg is 0 then set DP to point to the stack
- *	  frame and use DP for the local refs (needs a space for hireg in
- *	  each frame and to pass upper word back in X for this format)
  *	- Use stz.
  *	- fold a + b + 1 to use sec adc, ditto a - b - 1 and clc
  *
@@ -69,9 +83,7 @@
  *	- we need an outputcc2(size, blah") that sets valid if size 2
  *	  and not otherwise
  *	- Turn on lref etc for size 4
- *	- Tree rewrite DEREF(LBREF) DEREF(LREF) DEREF(NREF) to use
- *	  ldx blah, lda n,x and avoid shuffling registers. Make sure
- *	  to also cover DEREFPLUS
+ *	- Track NREF in X once volatile is propagated
  *
  */
 
@@ -86,6 +98,11 @@
 #define BYTE(x)		(((unsigned)(x)) & 0xFF)
 #define WORD(x)		(((unsigned)(x)) & 0xFFFF)
 
+/* Feature bits passed to us by cc */
+#define FEAT_DPFRAME	1	/* Point DP at the frame for locals (-Os) */
+
+#define DP_SCRATCH	10	/* Bytes of direct page variables (dp.s) */
+
 /*
  *	State for the current function
  */
@@ -98,6 +115,7 @@ static unsigned argbase;	/* Track shift between arguments and stack */
 static unsigned livesize = 2;	/* 16bit mode generating for */
 static unsigned cursize = 2;	/* 16bit mode currently set */
 static unsigned ccvalid;	/* CC state */
+static unsigned dpframe;	/* DP points at the frame in this function */
 
 #define CC_NONE		0	/* CC meaningless */
 #define CC_VALID	1	/* CC valid for 0 / not zero on A */
@@ -355,18 +373,15 @@ static void set_x_node(struct node *n)
 }
 
 /* Can't deal with NREF until we propagate volatile info better */
-/* Also need to deal with loading X from A and A from or via  X for nodes and
-   node contents */
 static unsigned x_contains(struct node *n)
 {
-//      printf(";x contains? %x %ld\n", n->op, n->value);
 	if (n->op == T_NREF)
 		return 0;
-	if (reg[R_A].state != n->op || reg[R_X].state != n->op)
+	if (reg[R_X].state != n->op)
 		return 0;
-	if (reg[R_A].value != n->value || reg[R_X].value != n->value)
+	if (reg[R_X].value != n->value)
 		return 0;
-	if (reg[R_A].snum != n->snum || reg[R_X].snum != n->snum)
+	if (reg[R_X].snum != n->snum)
 		return 0;
 	/* Looks good */
 	return 1;
@@ -433,6 +448,13 @@ static void move_a_x_ccvalid(void)
 	ccvalid = CC_VALID;
 }
 
+/* Move X to A setting the condition codes */
+static void move_x_a_ccvalid(void)
+{
+	outputcc("txa");
+	memcpy(reg + R_A, reg + R_X, sizeof(struct regtrack));
+}
+
 static void setsize(unsigned size)
 {
 	livesize = size;
@@ -460,6 +482,51 @@ static void assume16bit(void)
 	cursize = livesize = 2;
 }
 
+/*
+ *	The operand for the local at frame offset v. In a DP frame this is
+ *	a direct page reference providing the whole object fits in the page,
+ *	otherwise it is relative to the C stack in Y.
+ */
+static unsigned dp_local(unsigned v, unsigned size)
+{
+	return dpframe && v + size <= 256;
+}
+
+static const char *local_ref(unsigned v, unsigned size)
+{
+	static char buf[2][16];
+	static unsigned n;
+	char *p = buf[n++ & 1];
+
+	if (dp_local(v, size))
+		sprintf(p, "@%u", v);
+	else
+		sprintf(p, "%u,y", v + sp);
+	return p;
+}
+
+/*
+ *	Get the pointer held in the local at offset n->value into X. This
+ *	is the usual case for struct and array access via a pointer argument
+ *	so we try hard to avoid reloading it.
+ */
+static void load_x_local(struct node *n)
+{
+	if (reg[R_X].state == T_LREF && reg[R_X].value == n->value)
+		return;
+	if (reg[R_A].state == T_LREF && reg[R_A].value == n->value) {
+		move_a_x();
+		return;
+	}
+	/* The accumulator width doesn't matter for an index load */
+	setsize(cursize);
+	outputnc("ldx %s", local_ref(n->value, 2));
+	set16bit();
+	reg[R_X].state = T_LREF;
+	reg[R_X].value = n->value;
+	reg[R_X].snum = n->snum;
+}
+
 
 /* Memory writes occured, invalidate according to what we know. Passing
    NULL indicates unknown memory changes */
@@ -483,6 +550,14 @@ static void invalidate_mem(void)
 		reg[R_X].state = INVALID;
 }
 
+/* A store via the pointer in X. We assume it doesn't overwrite the
+   pointer itself so X stays valid */
+static void invalidate_store_x(void)
+{
+	if (reg[R_A].state != T_CONSTANT)
+		reg[R_A].state = INVALID;
+}
+
 /*
  *	Example size handling. In this case for a system that always
  *	pushes words.
@@ -533,7 +608,8 @@ static unsigned can_pri(struct node *n)
 	unsigned op = n->op;
 	if (op == T_LABEL || op == T_NAME || op == T_CONSTANT)
 		return 1;
-	if (op == T_LREF || op == T_NREF || op == T_LBREF || op == T_LSTORE || op == T_NSTORE || op == T_LBSTORE)
+	/* Not the store forms - they have to be generated */
+	if (op == T_LREF || op == T_NREF || op == T_LBREF)
 		return 1;
 	return 0;
 }
@@ -581,6 +657,9 @@ static int do_pri(struct node *n, const char *op, void (*pre)(struct node *__n),
 		r = n;
 		break;
 	}
+	/* A store on the right has to be generated properly */
+	if (r != n && (r->op == T_LSTORE || r->op == T_NSTORE || r->op == T_LBSTORE))
+		return 0;
 	/* TODO: optimize ld case for 8bit by loading 16 if not NAME */
 	s = get_size(r->type);
 	if (s == 4)
@@ -597,7 +676,7 @@ static int do_pri(struct node *n, const char *op, void (*pre)(struct node *__n),
 			/* TODO: use zp hacks stack tracking */
 		}
 		setsize(s);
-		outputnc("%s %d,y", op, r->value + sp);
+		outputnc("%s %s", op, local_ref(r->value, s));
 		set16bit();
 		return 1;
 	case T_NREF:
@@ -622,6 +701,19 @@ static int do_pri(struct node *n, const char *op, void (*pre)(struct node *__n),
 		/*
 		 *      We may be able to dereference stuff
 		 */
+	case T_LDEREF:
+		/* Pointer held in a local, offset in val2 */
+		if (via_x) {
+			load_x_local(r);
+			ccvalid = CC_NONE;
+			setsize(s);
+			pre(r);
+			outputnc("%s %d,x", op, r->val2);
+			set16bit();
+			invalidate_a();
+			return 1;
+		}
+		return 0;
 	case T_DEREF:
 	case T_DEREFPLUS:
 		if (can_pri(r->right) && via_x) {
@@ -631,9 +723,11 @@ static int do_pri(struct node *n, const char *op, void (*pre)(struct node *__n),
 			   do_pri lda
 			   tax
 			   pla ?? */
-			do_pri(r->right, "ldx", pre_none, 0);
+			if (!x_contains(r->right)) {
+				do_pri(r->right, "ldx", pre_none, 0);
+				set_x_node(r->right);
+			}
 			ccvalid = CC_NONE;
-			invalidate_x();
 			/* X now holds our pointer */
 			setsize(s);
 			pre(r);
@@ -676,6 +770,9 @@ static int do_pri_cc(struct node *n, const char *op, void (*pre)(struct node *__
 		r = n;
 		break;
 	}
+	/* A store on the right has to be generated properly */
+	if (r != n && (r->op == T_LSTORE || r->op == T_NSTORE || r->op == T_LBSTORE))
+		return 0;
 	/* TODO: optimize ld case for 8bit by loading 16 if not NAME */
 	s = get_size(r->type);
 	switch (r->op) {
@@ -691,9 +788,9 @@ static int do_pri_cc(struct node *n, const char *op, void (*pre)(struct node *__
 		}
 		setsize(s);
 		if (s == 2)
-			outputcc("%s %d,y", op, r->value + sp);
+			outputcc("%s %s", op, local_ref(r->value, s));
 		else
-			outputnc("%s %d,y", op, r->value + sp);
+			outputnc("%s %s", op, local_ref(r->value, s));
 		set16bit();
 		return 1;
 	case T_NREF:
@@ -724,6 +821,22 @@ static int do_pri_cc(struct node *n, const char *op, void (*pre)(struct node *__
 		/*
 		 *      We may be able to dereference stuff
 		 */
+	case T_LDEREF:
+		/* Pointer held in a local, offset in val2 */
+		if (via_x) {
+			load_x_local(r);
+			ccvalid = CC_NONE;
+			pre(r);
+			setsize(s);
+			if (s == 2)
+				outputcc("%s %d,x", op, r->val2);
+			else
+				outputnc("%s %d,x", op, r->val2);
+			set16bit();
+			invalidate_a();
+			return 1;
+		}
+		return 0;
 	case T_DEREF:
 	case T_DEREFPLUS:
 		if (can_pri(r->right) && via_x) {
@@ -733,9 +846,11 @@ static int do_pri_cc(struct node *n, const char *op, void (*pre)(struct node *__
 			   do_pri lda
 			   tax
 			   pla ?? */
-			do_pri(r->right, "ldx", pre_none, 0);
+			if (!x_contains(r->right)) {
+				do_pri(r->right, "ldx", pre_none, 0);
+				set_x_node(r->right);
+			}
 			ccvalid = CC_NONE;
-			invalidate_x();
 			/* X now holds our pointer */
 			pre(r);
 			setsize(s);
@@ -852,7 +967,7 @@ static int leftop_memc(struct node *n, const char *op)
 	unsigned nr = n->flags & NORETURN;
 	unsigned preload = 0;
 
-	if (sz > 2 || optsize)
+	if (sz > 2)
 		return 0;
 	if (r->op != T_CONSTANT || r->value > 2)
 		return 0;
@@ -860,10 +975,19 @@ static int leftop_memc(struct node *n, const char *op)
 		count = r->value;
 
 	v = l->value;
+	if (l->op == T_ARGUMENT)
+		v += argbase + frame_len;
+
+	/* For size only direct page locals are a win */
+	if (optsize && !((l->op == T_LOCAL || l->op == T_ARGUMENT) && dp_local(v, sz)))
+		return 0;
 
 	if (n->op == T_PLUSPLUS || n->op == T_MINUSMINUS)
 		preload = 1;
 
+	/* We are changing memory under any copy in A or X */
+	invalidate_mem();
+
 	switch (l->op) {
 	case T_NAME:
 		name = namestr(l->snum);
@@ -895,8 +1019,22 @@ static int leftop_memc(struct node *n, const char *op)
 		set16bit();
 		return 1;
 	case T_ARGUMENT:
-		v += argbase + frame_len;
 	case T_LOCAL:
+		if (dp_local(v, sz)) {
+			setsize(sz);
+			if (!nr && preload) {
+				outputcc("lda @%u", v);
+				invalidate_a();
+			}
+			while (count--)
+				output("%s @%u", op, v);
+			if (!nr && !preload) {
+				outputcc("lda @%u", v);
+				invalidate_a();
+			}
+			set16bit();
+			return 1;
+		}
 		/* We can do ,x but not ,y */
 		v += sp;
 		invalidate_x();
@@ -1026,6 +1164,10 @@ struct node *gen_rewrite_node(struct node *n)
 	   - rewrite some reg ops
 	 */
 
+	/* Locals sit above the direct page scratch in a DP frame */
+	if (op == T_LOCAL && dpframe)
+		n->value += DP_SCRATCH;
+
 	/* *regptr */
 	if (op == T_DEREF && r->op == T_RREF) {
 		n->op = T_RDEREF;
@@ -1222,13 +1364,23 @@ void gen_prologue(const char *name)
    end could collect it and pass it in a way we can use: TODO */
 void gen_frame(unsigned size, unsigned argsize)
 {
+	/* Only worth it for a decent sized frame where we already have to
+	   adjust Y the long way (so the scratch is free). The locals must fit
+	   in the page along with the scratch */
+	dpframe = 0;
+	if (optsize && (cpufeat & FEAT_DPFRAME) && size > 6 &&
+		size + DP_SCRATCH <= 254) {
+		dpframe = 1;
+		size += DP_SCRATCH;
+	}
+
 	frame_len = size;
 	arg_len = argsize;
+	sp = 0;
 
 	if (size == 0)
 		return;
 
-	sp = 0;
 	/* Maybe shortcut some common values ? */
 
 	if (size) {
@@ -1241,6 +1393,12 @@ void gen_frame(unsigned size, unsigned argsize)
 			output("tay");
 		}
 	}
+	/* A still holds the new Y from the adjust */
+	if (dpframe) {
+		outputnc("phd");
+		outputnc("tcd");
+		invalidate_a();
+	}
 }
 
 void gen_epilogue(unsigned size, unsigned argsize)
@@ -1260,6 +1418,16 @@ void gen_epilogue(unsigned size, unsigned argsize)
 	if (func_flags & F_VOIDRET)
 		cost -= 2;
 	assume16bit();
+	/* The upper half of a long return lives in our direct page */
+	if (dpframe) {
+		if (func_flags & F_LONGRET) {
+			outputnc("ldx @hireg");
+			outputnc("pld");
+			outputnc("stx @hireg");
+		} else
+			outputnc("pld");
+		size += DP_SCRATCH;
+	}
 	/* Use the helper for small cases */
 	if (optsize && size > 3 && size < 12) {
 		outputnc("jmp __fnexit%d", size);
@@ -1295,6 +1463,11 @@ void gen_label(const char *tail, unsigned n)
 unsigned gen_exit(const char *tail, unsigned n)
 {
 	set16bit();
+	/* The DP frame has to be unwound by the epilogue */
+	if (dpframe) {
+		outputnc("jmp L%d%s", n, tail);
+		return 0;
+	}
 	if (frame_len + arg_len == 0) {
 		outputnc("rts");
 		unreachable = 1;
@@ -1563,9 +1736,9 @@ unsigned gen_direct(struct node *n)
 		/* Avoid lstore going via @hireg if not needed */
 		if (s == 4 && r->op == T_CONSTANT && nr) {
 			load_a(r->value >> 16);
-			outputnc("sta %u,y\n", n->value + sp + 2);
+			outputnc("sta %s\n", local_ref(n->value + 2, 2));
 			load_a(r->value);
-			outputnc("sta %u,y\n", n->value + sp);
+			outputnc("sta %s\n", local_ref(n->value, 2));
 			return 1;	
 		}
 		return 0;
@@ -1575,7 +1748,7 @@ unsigned gen_direct(struct node *n)
 			invalidate_mem();
 			move_a_x();
 			setsize(s);
-			output("stz %u,x", n->val2);
+			output("stz %u,x", (unsigned) n->value);
 			set16bit();
 			return 1;
 		}
@@ -1584,7 +1757,7 @@ unsigned gen_direct(struct node *n)
 			invalidate_a();
 			invalidate_mem();
 			setsize(s);
-			outputnc("sta %u,x", n->val2);
+			outputnc("sta %u,x", (unsigned) n->value);
 			set16bit();
 			return 1;
 		}
@@ -1787,8 +1960,11 @@ unsigned gen_direct(struct node *n)
 	case T_STAR:
 		if (s > 2)
 			return 0;
-		if (r->op == T_CONSTANT && gen_mul(r->value))
+		if (r->op == T_CONSTANT && gen_mul(r->value)) {
+			if (r->value > 1)
+				invalidate_a();
 			return 1;
+		}
 		/* TODO: power of 2 into add/shifts, short form helpers
 		   for low consts 2,4 etc */
 		return pri_help(n, "mulx");
@@ -1998,6 +2174,7 @@ unsigned gen_direct(struct node *n)
 		}
 		if (s <= 2 && !optsize && do_pri(n, "ldx", pre_none, 0)) {
 			ccvalid = CC_NONE;
+			invalidate_x();
 			setsize(s);
 			output("bra X%d", xlabel + 2);
 			label("X%d", ++xlabel);
@@ -2034,6 +2211,7 @@ unsigned gen_direct(struct node *n)
 			if (!nr)
 				outputnc("lda 0,x");
 			if (nr && r->value <= 4) {
+				invalidate_store_x();
 				repeated_op(r->value, "inc 0,x");
 				set16bit();
 				return 1;
@@ -2063,6 +2241,7 @@ unsigned gen_direct(struct node *n)
 			if (!nr)
 				outputcc("lda 0,x");
 			if (nr && r->value <= 4) {
+				invalidate_store_x();
 				repeated_op(r->value, "dec 0,x");
 				set16bit();
 				return 1;
@@ -2093,6 +2272,7 @@ unsigned gen_direct(struct node *n)
 				move_a_x();
 				setsize(s);
 				if (nr) {
+					invalidate_store_x();
 					repeated_op(r->value, "inc 0,x");
 					set16bit();
 					return 1;
@@ -2121,6 +2301,7 @@ unsigned gen_direct(struct node *n)
 				move_a_x();
 				setsize(s);
 				if (nr) {
+					invalidate_store_x();
 					repeated_op(r->value, "dec 0,x");
 					set16bit();
 					return 1;
@@ -2250,6 +2431,21 @@ unsigned gen_direct(struct node *n)
  */
 unsigned gen_uni_direct(struct node *n)
 {
+	struct node *r = n->right;
+	unsigned s = get_size(n->type);
+
+	/* We can stz a direct page local but not n,y */
+	if (n->op == T_LSTORE && (n->flags & NORETURN) && r->op == T_CONSTANT &&
+		r->value == 0 && dp_local(n->value, s)) {
+		invalidate_mem();
+		/* A long is just two word stores */
+		setsize(s == 1 ? 1 : 2);
+		outputnc("stz @%u", n->value);
+		if (s == 4)
+			outputnc("stz @%u", n->value + 2);
+		set16bit();
+		return 1;
+	}
 	return 0;
 }
 
@@ -2259,12 +2455,14 @@ static unsigned argstack_helper(struct node *n, unsigned sz)
 		if (sz <= 2) {
 			if (n->value <= 4) {
 				output("jsr __push%d", n->value);
+				invalidate_a();
 				return 1;
 			}
 			return 0;
 		}
 		if (n->value == 0) {
 			output("jsr __pushl0");
+			invalidate_a();
 			return 1;
 		}
 		if (!(n->value & 0xFFFF0000UL)) {
@@ -2276,6 +2474,7 @@ static unsigned argstack_helper(struct node *n, unsigned sz)
 	/* The common lda n,y push values */
 	if (sz <= 2 && n->op == T_LREF && n->value + sp <= 10 && !((sp + n->value) & 1)) {
 		output("jsr __pushy%d", n->value + sp);
+		set_a_node(n);
 		return 1;
 	}
 	if (n->op == T_LREF) {
@@ -2284,6 +2483,9 @@ static unsigned argstack_helper(struct node *n, unsigned sz)
 		else
 			output("jsr __pushynl");
 		output(".word %d", n->value + sp);
+		/* These use X as well */
+		invalidate_a();
+		invalidate_x();
 		return 1;
 	}
 
@@ -2445,6 +2647,197 @@ static unsigned c_call(struct node *n)
 	return 0;
 }
 
+/* Load the object at offset off from the pointer in X */
+static unsigned deref_x(unsigned size, unsigned off)
+{
+	if (size > 2) {
+		outputnc("lda %d,x", off + 2);
+		outputnc("sta @hireg");
+		outputnc("lda %d,x", off);
+		/* Flags will not be valid because they are for
+		   both halves together */
+		invalidate_a();
+		return 1;
+	}
+	/* TODO: need to look at volatile propogation and volatile
+	   plus hardware I/O for optimizing opportunities */
+	setsize(size);
+	if (size == 2)
+		outputcc("lda %d,x", off);
+	else
+		outputnc("lda %d,x", off);
+	set16bit();
+	invalidate_a();
+	return 1;
+}
+
+/*
+ *	Pointers we can load straight into X without disturbing A. Pointers
+ *	in locals usually got folded into LDEREF and LEQ but can still turn
+ *	up under the assignment operators.
+ */
+static unsigned can_xptr(struct node *n)
+{
+	unsigned op = n->op;
+
+	if (get_size(n->type) != 2)
+		return 0;
+	if (op == T_LREF || op == T_NREF || op == T_LBREF)
+		return 1;
+	if (op == T_NAME || op == T_LABEL || op == T_CONSTANT)
+		return 1;
+	return 0;
+}
+
+static unsigned load_x_ptr(struct node *n)
+{
+	if (!can_xptr(n))
+		return 0;
+	if (n->op == T_LREF) {
+		load_x_local(n);
+		return 1;
+	}
+	if (!x_contains(n)) {
+		do_pri(n, "ldx", pre_none, 0);
+		set_x_node(n);
+	}
+	ccvalid = CC_NONE;
+	return 1;
+}
+
+/* Split an address into something load_x_ptr can handle and an offset */
+static struct node *x_address(struct node *n, unsigned *off)
+{
+	*off = 0;
+	if (n->op == T_PLUS && n->right->op == T_CONSTANT && n->right->value < 254) {
+		*off = n->right->value;
+		n = n->left;
+	}
+	if (n->op == T_LREF || n->op == T_NREF || n->op == T_LBREF)
+		return n;
+	return NULL;
+}
+
+/*
+ *	Assignment operators on *(ptr + n) where ptr is simple. Work out the
+ *	right hand side, then load the pointer into X and work on n,x rather
+ *	than stacking the address and pulling it back. In a DP frame we can
+ *	work on locals the same way with the direct page address instead.
+ */
+static char eq_mem[16];
+
+static void eq_target(struct node *p)
+{
+	if (p) {
+		load_x_ptr(p);
+		invalidate_store_x();
+	} else
+		invalidate_mem();
+}
+
+static unsigned x_eqop(struct node *n)
+{
+	struct node *r = n->right;
+	struct node *p;
+	unsigned size = get_size(n->type);
+	unsigned nr = n->flags & NORETURN;
+	unsigned post = 0;
+	unsigned off;
+	unsigned count;
+	const char *op;
+	const char *pre = NULL;
+
+	if (size > 2 || n->left == NULL)
+		return 0;
+	p = n->left;
+	off = p->value;
+	if (p->op == T_ARGUMENT)
+		off += argbase + frame_len;
+	if ((p->op == T_LOCAL || p->op == T_ARGUMENT) && dp_local(off, size)) {
+		p = NULL;
+		sprintf(eq_mem, "@%u", off);
+	} else {
+		p = x_address(n->left, &off);
+		if (p == NULL)
+			return 0;
+		sprintf(eq_mem, "%u,x", off);
+	}
+
+	switch (n->op) {
+	case T_PLUSPLUS:
+	case T_MINUSMINUS:
+		post = 1;
+	case T_PLUSEQ:
+	case T_MINUSEQ:
+		op = (n->op == T_PLUSPLUS || n->op == T_PLUSEQ) ? "inc" : "dec";
+		/* Small constants we can do directly in memory. The post
+		   forms load the old value first */
+		if (r->op == T_CONSTANT && r->value <= 2) {
+			count = r->value;
+			eq_target(p);
+			setsize(size);
+			if (post && !nr)
+				outputcc("lda %s", eq_mem);
+			while (count--)
+				output("%s %s", op, eq_mem);
+			if (!post && !nr)
+				outputcc("lda %s", eq_mem);
+			set16bit();
+			invalidate_a();
+			return 1;
+		}
+		/* We want the new value so can't do the post forms */
+		if (post && !nr)
+			return 0;
+		if (n->op == T_MINUSMINUS || n->op == T_MINUSEQ) {
+			if (r->op == T_CONSTANT) {
+				eq_target(p);
+				setsize(size);
+				outputnc("lda %s", eq_mem);
+				outputnc("sec");
+				outputcc("sbc #%u", (unsigned) r->value & 0xFFFF);
+			} else {
+				codegen_lr(r);
+				eq_target(p);
+				setsize(size);
+				outputnc("sta @tmp");
+				outputnc("lda %s", eq_mem);
+				outputnc("sec");
+				outputcc("sbc @tmp");
+			}
+			outputnc("sta %s", eq_mem);
+			set16bit();
+			invalidate_a();
+			return 1;
+		}
+		op = "adc";
+		pre = "clc";
+		break;
+	case T_ANDEQ:
+		op = "and";
+		break;
+	case T_OREQ:
+		op = "ora";
+		break;
+	case T_HATEQ:
+		op = "eor";
+		break;
+	default:
+		return 0;
+	}
+	/* Commutative so the order doesn't matter */
+	codegen_lr(r);
+	eq_target(p);
+	setsize(size);
+	if (pre)
+		outputnc("%s", pre);
+	outputcc("%s %s", op, eq_mem);
+	outputnc("sta %s", eq_mem);
+	set16bit();
+	invalidate_a();
+	return 1;
+}
+
 /*
  *	Allow the code generator to shortcut trees it knows
  */
@@ -2543,6 +2936,40 @@ unsigned gen_shortcut(struct node *n)
 		}
 		return 0;
 	}
+	/* Loads and stores via a simple pointer. Load the pointer straight
+	   into X rather than via A */
+	if ((n->op == T_DEREF || n->op == T_DEREFPLUS) && load_x_ptr(r))
+		return deref_x(size, n->value);
+	if ((n->op == T_EQ || n->op == T_EQPLUS) && size <= 4 && can_xptr(l)) {
+		if (size <= 2 && nr && r->op == T_CONSTANT && r->value == 0) {
+			load_x_ptr(l);
+			invalidate_store_x();
+			setsize(size);
+			output("stz %u,x", (unsigned) n->value);
+			set16bit();
+			return 1;
+		}
+		codegen_lr(r);
+		load_x_ptr(l);
+		invalidate_store_x();
+		if (size <= 2) {
+			setsize(size);
+			outputnc("sta %u,x", (unsigned) n->value);
+			set16bit();
+			return 1;
+		}
+		outputnc("sta %u,x", (unsigned) n->value);
+		if (!nr)
+			outputnc("pha");
+		output("lda @hireg");
+		output("sta %u,x", (unsigned) n->value + 2);
+		if (!nr)
+			outputcc("pla");
+		invalidate_a();
+		return 1;
+	}
+	if (x_eqop(n))
+		return 1;
 	/* The left may be a complex expression but also may be something
 	   we can directly reference. The right is the amount */
 	if (n->op == T_PLUSPLUS && leftop_memc(n, "inc"))
@@ -2641,6 +3068,7 @@ static unsigned gen_cast(struct node *n)
 
 static unsigned op_eq(struct node *n, const char *op, const char *pre, unsigned size)
 {
+	invalidate_x();
 	if (size <= 2) {
 		outputnc("plx");
 		setsize(size);
@@ -2766,30 +3194,29 @@ unsigned gen_node(struct node *n)
 		}
 		return 0;
 	case T_LREF:
-		v += sp;
 		if (size <= 2) {
 			if (a_contains(n))
 				return 1;
 			if (x_contains(n)) {
 				if (size == 2)
-					move_a_x_ccvalid();
+					move_x_a_ccvalid();
 				else
-					move_a_x();
+					move_x_a();
 				return 1;
 			}
 			setsize(size);
 			if (size == 2)
-				outputcc("lda %d,y", v);
+				outputcc("lda %s", local_ref(v, size));
 			else
-				outputnc("lda %d,y", v);
+				outputnc("lda %s", local_ref(v, size));
 			set16bit();
 			set_a_node(n);
 			return 1;
 		}
 		if (size == 4) {
-			outputnc("lda %d,y", v + 2);
+			outputnc("lda %s", local_ref(v + 2, 2));
 			outputnc("sta @hireg");
-			outputnc("lda %d,y", v);
+			outputnc("lda %s", local_ref(v, 2));
 			return 1;
 		}
 		return 0;
@@ -2835,9 +3262,9 @@ unsigned gen_node(struct node *n)
 		if (size == 4) {
 			if (!nr)
 				outputnc("pha");
-			outputnc("sta %d,y", n->value + sp);
+			outputnc("sta %s", local_ref(n->value, 2));
 			output("lda @hireg");
-			outputnc("sta %d,y", n->value + sp + 2);
+			outputnc("sta %s", local_ref(n->value + 2, 2));
 			if (!nr)
 				outputnc("pla");
 			invalidate_a();
@@ -2910,15 +3337,15 @@ unsigned gen_node(struct node *n)
 		if (size > 2) {
 			if (nr) {
 				output("plx");
-				outputnc("sta %u,x", n->val2);
+				outputnc("sta %u,x", (unsigned) n->value);
 				output("lda @hireg");
-				output("sta %u,x", n->val2 + 2);
+				output("sta %u,x", (unsigned) n->value + 2);
 			} else {
 				output("plx");
-				output("sta %u,x", n->val2);
+				output("sta %u,x", (unsigned) n->value);
 				outputnc("pha");
 				output("lda @hireg");
-				output("sta %u,x", n->val2 + 2);
+				output("sta %u,x", (unsigned) n->value + 2);
 				outputcc("pla");
 			}
 			invalidate_x();
@@ -2927,7 +3354,7 @@ unsigned gen_node(struct node *n)
 		}
 		output("plx");
 		setsize(size);
-		outputnc("sta %u,x", n->val2);
+		outputnc("sta %u,x", (unsigned) n->value);
 		set16bit();
 		invalidate_a();
 		invalidate_x();
@@ -2940,110 +3367,35 @@ unsigned gen_node(struct node *n)
 		invalidate_regs();
 		return 1;
 	case T_LEQ:
-		/* val2: offset of variable, value: offset on pointer */
-		v += sp;
-		if (size <= 2) {
-			if (x_contains(n))
-				;
-			else if (a_contains(n)) {
-				if (size == 2)
-					move_a_x();
-				else
-					return 1;
-			} else {
-				setsize(size);
-				outputnc("ldx %d,y", v);
-				set16bit();
-				set_x_node(n);
-			}
-		} else {
-			outputnc("ldx %d,y", v);
-			set_x_node(n);
-		}
+		/* value: offset of variable, val2: offset on pointer */
+		load_x_local(n);
+		invalidate_store_x();
 		if (size <= 2) {
 			setsize(size);
-			if (size == 2)
-				outputcc("sta %d,x", n->val2);
-			else
-				outputnc("sta %d,x", n->val2);
+			outputnc("sta %d,x", n->val2);
 			set16bit();
 		} else {
 			if (!nr)
 				outputnc("pha");
-			outputnc("sta %d,x", n->val2 + sp);
+			outputnc("sta %d,x", n->val2);
 			output("lda @hireg");
-			outputnc("sta %d,x", n->val2 + sp + 2);
+			outputnc("sta %d,x", n->val2 + 2);
 			if (!nr)
 				outputnc("pla");
 			invalidate_a();
 		}
 		return 1;
 	case T_LDEREF:
-		/* val2: offset of variable, value: offset on pointer */
-		v += sp;
-		if (size <= 2) {
-			if (x_contains(n))
-				;
-			else if (a_contains(n)) {
-				if (size == 2)
-					move_a_x();
-				else
-					return 1;
-			} else {
-				setsize(size);
-				outputnc("ldx %d,y", v);
-				set16bit();
-				set_x_node(n);
-			}
-		} else {
-			outputnc("ldx %d,y", v);
-			set_x_node(n);
-		}
-		/* Now dereference */
-		if (size > 2) {
-			outputnc("lda %d,x", n->val2 + 2);
-			outputnc("sta @hireg");
-			outputnc("lda %d,x", n->val2);
-			/* Flags will not be valid because they are for
-			   both halves together */
-			invalidate_a();
-			return 1;
-		}
-		/* TODO: need to look at volatile propogation and volatile
-		   plus hardware I/O for optimizing opportunities */
-		setsize(size);
-		if (size == 2)
-			outputcc("lda %d,x", n->val2);
-		else
-			outputnc("lda %d,x", n->val2);
-		set16bit();
-		invalidate_a();
-		return 1;
+		/* value: offset of variable, val2: offset on pointer */
+		load_x_local(n);
+		return deref_x(size, n->val2);
 	case T_DEREF:
 	case T_DEREFPLUS:
 		/* We could optimize the tracing a bit here. A deref
 		   of memory where we know A is a name, local etc is
 		   one where we can update the contents info TODO */
 		move_a_x();
-		if (size > 2) {
-			outputnc("lda %d,x", v + 2);
-			outputnc("sta @hireg");
-			outputnc("lda %d,x", v);
-			/* Flags will not be valid because they are for
-			   both halves together */
-			invalidate_a();
-			return 1;
-		}
-		/* TODO: need to look at volatile propogation and volatile
-		   plus hardware I/O for optimizing opportunities */
-		setsize(size);
-		if (size == 2)
-			outputcc("lda %d,x", v);
-		else
-			outputnc("lda %d,x", v);
-		set16bit();
-		invalidate_a();
-		return 1;
+		return deref_x(size, v);
 	case T_CONSTANT:
 		if (size > 2) {
 			if (v >> 16) {
@@ -3184,6 +3536,8 @@ unsigned gen_node(struct node *n)
 			return 1;
 		}
 		if (!optsize) {
+			invalidate_x();
+			invalidate_mem();
 			output("plx");
 			output("sta @tmp");
 			outputcc("lda 0,x");
@@ -26,6 +26,11 @@
 #define T_REQPLUS	(T_USER+20)	/* *regptr++ =  */
 #define	T_LPLUS		(T_USER+21)	/* address of local[n] into D and X */
 
+/* Register variables are numbered from 1 and live in U. This number is
+   used for Y when it holds a pointer for the length of an expression */
+#define REG_IDX		16
+#define REGNAME(n)	((n)->value == REG_IDX ? 'y' : 'u')
+
 extern unsigned frame_len;	/* Number of bytes of stack frame */
 extern unsigned sp;		/* Stack pointer offset tracking */
 extern unsigned argbase;	/* Argument offset in current function */
@@ -36,6 +41,7 @@ extern unsigned get_size(unsigned t);
 extern unsigned get_stack_size(unsigned t);
 
 extern void repeated_op(unsigned n, const char *op);
+extern void set_cc_branch(unsigned op, unsigned uns, unsigned flip);
 
 extern unsigned cpu_has_d;	/* 16bit ops and 'D' are present */
 extern unsigned cpu_has_xgdx;	/* XGDX is present */
@@ -44,6 +50,8 @@ extern unsigned cpu_has_pshx;	/* Has PSHX PULX */
 extern unsigned cpu_has_y;	/* Has Y register */
 extern unsigned cpu_has_lea;	/* Has LEA. For now 6809 but if we get to HC12... */
 extern unsigned cpu_is_09;	/* Bulding for 6x09 so a bit different */
+extern unsigned cpu_has_aim;	/* 6303 AIM/OIM/EIM/TIM on memory */
+extern unsigned cpu_has_bset;	/* 68HC11 BSET/BCLR on memory */
 extern unsigned cpu_pic;	/* Position independent output (6809 only) */
 
 extern const char *jmp_op;
@@ -56,6 +64,8 @@ extern uint8_t b_val;
 extern unsigned a_valid;
 extern unsigned b_valid;
 extern unsigned d_valid;
+extern uint16_t hi_val;
+extern unsigned hi_valid;
 extern uint16_t x_fpoff;
 extern unsigned x_fprel;
 
@@ -65,18 +75,24 @@ extern void invalidate_a(void);
 extern void invalidate_b(void);
 extern void invalidate_d(void);
 extern void invalidate_work(void);
+extern void invalidate_hi(void);
 extern void invalidate_mem(void);
 extern void set_d_node(struct node *n);
 extern void set_d_node_ptr(struct node *n);
+extern void set_dy_node(struct node *n);
+extern void set_dy_node_ptr(struct node *n);
 extern unsigned d_holds_node(struct node *n);
 extern void modify_a(uint8_t val);
 extern void modify_b(uint8_t val);
+extern void modify_hi(uint16_t val);
 
 /* Code generation helpers */
 extern void load_d_const(uint16_t n);
 extern void load_a_const(uint8_t n);
 extern void load_b_const(uint8_t n);
 extern void add_d_const(uint16_t n);
+extern void load_hi_const(uint16_t n);
+extern void add_hi_const(uint16_t n);
 extern void add_b_const(uint8_t n);
 extern void load_a_b(void);
 extern void load_b_a(void);
@@ -113,6 +129,7 @@ extern unsigned can_load_r_simple(struct node *r, unsigned off);
 extern unsigned can_load_r_with(struct node *r, unsigned off);
 extern unsigned load_x_with(struct node *r, unsigned off);
 extern unsigned load_u_with(struct node *r, unsigned off);
+extern unsigned load_y_with(struct node *r, unsigned off);
 extern unsigned cmp_direct(struct node *n, const char *uop, const char *op);
 extern int count_mul_cost(unsigned n);
 extern void write_mul(unsigned n);
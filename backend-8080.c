@@ -6,7 +6,6 @@
  *	- Avoid the two xchg calls on a void function cleanup (see gen_cleanup)
  *	- Do we want a single "LBREF or NREF name print" fuinction
  *	- Optimize xor 0xff with cpl ?
- *	- Inline load and store of long to static/global/label (certainly for -O2)
  *	- See if we can think down support routines that use the retaddr patching (ideally
  *	  remove them, if not fix Fuzix task switch to save/restore it)
  */
@@ -17,6 +16,7 @@
 #include <stdarg.h>
 #include "compiler.h"
 #include "backend.h"
+#include "backend-byte.h"
 
 #define BYTE(x)		(((unsigned)(x)) & 0xFF)
 #define WORD(x)		(((unsigned)(x)) & 0xFFFF)
@@ -36,8 +36,24 @@ static unsigned func_cleanup;	/* Zero if we can just ret out */
 static unsigned label;		/* Used to hand out local labels in the form X%u */
 
 /*
- *	Output side logic. For now dumb but route everything here so
- *	we can do more useful stuff later
+ *	The condition the next branch treats as true. The false condition
+ *	is always the entry next to it. Anything that sets a different one
+ *	must not be CCFIXED as that needs nz for true.
+ */
+#define CC_NZ		0
+#define CC_Z		1
+#define CC_C		2
+#define CC_NC		3
+#define CC_M		4
+#define CC_P		5
+
+static const char *ccname[] = { "nz", "z", "c", "nc", "m", "p" };
+static unsigned ccflags = CC_NZ;
+
+/*
+ *	Output side logic. Everything goes via the opcode buffer which holds
+ *	a straight run of code so that a mini peephole can tidy it up before
+ *	it is written out. Anything written directly flushes the buffer first.
  */
 
 #define OP_XCHG		1
@@ -74,6 +90,12 @@ static unsigned label;		/* Used to hand out local labels in the form X%u */
 #define OP_ADD		32
 #define OP_ANA		33
 #define OP_ORA		34
+#define OP_SUB		35
+#define OP_XRA		36
+#define OP_CMP		37
+#define OP_SBB		38
+#define OP_CMC		39
+#define OP_CMA		40
 
 #define	R_A		1
 #define R_PSW		1		/* Unless we start CC tracking */
@@ -92,25 +114,205 @@ static unsigned label;		/* Used to hand out local labels in the form X%u */
 #define R_KEEP		1024		/* Not to be removed */
 #define R_ALL		(R_PSW|R_BC|R_DE|R_HL|R_SP|R_MEM)
 
-static void opcode(unsigned code, unsigned rs, unsigned rd, const char *p, ...)
+#define MAXOPS		32	/* Instructions held in the buffer */
+
+static struct opbuf {
+	unsigned code;
+	unsigned rs;		/* Registers used */
+	unsigned rd;		/* Registers changed */
+	char text[128];
+} opbuf[MAXOPS];
+static unsigned opnum;
+
+static void invalidate_all(void);
+static void op_track(const char *t);
+
+/* Write out the first n buffered instructions */
+static void opcode_write(unsigned n)
+{
+	register struct opbuf *o = opbuf;
+	unsigned i;
+
+	for (i = 0; i < n; i++, o++) {
+		if (o->code != OP_LABEL && o->code != OP_COMMENT)
+			putchar('\t');
+		fputs(o->text, stdout);
+		putchar('\n');
+	}
+	opnum -= n;
+	memmove(opbuf, opbuf + n, opnum * sizeof(struct opbuf));
+}
+
+/* Finish and write any data */
+static void opcode_flush(void)
+{
+	opcode_write(opnum);
+}
+
+/* Anything written directly must not overtake the buffered code */
+static void out(const char *p, ...)
 {
 	va_list v;
+
+	opcode_flush();
+	/* We don't know what it does so we don't know what is in any register */
+	invalidate_all();
 	va_start(v, p);
-	if (code != OP_LABEL && code != OP_COMMENT)
-		putchar('\t');
 	vprintf(p, v);
-	putchar('\n');
 	va_end(v);
 }
 
-static void set_segment(unsigned seg)
+/* The instruction before o, skipping the expression separators */
+static struct opbuf *op_prev(struct opbuf *o)
 {
-	/* Track segments for output */
+	while (o > opbuf) {
+		o--;
+		if (o->code != OP_COMMENT)
+			return o;
+	}
+	return NULL;
 }
 
-/* Finish and write any data */
-static void opcode_flush(void)
+static void op_drop(struct opbuf *o)
+{
+	opnum--;
+	memmove(o, o + 1, (opbuf + opnum - o) * sizeof(struct opbuf));
+}
+
+/* The low half of register pair r or 0 if it is not a pair we can move */
+static char op_low(char r)
+{
+	switch(r) {
+	case 'b':
+		return 'c';
+	case 'd':
+		return 'e';
+	case 'h':
+		return 'l';
+	}
+	return 0;
+}
+
+/*
+ *	Mini peephole. Each time an instruction is added look at the end of
+ *	the buffer for things that are easier to spot here than in the
+ *	generator. Labels, branches and calls flush the buffer so we only
+ *	ever see straight line code. This catches most of what rules.8080
+ *	used to have to find by matching text.
+ */
+static unsigned peephole(void)
+{
+	register struct opbuf *b = opbuf + opnum - 1;
+	register struct opbuf *a, *c;
+	char r;
+
+	if (b->code == OP_COMMENT || (a = op_prev(b)) == NULL)
+		return 0;
+
+	/* xchg xchg, push x pop x, inx x dcx x and dcx x inx x */
+	if ((a->code == OP_XCHG && b->code == OP_XCHG) ||
+		(a->code == OP_PUSH && b->code == OP_POP && a->text[5] == b->text[4]) ||
+		(a->code == OP_INX && b->code == OP_DCX && strcmp(a->text + 4, b->text + 4) == 0) ||
+		(a->code == OP_DCX && b->code == OP_INX && strcmp(a->text + 4, b->text + 4) == 0)) {
+		op_drop(b);
+		op_drop(a);
+		return 1;
+	}
+	/* push x pop y is a pair of moves */
+	if (a->code == OP_PUSH && b->code == OP_POP && op_low(a->text[5]) && op_low(b->text[4])) {
+		r = a->text[5];
+		a->code = OP_MOV;
+		sprintf(a->text, "mov %c,%c", b->text[4], r);
+		sprintf(b->text, "mov %c,%c", op_low(b->text[4]), op_low(r));
+		b->code = OP_MOV;
+		return 1;
+	}
+	if ((b->code == OP_MOV || b->code == OP_MVI) && (r = b->text[4]) != 'm') {
+		/* mov x,y mov y,x */
+		if (a->code == OP_MOV && b->code == OP_MOV && a->text[4] == b->text[6] && a->text[6] == r) {
+			op_drop(b);
+			return 1;
+		}
+		/* A register loaded and then loaded again without being used.
+		   Leave loads from memory alone in case they are volatile, and
+		   a load from m uses both H and L */
+		if (((a->code == OP_MOV && a->text[6] != 'm') || a->code == OP_MVI) &&
+			a->text[4] == r && (b->code == OP_MVI ||
+			(b->text[6] != r && !(b->text[6] == 'm' && (r == 'h' || r == 'l'))))) {
+			op_drop(a);
+			return 1;
+		}
+	}
+	/* A pair loaded and then loaded again */
+	if (a->code == OP_LXI && ((b->code == OP_LXI && a->text[4] == b->text[4]) ||
+		(b->code == OP_LHLD && a->text[4] == 'h'))) {
+		op_drop(a);
+		return 1;
+	}
+	/* Load of what we just stored. Only for our own workspace as for
+	   loads above, user memory might be volatile */
+	if (a->code == OP_SHLD && b->code == OP_LHLD && strcmp(a->text + 5, b->text + 5) == 0 &&
+		strncmp(a->text + 5, "__", 2) == 0) {
+		op_drop(b);
+		return 1;
+	}
+	/* lxi h,n shld ... lxi h,n - HL still holds the constant */
+	if (b->code == OP_LXI && b->text[4] == 'h') {
+		for (c = a; c && c->code == OP_SHLD; c = op_prev(c));
+		if (c && c != a && c->code == OP_LXI && strcmp(c->text, b->text) == 0) {
+			op_drop(b);
+			return 1;
+		}
+	}
+	/* xchg pop d xchg and xchg lxi h,n xchg */
+	if (b->code == OP_XCHG && (c = op_prev(a)) != NULL && c->code == OP_XCHG) {
+		if ((a->code == OP_POP && a->text[4] == 'd') || (a->code == OP_LXI && a->text[4] == 'h')) {
+			a->text[4] = a->code == OP_POP ? 'h' : 'd';
+			op_drop(b);
+			op_drop(c);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void opcode(unsigned code, unsigned rs, unsigned rd, const char *p, ...)
+{
+	register struct opbuf *o;
+	char *t;
+	va_list v;
+
+	if (opnum == MAXOPS)
+		opcode_write(1);
+	o = opbuf + opnum++;
+	o->code = code;
+	o->rs = rs;
+	o->rd = rd;
+	va_start(v, p);
+	vsnprintf(o->text, sizeof(o->text), p, v);
+	va_end(v);
+	/* Some of the templates have stray whitespace */
+	for (t = o->text; *t == ' ' || *t == '\t'; t++);
+	memmove(o->text, t, strlen(t) + 1);
+	t = o->text + strlen(o->text);
+	while (t > o->text && t[-1] == '\n')
+		*--t = 0;
+	op_track(o->text);
+	if (opt || optsize)
+		while (opnum && peephole());
+	switch(code) {
+	case OP_LABEL:
+	case OP_JUMP:
+	case OP_CALL:
+	case OP_RET:
+	case OP_DATA:
+		opcode_flush();
+	}
+}
+
+static void set_segment(unsigned seg)
 {
+	/* Track segments for output */
 }
 
 /*
@@ -155,6 +357,351 @@ static unsigned get_stack_size(unsigned t)
 #define T_RSTORE	(T_USER+8)
 #define T_RDEREF	(T_USER+9)		/* *regptr */
 #define T_REQ		(T_USER+10)		/* *regptr */
+#define T_ONESHL	(T_USER+11)		/* 1 << n */
+#define T_BITAND	(T_USER+12)		/* x & (1 << n) */
+
+/*
+ *	Upper node flag fields are ours. The first half belongs to the
+ *	byte analysis in backend-byte.h
+ */
+
+#define REGARG		0x2000			/* Call passes the first argument in HL */
+
+/* With -m8080-regcall the first argument of a prototyped call goes in HL
+   and the called function removes the arguments */
+#define REGCALL		(cpufeat & 1)
+
+/*
+ *	Register tracking. We remember what HL, DE and A hold so that the
+ *	code generator can skip loading a value that is already present.
+ *	Each register can be known to hold up to two equivalent things, for
+ *	example a constant and the variable we just stored it in.
+ *
+ *	Because all code goes through opcode() we work out what each
+ *	instruction does to the registers from its text, so nothing needs
+ *	to remember to invalidate. Anything written with out() is unknown
+ *	and throws everything away, as do calls and labels. The generator
+ *	only has to record what it loaded or stored after it emits it.
+ */
+
+#define TRACK_MAX	2
+
+static struct regtrack {
+	unsigned num;
+	struct node node[TRACK_MAX];
+} track[3];
+static unsigned a_is_l;		/* A and L are known to be the same */
+
+static struct regtrack *track_reg(unsigned r)
+{
+	if (r == R_HL)
+		return track;
+	if (r == R_DE)
+		return track + 1;
+	return track + 2;
+}
+
+static void invalidate_all(void)
+{
+	track[0].num = 0;
+	track[1].num = 0;
+	track[2].num = 0;
+	a_is_l = 0;
+}
+
+static void invalidate(unsigned r)
+{
+	track_reg(r)->num = 0;
+	if (r != R_DE)
+		a_is_l = 0;
+}
+
+/* Turn a node into the form we remember it as so the same object always
+   looks the same */
+static unsigned track_form(struct node *d, struct node *n)
+{
+	unsigned size = get_size(n->type);
+
+	if (size > 2)
+		return 0;
+	memcpy(d, n, sizeof(struct node));
+	d->left = NULL;
+	d->right = NULL;
+	switch(d->op) {
+	case T_LSTORE:
+		d->op = T_LREF;
+		break;
+	case T_LBSTORE:
+		d->op = T_LBREF;
+		break;
+	case T_NSTORE:
+		d->op = T_NREF;
+		break;
+	case T_RSTORE:
+		d->op = T_RREF;
+		break;
+	case T_ARGUMENT:
+		d->value += argbase + frame_len;
+		d->op = T_LOCAL;
+		break;
+	case T_CONSTANT:
+		if (size == 1)
+			d->value = BYTE(d->value);
+		else
+			d->value = WORD(d->value);
+		return 1;
+	case T_NREF:
+	case T_LBREF:
+	case T_LREF:
+	case T_RREF:
+	case T_NAME:
+	case T_LABEL:
+	case T_LOCAL:
+		break;
+	default:
+		return 0;
+	}
+	d->value = WORD(d->value);
+	return 1;
+}
+
+static unsigned holds_node(unsigned r, struct node *n)
+{
+	struct regtrack *t = track_reg(r);
+	struct node *d;
+	struct node m;
+	unsigned i;
+
+	if (t->num == 0 || !track_form(&m, n))
+		return 0;
+	for (i = 0; i < t->num; i++) {
+		d = t->node + i;
+		if (d->op == m.op && d->value == m.value && d->val2 == m.val2 &&
+			d->snum == m.snum && get_size(d->type) == get_size(m.type))
+			return 1;
+	}
+	return 0;
+}
+
+/* Register r now also holds the value described by n */
+static void add_node(unsigned r, struct node *n)
+{
+	struct regtrack *t = track_reg(r);
+	struct node m;
+
+	if (!track_form(&m, n) || holds_node(r, &m))
+		return;
+	/* Keep the most recent */
+	if (t->num == TRACK_MAX)
+		memmove(t->node, t->node + 1, (TRACK_MAX - 1) * sizeof(struct node));
+	else
+		t->num++;
+	memcpy(t->node + t->num - 1, &m, sizeof(struct node));
+}
+
+/* Register r now holds only the value described by n */
+static void set_node(unsigned r, struct node *n)
+{
+	track_reg(r)->num = 0;
+	add_node(r, n);
+}
+
+/* A has been copied to or from L. Only byte sized knowledge survives */
+static void copy_byte(unsigned r, unsigned f)
+{
+	struct regtrack *s = track_reg(f);
+	unsigned i;
+
+	invalidate(r);
+	for (i = 0; i < s->num; i++)
+		if (get_size(s->node[i].type) == 1)
+			add_node(r, s->node + i);
+	a_is_l = 1;
+}
+
+/* We stored HL into n, so HL and possibly A also hold the value of n */
+static void track_store(struct node *n)
+{
+	add_node(R_HL, n);
+	if (get_size(n->type) == 1 && a_is_l)
+		add_node(R_A, n);
+}
+
+/* Get the low byte of HL into A for a store */
+static void load_a_l(void)
+{
+	if (!a_is_l)
+		opcode(OP_MOV, R_L, R_A, "mov a,l");
+}
+
+static void track_drop(struct regtrack *t, unsigned i)
+{
+	t->num--;
+	memmove(t->node + i, t->node + i + 1, (t->num - i) * sizeof(struct node));
+}
+
+/* Forget anything held in a register that refers to memory the instruction
+   text a writes size bytes to. If we can't tell where that is we forget
+   all of memory. Register variable changes are passed as "b" */
+static void track_write(const char *a, unsigned size)
+{
+	struct regtrack *t;
+	struct node *d;
+	const char *p = strchr(a, '+');
+	unsigned len = p ? p - a : strlen(a);
+	unsigned off = p ? atoi(p + 1) : 0;
+	unsigned i;
+	unsigned kill;
+
+	for (t = track; t < track + 3; t++) {
+		i = 0;
+		while (i < t->num) {
+			d = t->node + i;
+			kill = 0;
+			switch(d->op) {
+			case T_RREF:
+				kill = *a == 'b';
+				break;
+			case T_NREF:
+				kill = *a != 'b' && (*a != '_' ||
+					(strlen(namestr(d->snum)) == len - 1 &&
+					memcmp(namestr(d->snum), a + 1, len - 1) == 0));
+				break;
+			case T_LBREF:
+				kill = *a != 'b' && (*a != 'T' || atoi(a + 1) == d->val2);
+				break;
+			case T_LREF:
+				kill = *a != 'b' && *a != '_' && *a != 'T';
+				break;
+			}
+			/* Same object, see if the bytes overlap */
+			if (kill && (d->op == T_NREF || d->op == T_LBREF) && (*a == '_' || *a == 'T')) {
+				if (d->value + get_size(d->type) <= off || off + size <= d->value)
+					kill = 0;
+			}
+			if (kill)
+				track_drop(t, i);
+			else
+				i++;
+		}
+	}
+}
+
+/* Work out what an instruction does to the registers we track */
+static void op_track(const char *t)
+{
+	static const char *aops[] = {
+		"add", "adc", "sub", "sbb", "ana", "xra", "ora", "adi", "aci",
+		"sui", "sbi", "ani", "xri", "ori", "cma", "rlc", "rrc", "ral",
+		"rar", "daa", NULL
+	};
+	const char **op;
+	struct regtrack tmp;
+	char m[8];
+	char r, r2 = 0;
+	unsigned i = 0;
+
+	if (*t == ';')
+		return;
+	while (i < 7 && *t && *t != ' ' && *t != '\t')
+		m[i++] = *t++;
+	m[i] = 0;
+	while (*t == ' ' || *t == '\t')
+		t++;
+	r = *t;
+	if (r && t[1] == ',')
+		r2 = t[2];
+
+	/* Several instructions at once or trailing text we don't understand */
+	if (strchr(t, '\n')) {
+		invalidate_all();
+		return;
+	}
+	if (strcmp(m, "xchg") == 0) {
+		memcpy(&tmp, track, sizeof(tmp));
+		memcpy(track, track + 1, sizeof(tmp));
+		memcpy(track + 1, &tmp, sizeof(tmp));
+		a_is_l = 0;
+		return;
+	}
+	/* Things that change nothing we track. Conditional jumps keep the
+	   state as it is the same on both paths */
+	if (strcmp(m, "push") == 0 || strcmp(m, "sphl") == 0 ||
+		strcmp(m, "cmp") == 0 || strcmp(m, "cpi") == 0 ||
+		strcmp(m, "stc") == 0 || strcmp(m, "cmc") == 0 ||
+		*m == 'j')
+		return;
+	if (strcmp(m, "mov") == 0 || strcmp(m, "mvi") == 0 ||
+		strcmp(m, "inr") == 0 || strcmp(m, "dcr") == 0) {
+		if (r == 'l' && r2 == 'a' && *m == 'm' && m[1] == 'o')
+			copy_byte(R_HL, R_A);
+		else if (r == 'a' && r2 == 'l' && *m == 'm' && m[1] == 'o')
+			copy_byte(R_A, R_HL);
+		else if (r == 'a')
+			invalidate(R_A);
+		else if (r == 'h' || r == 'l')
+			invalidate(R_HL);
+		else if (r == 'd' || r == 'e')
+			invalidate(R_DE);
+		else if (r == 'b' || r == 'c')
+			track_write("b", 2);
+		else
+			track_write("", 2);
+		return;
+	}
+	if (strcmp(m, "lxi") == 0 || strcmp(m, "inx") == 0 ||
+		strcmp(m, "dcx") == 0 || strcmp(m, "pop") == 0) {
+		if (r == 'h')
+			invalidate(R_HL);
+		else if (r == 'd')
+			invalidate(R_DE);
+		else if (r == 'b')
+			track_write("b", 2);
+		else if (r == 'p')
+			invalidate(R_A);
+		return;
+	}
+	if (strcmp(m, "lhld") == 0 || strcmp(m, "lhlx") == 0 ||
+		strcmp(m, "dad") == 0 || strcmp(m, "dsub") == 0 ||
+		strcmp(m, "arhl") == 0) {
+		invalidate(R_HL);
+		return;
+	}
+	if (strcmp(m, "ldsi") == 0 || strcmp(m, "ldhi") == 0 ||
+		strcmp(m, "rdel") == 0) {
+		invalidate(R_DE);
+		return;
+	}
+	if (strcmp(m, "lda") == 0 || strcmp(m, "ldax") == 0) {
+		invalidate(R_A);
+		return;
+	}
+	if (strcmp(m, "shld") == 0) {
+		track_write(t, 2);
+		return;
+	}
+	if (strcmp(m, "sta") == 0) {
+		track_write(t, 1);
+		return;
+	}
+	if (strcmp(m, "stax") == 0 || strcmp(m, "shlx") == 0) {
+		track_write("", 2);
+		return;
+	}
+	if (strcmp(m, "xthl") == 0) {
+		invalidate(R_HL);
+		track_write("", 2);
+		return;
+	}
+	for (op = aops; *op; op++) {
+		if (strcmp(m, *op) == 0) {
+			invalidate(R_A);
+			return;
+		}
+	}
+	/* Calls, labels, data and anything else */
+	invalidate_all();
+}
 
 static void squash_node(struct node *n, struct node *o)
 {
@@ -205,13 +752,28 @@ static unsigned is_simple(struct node *n)
 }
 
 /* Chance to rewrite the tree from the top rather than none by node
-   upwards. We will use this for 8bit ops at some point and for cconly
-   propagation */
+   upwards. Work out which parts can be done 8bit, we will use this for
+   cconly propagation at some point */
 struct node *gen_rewrite(struct node *n)
 {
+	byte_label_tree(n, 0);
 	return n;
 }
 
+/*
+ *	Long globals and statics become direct references when optimizing
+ *	for speed. Storing a constant is smaller inline as well so we do
+ *	that whenever we optimize.
+ */
+static unsigned long_direct(unsigned op, struct node *r, unsigned nt)
+{
+	if (nt != CLONG && nt != ULONG)
+		return 0;
+	if (opt > 1 && !optsize)
+		return 1;
+	return op == T_EQ && r->op == T_CONSTANT && (opt || optsize);
+}
+
 /*
  *	Our chance to do tree rewriting. We don't do much for the 8080
  *	at this point, but we do rewrite name references and function calls
@@ -290,6 +852,24 @@ struct node *gen_rewrite_node(struct node *n)
 			}
 		}
 	}
+	if (long_direct(op, r, nt)) {
+		if (op == T_DEREF && r->op == T_NAME) {
+			squash_right(n, T_NREF);
+			return n;
+		}
+		if (op == T_DEREF && r->op == T_LABEL) {
+			squash_right(n, T_LBREF);
+			return n;
+		}
+		if (op == T_EQ && l->op == T_NAME) {
+			squash_left(n, T_NSTORE);
+			return n;
+		}
+		if (op == T_EQ && l->op == T_LABEL) {
+			squash_left(n, T_LBSTORE);
+			return n;
+		}
+	}
 	/* Eliminate casts for sign, pointer conversion or same */
 	if (op == T_CAST) {
 		if (nt == r->type || (nt ^ r->type) == UNSIGNED ||
@@ -307,6 +887,33 @@ struct node *gen_rewrite_node(struct node *n)
 		free_node(r);
 		n->right = NULL;
 	}
+	/* A prototyped call with arguments passes the first one in HL when
+	   using the register calling convention. Varargs use the stack */
+	if (op == T_CLEANUP && REGCALL && n->val2 == 0 && r->value)
+		l->flags |= REGARG;
+	/* 1 << n is a table lookup rather than a shift loop */
+	if (op == T_LTLT && get_size(nt) == 2 && l->op == T_CONSTANT &&
+		l->value == 1 && r->op != T_CONSTANT) {
+		n->op = T_ONESHL;
+		n->left = NULL;
+		free_node(l);
+		return n;
+	}
+	/* x & (1 << n) is a bit test, mask x directly with the table */
+	if (op == T_AND && get_size(nt) == 2) {
+		if (l->op == T_ONESHL) {
+			struct node *c = l;
+			l = r;
+			r = c;
+		}
+		if (r->op == T_ONESHL) {
+			n->op = T_BITAND;
+			n->left = l;
+			n->right = r->right;
+			free_node(r);
+			return n;
+		}
+	}
 	/* Commutive operations. We can swap the sides over on these */
 	if (op == T_AND || op == T_OR || op == T_HAT || op == T_STAR || op == T_PLUS) {
 /*		printf(";left %d right %d\n", is_simple(n->left), is_simple(n->right)); */
@@ -321,7 +928,7 @@ struct node *gen_rewrite_node(struct node *n)
 /* Export the C symbol */
 void gen_export(const char *name)
 {
-	printf("	.export _%s\n", name);
+	out("	.export _%s\n", name);
 }
 
 void gen_segment(unsigned segment)
@@ -329,16 +936,16 @@ void gen_segment(unsigned segment)
 	set_segment(segment);
 	switch(segment) {
 	case A_CODE:
-		printf("\t.%s\n", codeseg);
+		out("\t.%s\n", codeseg);
 		break;
 	case A_DATA:
-		printf("\t.data\n");
+		out("\t.data\n");
 		break;
 	case A_BSS:
-		printf("\t.bss\n");
+		out("\t.bss\n");
 		break;
 	case A_LITERAL:
-		printf("\t.literal\n");
+		out("\t.literal\n");
 		break;
 	default:
 		error("gseg");
@@ -353,6 +960,13 @@ void gen_prologue(const char *name)
 	unreachable = 0;
 }
 
+/* With the register calling convention a function that takes a fixed
+   set of arguments gets the first in HL and removes them on return */
+static unsigned callee_cleanup(unsigned argsize)
+{
+	return REGCALL && argsize && !(func_flags & F_VARARG);
+}
+
 /* Generate the stack frame */
 /* TODO: defer this to statements so we can ld/push initializers */
 void gen_frame(unsigned size, unsigned aframe)
@@ -365,6 +979,14 @@ void gen_frame(unsigned size, unsigned aframe)
 	else
 		func_cleanup = 0;
 
+	/* Put the first argument back under the return address so that the
+	   arguments are where they normally are */
+	if (callee_cleanup(aframe)) {
+		opcode(OP_XTHL, R_HL|R_SP, R_HL|R_MEM, "xthl");
+		opcode(OP_PUSH, R_HL|R_SP, R_SP, "push h");
+		func_cleanup = 1;
+	}
+
 	argbase = ARGBASE;
 	if (func_flags & F_REG(1)) {
 		opcode(OP_PUSH, R_BC|R_SP, R_SP, "push b");
@@ -386,6 +1008,49 @@ void gen_frame(unsigned size, unsigned aframe)
 	}
 }
 
+/* Return to the caller removing the arguments if they are ours to
+   clean up. HL and __hireg hold the result unless we are void */
+static void gen_return(unsigned argsize)
+{
+	/* TODO: make this a little "ret" func as it has several users */
+	if (!callee_cleanup(argsize)) {
+		if (func_flags & F_VOIDRET)
+			opcode(OP_RET, 0, 0, "ret");
+		else
+			opcode(OP_RET, R_HL, 0, "ret");
+		return;
+	}
+	/* A char argument last in the list still occupies a whole word */
+	argsize = (argsize + 1) & ~1;
+	if (func_flags & F_VOIDRET) {
+		opcode(OP_POP, R_SP, R_SP|R_HL, "pop h");
+		if (argsize > 10) {
+			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+			opcode(OP_LXI, 0, R_HL, "lxi h,0x%x", argsize);
+			opcode(OP_DAD, R_SP|R_HL, R_HL, "dad sp");
+			opcode(OP_SPHL, R_HL, R_SP, "sphl");
+			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+		} else while (argsize) {
+			opcode(OP_POP, R_SP, R_SP|R_DE, "pop d");
+			argsize -= 2;
+		}
+		opcode(OP_JUMP, R_HL, 0, "pchl");
+		return;
+	}
+	if (argsize <= 6) {
+		opcode(OP_POP, R_SP, R_SP|R_DE, "pop d");
+		while (argsize) {
+			opcode(OP_POP, R_SP, R_SP|R_PSW, "pop psw");
+			argsize -= 2;
+		}
+		opcode(OP_PUSH, R_SP|R_DE, R_SP, "push d");
+		opcode(OP_RET, R_HL, 0, "ret");
+	} else {
+		opcode(OP_LXI, 0, R_DE, "lxi d,0x%x", argsize);
+		opcode(OP_JUMP, R_DE|R_HL, 0, "jmp __cleanup");
+	}
+}
+
 void gen_epilogue(unsigned size, unsigned argsize)
 {
 	unsigned x = func_flags & F_VOIDRET;
@@ -423,11 +1088,7 @@ void gen_epilogue(unsigned size, unsigned argsize)
 	}
 	if (func_flags & F_REG(1))
 		opcode(OP_POP, R_SP, R_SP|R_BC, "pop b");
-	/* TODO: make this a little "ret" func as it has several users */
-	if (x)
-		opcode(OP_RET, 0, 0, "ret");
-	else
-		opcode(OP_RET, R_HL, 0, "ret");
+	gen_return(argsize);
 }
 
 void gen_label(const char *tail, unsigned n)
@@ -465,12 +1126,14 @@ void gen_jump(const char *tail, unsigned n)
 
 void gen_jfalse(const char *tail, unsigned n)
 {
-	opcode(OP_JUMP, R_ALL, 0, "jz L%u%s", n, tail);
+	opcode(OP_JUMP, R_ALL, 0, "j%s L%u%s", ccname[ccflags ^ 1], n, tail);
+	ccflags = CC_NZ;
 }
 
 void gen_jtrue(const char *tail, unsigned n)
 {
-	opcode(OP_JUMP, R_ALL, 0, "jnz L%u%s", n, tail);
+	opcode(OP_JUMP, R_ALL, 0, "j%s L%u%s", ccname[ccflags], n, tail);
+	ccflags = CC_NZ;
 }
 
 static void gen_cleanup(unsigned v)
@@ -525,7 +1188,7 @@ void gen_helpcall(struct node *n)
 	   C call format */
 	if (c_style(n))
 		gen_push(n->right);
-	printf("\tcall __");
+	out("\tcall __");
 }
 
 void gen_helptail(struct node *n)
@@ -548,7 +1211,7 @@ void gen_helpclean(struct node *n)
 		gen_cleanup(s);
 		/* C style ops that are ISBOOL didn't set the bool flags */
 		if (n->flags & ISBOOL)
-			printf("\txra a\n\tcmp l\n");
+			out("\txra a\n\tcmp l\n");
 	}
 }
 
@@ -556,7 +1219,7 @@ void gen_switch(unsigned n, unsigned type)
 {
 	opcode(OP_LXI, 0, R_DE, "lxi d,Sw%u", n);
 	/* Nothing is preserved over a switch */
-	printf("\tjmp __switch");
+	out("\tjmp __switch");
 	helper_type(type, 0);
 	putchar('\n');
 }
@@ -633,9 +1296,37 @@ void gen_value(unsigned type, unsigned long value)
 	}
 }
 
+/* How deep we let the stack get before we stop deferring argument
+   cleanup. Locals and arguments have to stay within reach of the byte
+   offset helpers with room left for the calls that follow */
+#define DEFER_MAX	128
+
+static unsigned defer_limit(void)
+{
+	unsigned n = frame_len + argbase;
+	if (n >= DEFER_MAX)
+		return 0;
+	return DEFER_MAX - n;
+}
+
+/* Remove the argument space we left on the stack. Between statements
+   HL is dead so we can skip the work gen_cleanup does to keep it */
+static void flush_cleanup(unsigned v, unsigned exiting)
+{
+	if ((exiting && !(func_flags & F_VOIDRET)) || v <= 10)
+		gen_cleanup(v);
+	else {
+		sp -= v;
+		opcode(OP_LXI, 0, R_HL, "lxi h,%u", v);
+		opcode(OP_DAD, R_SP|R_HL, R_HL, "dad sp");
+		opcode(OP_SPHL, R_HL, R_SP, "sphl");
+	}
+}
+
 void gen_start(void)
 {
-	printf("\t.setcpu %u\n", cpu);
+	gen_flush_cleanup = flush_cleanup;
+	out("\t.setcpu %u\n", cpu);
 }
 
 void gen_end(void)
@@ -646,7 +1337,12 @@ void gen_end(void)
 void gen_tree(struct node *n)
 {
 	codegen_lr(n);
-	opcode(OP_COMMENT, 0, 0, ";");
+	/* Tell copt the working registers are dead unless HL holds something
+	   the next statement may want */
+	if (track[0].num == 0) {
+		opcode(OP_COMMENT, 0, 0, ";");
+		invalidate_all();
+	}
 /*	printf(";SP=%d\n", sp); */
 }
 
@@ -748,11 +1444,11 @@ unsigned gen_lref(unsigned v, unsigned size, unsigned to_de)
 		opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
 
 	if (v < LWDIRECT)
-		printf("\tcall __%s%u\n", name, v + 2);
+		out("\tcall __%s%u\n", name, v + 2);
 	else if (v < 253)
-		printf("\tcall __%s\n\t.byte %u\n", name, v + 2);
+		out("\tcall __%s\n\t.byte %u\n", name, v + 2);
 	else
-		printf("\tcall __%sw\n\t.word %u\n", name, v + 2);
+		out("\tcall __%sw\n\t.word %u\n", name, v + 2);
 
 	if (to_de)
 		opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
@@ -875,20 +1571,48 @@ static unsigned load_bc_with(struct node *n)
 
 static unsigned load_de_with(struct node *n)
 {
-	if (n->op == T_LREF)
-		return gen_lref(n->value + sp, 2, 1);
-	return load_r_with('d', n, R_DE);
-}
+	unsigned r;
+
+	if (holds_node(R_DE, n))
+		return 1;
+	if (get_size(n->type) == 2 && holds_node(R_HL, n)) {
+		opcode(OP_MOV, R_H, R_D, "mov d,h");
+		opcode(OP_MOV, R_L, R_E, "mov e,l");
+		r = 1;
+	} else if (n->op == T_LREF)
+		r = gen_lref(n->value + sp, 2, 1);
+	else
+		r = load_r_with('d', n, R_DE);
+	if (r)
+		set_node(R_DE, n);
+	return r;
+}
 
 static unsigned load_hl_with(struct node *n)
 {
+	unsigned r;
+
+	if (holds_node(R_HL, n))
+		return 1;
 	if (n->op == T_LREF)
-		return gen_lref(n->value + sp, 2, 0);
-	return load_r_with('h', n, R_HL);
+		r = gen_lref(n->value + sp, 2, 0);
+	else
+		r = load_r_with('h', n, R_HL);
+	if (r)
+		set_node(R_HL, n);
+	return r;
 }
 
 static unsigned load_a_with(struct node *n)
 {
+	unsigned size = get_size(n->type);
+
+	if (size == 1 && holds_node(R_A, n))
+		return 1;
+	if (size == 1 && holds_node(R_HL, n)) {
+		opcode(OP_MOV, R_L, R_A, "mov a,l");
+		return 1;
+	}
 	switch(n->op) {
 	case T_CONSTANT:
 		/* We know this is not a long from the checks above */
@@ -914,14 +1638,16 @@ static unsigned load_a_with(struct node *n)
 	default:
 		return 0;
 	}
+	if (size == 1)
+		add_node(R_A, n);
 	return 1;
 }
 
 /* TODO: needs a format change */
-static void repeated_op(const char *o, unsigned n)
+static void repeated_op(unsigned op, unsigned r, const char *o, unsigned n)
 {
 	while(n--)
-		printf("\t%s\n", o);
+		opcode(op, r, r, o);
 }
 
 static void loadhl(struct node *n, unsigned s)
@@ -1060,14 +1786,14 @@ static unsigned gen_fast_div(unsigned s, unsigned n)
 	opcode(OP_JUMP, R_A, 0, "jp X%u", ++label);
 	/* We can trash DE */
 	if (m > 0 && m <= 4)
-		repeated_op("inx h", m);
+		repeated_op(OP_INX, R_HL, "inx h", m);
 	else if (m < 0 && m >= -4)
-		repeated_op("dcx h", -m);
+		repeated_op(OP_DCX, R_HL, "dcx h", -m);
 	else {
 		opcode(OP_LXI, 0, R_HL, "lxi d,%u", (n - 1) & 0xFFFF);
 		opcode(OP_DAD, R_DE|R_HL, R_HL, "dad d");
 	}
-	printf("X%u:\n", label);
+	out("X%u:\n", label);
 	while(n > 1) {
 		opcode(OP_ARHL, R_HL,  R_HL, "arhl");
 		n >>= 1;
@@ -1112,9 +1838,9 @@ static unsigned gen_logicc(struct node *n, unsigned s, const char *op, unsigned
 		} else {
 			opcode(OP_MOV, R_H, R_A, "mov a,h");
 			if (code == 3 && h == 255)
-				printf("\tcpl\n");
+				out("\tcpl\n");
 			else
-				printf("\t%s %u", op, h);
+				out("\t%s %u", op, h);
 			opcode(OP_MOV, R_A, R_H, "mov h,a");
 		}
 	}
@@ -1127,9 +1853,9 @@ static unsigned gen_logicc(struct node *n, unsigned s, const char *op, unsigned
 	} else {
 		opcode(OP_MOV, R_L, R_A, "mov a,l");
 		if (code == 3&& l == 255)
-			printf("\tcpl\n");
+			out("\tcpl\n");
 		else
-			printf("\t%s %u\n", op, l);
+			out("\t%s %u\n", op, l);
 		opcode(OP_MOV, R_A, R_L, "mov l,a");
 	}
 	return 1;
@@ -1187,16 +1913,34 @@ unsigned gen_direct(struct node *n)
 
 	switch (n->op) {
 	case T_CLEANUP:
-		gen_cleanup(v);
+		/* The called function removed the arguments */
+		if (n->left->flags & REGARG)
+			sp -= v - 2;
+		else
+			gen_cleanup(defer_cleanup(n, v, sp, defer_limit()));
+		return 1;
+	case T_CALLNAME:
+		/* The first argument stays in HL. Only the upper half of a long
+		   or float goes on the stack */
+		if (!(n->flags & REGARG))
+			return 0;
+		if (get_stack_size(n->left->type) == 4) {
+			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+			opcode(OP_LHLD, R_M, R_HL, "lhld __hireg");
+			opcode(OP_PUSH, R_SP|R_HL, R_SP, "push h");
+			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+			sp += 2;
+		}
+		opcode(OP_CALL, R_HL, R_BC|R_DE|R_HL|R_PSW, "call _%s+%u", namestr(n->snum), WORD(n->value));
 		return 1;
 	case T_NSTORE:
 		if (s > 2)
 			return 0;
 		if (s == 1)
-			printf("\tmov a,l\n\tsta");
+			out("\tmov a,l\n\tsta");
 		else
-			printf("\tshld ");
-		printf("_%s+%u\n", namestr(n->snum), WORD(n->value));
+			out("\tshld ");
+		out("_%s+%u\n", namestr(n->snum), WORD(n->value));
 			return 1;
 		/* TODO 4/8 for long etc */
 		return 0;
@@ -1204,10 +1948,10 @@ unsigned gen_direct(struct node *n)
 		if (s > 2)
 			return 0;
 		if (s == 1)
-			printf("\tmov a,l\n\tsta");
+			out("\tmov a,l\n\tsta");
 		else
-			printf("\tshld");
-		printf(" T%u+%u\n", n->val2, v);
+			out("\tshld");
+		out(" T%u+%u\n", n->val2, v);
 		return 1;
 	case T_RSTORE:
 		loadbc(s);
@@ -1221,7 +1965,7 @@ unsigned gen_direct(struct node *n)
 			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
 			if (load_hl_with(r) == 0)
 				error("teq");
-			printf("\tshlx\n");
+			out("\tshlx\n");
 			return 1;
 		}
 		if (s == 1) {
@@ -1246,9 +1990,9 @@ unsigned gen_direct(struct node *n)
 				return 1;
 			if (v < 4 && s <= 2) {
 				if (s == 1)
-					repeated_op("inr l", v);
+					repeated_op(OP_INC, R_L, "inr l", v);
 				else
-					repeated_op("inx h", v);
+					repeated_op(OP_INX, R_HL, "inx h", v);
 				return 1;
 			}
 		}
@@ -1276,9 +2020,9 @@ unsigned gen_direct(struct node *n)
 				return 1;
 			if (v < 6 && s <= 2) {
 				if (s == 1)
-					repeated_op("dcr l", v);
+					repeated_op(OP_DEC, R_L, "dcr l", v);
 				else
-					repeated_op("dcx h", v);
+					repeated_op(OP_DCX, R_HL, "dcx h", v);
 				return 1;
 			}
 			opcode(OP_LXI, 0, R_DE, "lxi d,%u", 65536 - v);
@@ -1363,7 +2107,7 @@ unsigned gen_direct(struct node *n)
 	case T_LTLT:
 		if (s <= 2 && r->op == T_CONSTANT && r->value <= 8) {
 			if (r->value < 8)
-				repeated_op("dad h", r->value);
+				repeated_op(OP_DAD, R_HL, "dad h", r->value);
 			else {
 				opcode(OP_MOV, R_L, R_H, "mov h,l");
 				opcode(OP_MVI, 0, R_L, "mvi l,0");
@@ -1381,11 +2125,13 @@ unsigned gen_direct(struct node *n)
 		/* 8085 has a signed right shift 16bit */
 		if (cpu == 8085 && (!(n->type & UNSIGNED))) {
 			if (s == 2 && r->op == T_CONSTANT && v < 8) {
-				repeated_op("arhl", v);
+				repeated_op(OP_ARHL, R_HL, "arhl", v);
 				return 1;
 			}
 		}
 		return gen_deop("shrde", n, r, 1);
+	case T_BITAND:
+		return gen_deop("bitandde", n, r, 0);
 	/* Shorten post inc/dec if result not needed - in which case it's the same as
 	   pre inc/dec */
 	case T_PLUSPLUS:
@@ -1394,20 +2140,20 @@ unsigned gen_direct(struct node *n)
 	case T_PLUSEQ:
 		if (s == 1) {
 			if (r->op == T_CONSTANT && r->value < 4 && nr)
-				repeated_op("inr m", r->value);
+				repeated_op(OP_INC, R_M, "inr m", r->value);
 			else {
 				if (load_a_with(r) == 0)
 					return 0;
-				printf("\tadd m\n\tmov m,a\n");
+				out("\tadd m\n\tmov m,a\n");
 				if (!nr)
-					printf("\tmov l,a\n");
+					out("\tmov l,a\n");
 			}
 			return 1;
 		}
 		if (s == 2 && nr && r->op == T_CONSTANT && (r->value & 0x00FF) == 0) {
-			opcode(OP_INC, R_HL, R_HL, "inx h");
+			opcode(OP_INX, R_HL, R_HL, "inx h");
 			if ((r->value >> 8) < 4) {
-				repeated_op("inr m", r->value >> 8);
+				repeated_op(OP_INC, R_M, "inr m", r->value >> 8);
 				return 1;
 			}
 			opcode(OP_MVI, 0, R_A, "mvi a,%u", r->value >> 8);
@@ -1423,24 +2169,24 @@ unsigned gen_direct(struct node *n)
 		if (s == 1) {
 			/* Shortcut for small 8bit values */
 			if (r->op == T_CONSTANT && r->value < 4 && (n->flags & NORETURN)) {
-				repeated_op("dcr m", r->value);
+				repeated_op(OP_DEC, R_M, "dcr m", r->value);
 			} else {
 				/* Subtraction is not transitive so this is
 				   messier */
 				if (r->op == T_CONSTANT) {
 					if (r->value == 1)
-						printf("\tmov a,m\n\tdcr a\n\tmov m,a");
+						out("\tmov a,m\n\tdcr a\n\tmov m,a");
 					else
-						printf("\tmov a,m\n\tsbi %u\n\tmov m,a",
+						out("\tmov a,m\n\tsbi %u\n\tmov m,a",
 							(int)r->value);
 				} else {
 					if (load_a_with(r) == 0)
 						return 0;
-					printf("\tcma\n\tinr a\n\n");
-					printf("\tsub m\n\tmov m,a\n");
+					out("\tcma\n\tinr a\n\n");
+					out("\tsub m\n\tmov m,a\n");
 				}
 				if (!(n->flags & NORETURN))
-					printf("\tmov l,a\n");
+					out("\tmov l,a\n");
 			}
 			return 1;
 		}
@@ -1449,9 +2195,9 @@ unsigned gen_direct(struct node *n)
 		if (s == 1) {
 			if (load_a_with(r) == 0)
 				return 0;
-			printf("\tana m\n\tmov m,a\n");
+			out("\tana m\n\tmov m,a\n");
 			if (!(n->flags & NORETURN))
-				printf("\tmov l,a\n");
+				out("\tmov l,a\n");
 			return 1;
 		}
 		return gen_deop("andeqde", n, r, 0);
@@ -1459,9 +2205,9 @@ unsigned gen_direct(struct node *n)
 		if (s == 1) {
 			if (load_a_with(r) == 0)
 				return 0;
-			printf("\tora m\n\tmov m,a\n");
+			out("\tora m\n\tmov m,a\n");
 			if (!(n->flags & NORETURN))
-				printf("\tmov l,a\n");
+				out("\tmov l,a\n");
 			return 1;
 		}
 		return gen_deop("oreqde", n, r, 0);
@@ -1469,9 +2215,9 @@ unsigned gen_direct(struct node *n)
 		if (s == 1) {
 			if (load_a_with(r) == 0)
 				return 0;
-			printf("\txra m\n\tmov m,a\n");
+			out("\txra m\n\tmov m,a\n");
 			if (!(n->flags & NORETURN))
-				printf("\tmov l,a\n");
+				out("\tmov l,a\n");
 			return 1;
 		}
 		return gen_deop("xoreqde", n, r, 0);
@@ -1502,14 +2248,14 @@ static unsigned reg_incdec(unsigned s, int v)
 {
 	if (s == 1) {
 		if (v < 0)
-			repeated_op("dcr c", -v);
+			repeated_op(OP_DEC, R_C, "dcr c", -v);
 		else
-			repeated_op("inr c", v);
+			repeated_op(OP_INC, R_C, "inr c", v);
 	} else {
 		if (v < 0)
-			repeated_op("dcx b", -v);
+			repeated_op(OP_DCX, R_BC, "dcx b", -v);
 		else
-			repeated_op("inx b", v);
+			repeated_op(OP_INX, R_BC, "inx b", v);
 	}
 	return 1;
 }
@@ -1522,17 +2268,519 @@ static void reg_logic(struct node *n, unsigned s, unsigned op, const char *i)
 	if (opt > 1) {
 		/* TODO - can avoid the reload into HL if NORETURN */
 		if (s == 2)
-			printf("\tmov a,b\n\t%s h\n\tmov b,a\nmov h,a\n", i + 2);
-		printf("\tmov a,c\n\t%s c\n\tmov c,a\nmov l,a\n", i + 2);
+			out("\tmov a,b\n\t%s h\n\tmov b,a\nmov h,a\n", i + 2);
+		out("\tmov a,c\n\t%s c\n\tmov c,a\nmov l,a\n", i + 2);
 	} else {
 		helper(n, i);
 		loadhl(n, s);
 	}
 }
+/*
+ *	8bit expressions. backend-byte.c marks the parts of the tree where
+ *	only the low byte of the result matters. Where that part is simple
+ *	enough we work it in A instead of widening it into HL and trimming it
+ *	back again. Only A and HL are used so a pointer can be held in DE.
+ */
+
+/* Casts within a byte tree don't change the low byte */
+static struct node *byte_strip(struct node *n)
+{
+	while (n->op == T_CAST && (n->flags & BYTEOP))
+		n = n->right;
+	return n;
+}
+
+/* Something we can use directly as the argument of an 8bit ALU op */
+static unsigned byte_operand(struct node *n)
+{
+	unsigned op = n->op;
+	return op == T_CONSTANT || op == T_NREF || op == T_LBREF ||
+		op == T_LREF || op == T_RREF;
+}
+
+static unsigned byte_swap_ok(unsigned op)
+{
+	return op == T_PLUS || op == T_AND || op == T_OR || op == T_HAT;
+}
+
+/* Can we compute the low byte of n into A */
+static unsigned can_byte_a(struct node *n)
+{
+	struct node *r;
+
+	n = byte_strip(n);
+	if (byte_operand(n))
+		return 1;
+	if (!(n->flags & BYTEOP))
+		return 0;
+	switch(n->op) {
+	case T_LTLT:
+		r = byte_strip(n->right);
+		if (r->op != T_CONSTANT || r->value > 7)
+			return 0;
+		break;
+	case T_PLUS:
+	case T_MINUS:
+	case T_AND:
+	case T_OR:
+	case T_HAT:
+		if (!byte_operand(byte_strip(n->right))) {
+			/* Both sides are work so the right goes via the stack */
+			if (!byte_swap_ok(n->op) || !byte_operand(byte_strip(n->left)))
+				return can_byte_a(n->right) && can_byte_a(n->left);
+			r = n->right;
+			n->right = n->left;
+			n->left = r;
+		}
+		break;
+	default:
+		return 0;
+	}
+	return can_byte_a(n->left);
+}
+
+static unsigned byte_de_busy;	/* DE holds the pointer we will store via */
+
+/* Point HL at a stack byte unless it already is */
+static void byte_lref_hl(unsigned v)
+{
+	struct node m;
+
+	memset(&m, 0, sizeof(m));
+	m.op = T_LOCAL;
+	m.type = CCHAR + 1;
+	m.value = v;
+	if (holds_node(R_HL, &m))
+		return;
+	opcode(OP_LXI, 0, R_HL, "lxi h,%u", WORD(v + sp));
+	opcode(OP_DAD, R_SP|R_HL, R_HL, "dad sp");
+	set_node(R_HL, &m);
+}
+
+/* The 8085 can point DE at a stack byte more compactly */
+static unsigned byte_lref_de(unsigned v)
+{
+	if (cpu != 8085 || byte_de_busy || v + sp > 255)
+		return 0;
+	opcode(OP_LDSI, R_SP, R_DE, "ldsi %u", v + sp);
+	return 1;
+}
+
+static void byte_load(struct node *n)
+{
+	unsigned v = WORD(n->value);
+
+	if (get_size(n->type) == 1 && holds_node(R_A, n))
+		return;
+	if (holds_node(R_HL, n)) {
+		load_a_l();
+		return;
+	}
+	switch(n->op) {
+	case T_CONSTANT:
+		opcode(OP_MVI, 0, R_A, "mvi a,%u", BYTE(v));
+		break;
+	case T_NREF:
+		opcode(OP_LDA, R_MEM, R_A, "lda _%s+%u", namestr(n->snum), v);
+		break;
+	case T_LBREF:
+		opcode(OP_LDA, R_MEM, R_A, "lda T%u+%u", n->val2, v);
+		break;
+	case T_LREF:
+		if (byte_lref_de(v))
+			opcode(OP_LDAX, R_DE|R_M, R_A, "ldax d");
+		else {
+			byte_lref_hl(v);
+			opcode(OP_MOV, R_HL|R_M, R_A, "mov a,m");
+		}
+		break;
+	case T_RREF:
+		opcode(OP_MOV, R_C, R_A, "mov a,c");
+		break;
+	}
+	if (get_size(n->type) == 1)
+		set_node(R_A, n);
+}
+
+/* Write an ALU op on A with n, or with H holding a value we stacked and
+   popped back if n is NULL */
+static void byte_op(unsigned code, const char *imm, const char *reg, struct node *n)
+{
+	unsigned v;
+
+	if (n == NULL) {
+		opcode(code, R_A|R_H, R_A, "%s h", reg);
+		return;
+	}
+	v = WORD(n->value);
+	switch(n->op) {
+	case T_CONSTANT:
+		opcode(code, R_A, R_A, "%s %u", imm, BYTE(v));
+		return;
+	case T_NREF:
+		opcode(OP_LXI, 0, R_HL, "lxi h,_%s+%u", namestr(n->snum), v);
+		break;
+	case T_LBREF:
+		opcode(OP_LXI, 0, R_HL, "lxi h,T%u+%u", n->val2, v);
+		break;
+	case T_LREF:
+		byte_lref_hl(v);
+		break;
+	case T_RREF:
+		opcode(code, R_A|R_C, R_A, "%s c", reg);
+		return;
+	}
+	opcode(code, R_A|R_HL|R_M, R_A, "%s m", reg);
+}
+
+/* Generate a tree that passed can_byte_a into A */
+static void gen_byte_a(struct node *n)
+{
+	struct node *r;
+	unsigned v;
+
+	n = byte_strip(n);
+	if (byte_operand(n)) {
+		byte_load(n);
+		return;
+	}
+	r = byte_strip(n->right);
+	if (!byte_operand(r)) {
+		/* Work out the right, stack it and use it from H */
+		gen_byte_a(r);
+		opcode(OP_PUSH, R_SP|R_PSW, R_SP, "push psw");
+		sp += 2;
+		gen_byte_a(n->left);
+		opcode(OP_POP, R_SP, R_SP|R_HL, "pop h");
+		sp -= 2;
+		r = NULL;
+	} else
+		gen_byte_a(n->left);
+	v = 0;
+	if (r && r->op == T_CONSTANT)
+		v = BYTE(r->value);
+	switch(n->op) {
+	case T_LTLT:
+		repeated_op(OP_ADD, R_A, "add a", v);
+		break;
+	case T_PLUS:
+		if (v == 1)
+			opcode(OP_INC, R_A, R_A, "inr a");
+		else if (v == 0xFF)
+			opcode(OP_DEC, R_A, R_A, "dcr a");
+		else
+			byte_op(OP_ADD, "adi", "add", r);
+		break;
+	case T_MINUS:
+		if (v == 1)
+			opcode(OP_DEC, R_A, R_A, "dcr a");
+		else
+			byte_op(OP_SUB, "sui", "sub", r);
+		break;
+	case T_AND:
+		byte_op(OP_ANA, "ani", "ana", r);
+		break;
+	case T_OR:
+		byte_op(OP_ORA, "ori", "ora", r);
+		break;
+	case T_HAT:
+		byte_op(OP_XRA, "xri", "xra", r);
+		break;
+	}
+}
+
+/* Byte stores and narrowing casts of a tree we can do in A */
+static unsigned gen_byte_store(struct node *n)
+{
+	struct node *r = n->right;
+	unsigned nr = n->flags & NORETURN;
+	unsigned v = WORD(n->value);
+
+	switch(n->op) {
+	case T_CAST:
+	case T_RSTORE:
+	case T_NSTORE:
+	case T_LBSTORE:
+	case T_LSTORE:
+	case T_EQ:
+		break;
+	default:
+		return 0;
+	}
+	if (!can_byte_a(r) || byte_operand(r))
+		return 0;
+	switch(n->op) {
+	case T_CAST:
+		if (!(n->flags & BYTEROOT))
+			return 0;
+		gen_byte_a(r);
+		opcode(OP_MOV, R_A, R_L, "mov l,a");
+		return 1;
+	case T_RSTORE:
+		gen_byte_a(r);
+		opcode(OP_MOV, R_A, R_C, "mov c,a");
+		break;
+	case T_NSTORE:
+		gen_byte_a(r);
+		opcode(OP_STA, R_A, R_MEM, "sta _%s+%u", namestr(n->snum), v);
+		break;
+	case T_LBSTORE:
+		gen_byte_a(r);
+		opcode(OP_STA, R_A, R_MEM, "sta T%u+%u", n->val2, v);
+		break;
+	case T_LSTORE:
+		gen_byte_a(r);
+		if (v + sp == 0) {
+			opcode(OP_POP, R_SP, R_SP|R_HL, "pop h");
+			opcode(OP_MOV, R_A, R_L, "mov l,a");
+			opcode(OP_PUSH, R_SP|R_HL, R_SP, "push h");
+		} else if (byte_lref_de(v))
+			opcode(OP_STAX, R_A|R_DE, R_MEM, "stax d");
+		else {
+			byte_lref_hl(v);
+			opcode(OP_MOV, R_A|R_HL, R_M, "mov m,a");
+		}
+		break;
+	case T_EQ:
+		codegen_lr(n->left);
+		opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+		byte_de_busy = 1;
+		gen_byte_a(r);
+		byte_de_busy = 0;
+		opcode(OP_STAX, R_A|R_DE, R_MEM, "stax d");
+		if (!nr)
+			opcode(OP_MOV, R_A, R_L, "mov l,a");
+		return 1;
+	}
+	add_node(R_A, n);
+	if (!nr)
+		opcode(OP_MOV, R_A, R_L, "mov l,a");
+	return 1;
+}
+
+/* The compare side of a byte compare. Either a constant in the range of
+   the type or a widening of a byte value with the same signedness */
+static struct node *byte_cmp_side(struct node *n, unsigned *t)
+{
+	unsigned v;
+
+	if (n->op == T_CONSTANT) {
+		v = WORD(n->value);
+		if (v <= 0x7F || (*t == CCHAR && v >= 0xFF80) ||
+			(*t == UCHAR && v <= 0xFF))
+			return n;
+		return NULL;
+	}
+	if (n->op != T_CAST || get_size(n->right->type) != 1)
+		return NULL;
+	if (*t == 0xFF)
+		*t = n->right->type;
+	else if (*t != n->right->type)
+		return NULL;
+	return n->right;
+}
+
+/* Compare the result of a tree in A with a constant or simple value for
+   a condition. The branch can use carry directly unless the sense is
+   fixed, in which case we turn carry into nz with sbb a */
+static unsigned gen_byte_cmp(struct node *n, unsigned fixed)
+{
+	struct node *l, *r, *t;
+	unsigned op = n->op;
+	unsigned type = 0xFF;
+
+	if (op != T_EQEQ && op != T_BANGEQ && op != T_LT && op != T_GT &&
+		op != T_LTEQ && op != T_GTEQ)
+		return 0;
+	if (get_size(n->left->type) != 2)
+		return 0;
+	/* Work out the type first as constants depend on it */
+	if (n->left->op == T_CONSTANT) {
+		r = byte_cmp_side(n->right, &type);
+		l = byte_cmp_side(n->left, &type);
+	} else {
+		l = byte_cmp_side(n->left, &type);
+		r = l ? byte_cmp_side(n->right, &type) : NULL;
+	}
+	if (l == NULL || r == NULL || type == 0xFF)
+		return 0;
+	if (op != T_EQEQ && op != T_BANGEQ && type != UCHAR)
+		return 0;
+	/* a > b is b < a and a <= b is b >= a unless we can adjust a constant */
+	if ((op == T_GT || op == T_LTEQ) &&
+		(r->op != T_CONSTANT || WORD(r->value) >= 0xFF)) {
+		t = l;
+		l = r;
+		r = t;
+		op = (op == T_GT) ? T_LT : T_GTEQ;
+	}
+	if (!byte_operand(byte_strip(r))) {
+		if (op != T_EQEQ && op != T_BANGEQ)
+			return 0;
+		t = l;
+		l = r;
+		r = t;
+	}
+	r = byte_strip(r);
+	if (!byte_operand(r) || !can_byte_a(l))
+		return 0;
+	gen_byte_a(l);
+	switch(op) {
+	case T_BANGEQ:
+		if (r->op == T_CONSTANT && BYTE(r->value) == 0)
+			opcode(OP_ORA, R_A, R_A, "ora a");
+		else
+			byte_op(OP_SUB, "sui", "sub", r);
+		return 1;
+	case T_EQEQ:
+		if (r->op != T_CONSTANT || BYTE(r->value))
+			byte_op(OP_SUB, "sui", "sub", r);
+		else if (!fixed)
+			opcode(OP_ORA, R_A, R_A, "ora a");
+		if (!fixed) {
+			ccflags = CC_Z;
+			return 1;
+		}
+		opcode(OP_SUB, R_A, R_A, "sui 1");
+		break;
+	case T_GT:
+	case T_LTEQ:
+		opcode(OP_CMP, R_A, R_A, "cpi %u", BYTE(r->value + 1));
+		if (!fixed) {
+			ccflags = op == T_GT ? CC_NC : CC_C;
+			return 1;
+		}
+		if (op == T_GT)
+			opcode(OP_CMC, R_PSW, R_PSW, "cmc");
+		break;
+	case T_LT:
+	case T_GTEQ:
+		byte_op(OP_CMP, "cpi", "cmp", r);
+		if (!fixed) {
+			ccflags = op == T_LT ? CC_C : CC_NC;
+			return 1;
+		}
+		if (op == T_GTEQ)
+			opcode(OP_CMC, R_PSW, R_PSW, "cmc");
+		break;
+	}
+	/* Fixed sense, turn carry into 0xFF for nz */
+	opcode(OP_SBB, R_A, R_A, "sbb a");
+	return 1;
+}
+
+/*
+ *	Compares against 0 and -1 whose result is only wanted for a branch.
+ *	Our branches treat nz as true so build the flags that way round. The
+ *	signed ordered cases only need the sign bit, a > -1 is a >= 0 and
+ *	a <= -1 is a < 0.
+ */
+static unsigned gen_cc_compare(struct node *n, unsigned fixed)
+{
+	struct node *l = n->left;
+	struct node *r = n->right;
+	unsigned op = n->op;
+	unsigned s = get_size(n->type);
+	unsigned m = s == 1 ? 0xFF : 0xFFFF;
+	unsigned v = 0;
+
+	/* !x is x == 0 */
+	if (op == T_BANG) {
+		l = r;
+		s = get_size(l->type);
+		if (s > 2)
+			return 0;
+		op = T_EQEQ;
+	} else {
+		if (op != T_EQEQ && op != T_BANGEQ && op != T_LT && op != T_GT &&
+			op != T_LTEQ && op != T_GTEQ)
+			return 0;
+		if (s > 2 || r->op != T_CONSTANT)
+			return 0;
+		v = r->value & m;
+		if (v != 0 && v != m)
+			return 0;
+	}
+	if (op != T_EQEQ && op != T_BANGEQ) {
+		if ((n->type & UNSIGNED) || PTR(n->type))
+			return 0;
+		if (v == m && op == T_GT)
+			op = T_GTEQ;
+		else if (v == m && op == T_LTEQ)
+			op = T_LT;
+		else if (v == m || (op != T_LT && op != T_GTEQ))
+			return 0;
+	}
+	/* The fixed sense forms are bigger than the helper call */
+	if (fixed && optsize && op != T_BANGEQ && op != T_LT)
+		return 0;
+	codegen_lr(l);
+	if (s == 1)
+		load_a_l();
+	else
+		opcode(OP_MOV, R_H, R_A, "mov a,h");
+	if (op == T_LT || op == T_GTEQ) {
+		if (!fixed) {
+			opcode(OP_ORA, R_A, R_A, "ora a");
+			ccflags = op == T_LT ? CC_M : CC_P;
+			return 1;
+		}
+		if (op == T_GTEQ)
+			opcode(OP_CMA, R_A, R_A, "cma");
+		opcode(OP_ANA, R_A, R_A, "ani 0x80");
+		return 1;
+	}
+	/* A is zero for the value we are looking for */
+	if (s == 2) {
+		if (v)
+			opcode(OP_ANA, R_A|R_L, R_A, "ana l");
+		else
+			opcode(OP_ORA, R_A|R_L, R_A, "ora l");
+	}
+	if (op == T_BANGEQ || !fixed) {
+		if (v)
+			opcode(OP_INC, R_A, R_A, "inr a");
+		else if (s == 1)
+			opcode(OP_ORA, R_A, R_A, "ora a");
+		if (op == T_EQEQ)
+			ccflags = CC_Z;
+		return 1;
+	}
+	/* Carry is set only for the value we want, turn it into 0xFF */
+	if (v)
+		opcode(OP_ADD, R_A, R_A, "adi 1");
+	else
+		opcode(OP_SUB, R_A, R_A, "sui 1");
+	opcode(OP_SBB, R_A, R_A, "sbb a");
+	return 1;
+}
+
 /*
  *	Allow the code generator to short cut any subtrees it can directly
  *	generate.
  */
+/* Store a long constant a word at a time through HL */
+static void gen_long_cstore(struct node *n)
+{
+	unsigned lo = WORD(n->right->value);
+	unsigned hi = WORD(n->right->value >> 16);
+	unsigned v = WORD(n->value);
+
+	opcode(OP_LXI, 0, R_HL, "lxi h,%u", hi);
+	if (n->op == T_NSTORE)
+		opcode(OP_SHLD, R_HL, R_M, "shld _%s+%u", namestr(n->snum), v + 2);
+	else
+		opcode(OP_SHLD, R_HL, R_M, "shld T%u+%u", n->val2, v + 2);
+	if (!(n->flags & NORETURN))
+		opcode(OP_SHLD, R_HL, R_M, "shld __hireg");
+	if (lo != hi)
+		opcode(OP_LXI, 0, R_HL, "lxi h,%u", lo);
+	if (n->op == T_NSTORE)
+		opcode(OP_SHLD, R_HL, R_M, "shld _%s+%u", namestr(n->snum), v);
+	else
+		opcode(OP_SHLD, R_HL, R_M, "shld T%u+%u", n->val2, v);
+}
+
 unsigned gen_shortcut(struct node *n)
 {
 	unsigned s = get_size(n->type);
@@ -1560,15 +2808,28 @@ unsigned gen_shortcut(struct node *n)
 	 * until we generate the subtree. So generate the tree, then
 	 * either do nice things or use the helper */
 	if (n->op == T_BOOL) {
+		/* The value of && and || under us is only wanted for the flags
+		   too, so their operands can use the flags only compares */
+		if ((n->flags & CCONLY) && (r->op == T_ANDAND || r->op == T_OROR))
+			r->flags |= CCONLY;
+		/* Byte compares can go straight to the flags */
+		if ((opt || optsize) && (n->flags & CCONLY) &&
+			gen_byte_cmp(r, n->flags & CCFIXED))
+			return 1;
+		if ((n->flags & CCONLY) && gen_cc_compare(r, n->flags & CCFIXED))
+			return 1;
 		codegen_lr(r);
 		if (r->flags & ISBOOL)
 			return 1;
 		s = get_size(r->type);
 		if (s <= 2 && (n->flags & CCONLY)) {
-			if (s == 2)
-				printf("\tmov a,h\n\tora l\n");
-			else
-				printf("\tmov a,l\n\tora a\n");
+			if (s == 2) {
+				opcode(OP_MOV, R_H, R_A, "mov a,h");
+				opcode(OP_ORA, R_A|R_L, R_A, "ora l");
+			} else {
+				load_a_l();
+				opcode(OP_ORA, R_A, R_A, "ora a");
+			}
 			return 1;
 		}
 		/* Too big or value needed */
@@ -1576,15 +2837,26 @@ unsigned gen_shortcut(struct node *n)
 		n->flags |= ISBOOL;
 		return 1;
 	}
+	/* Byte sized work we can do entirely in A */
+	if ((opt || optsize) && s == 1 && gen_byte_store(n))
+		return 1;
+	/* Long constant into a global or static */
+	if ((n->op == T_NSTORE || n->op == T_LBSTORE) && s == 4 &&
+		r->op == T_CONSTANT) {
+		gen_long_cstore(n);
+		return 1;
+	}
 	/* Re-order assignments we can do the simple way */
 	if (n->op == T_NSTORE && s <= 2) {
 		codegen_lr(r);
 		/* Expression result is now in HL */
 		if (s == 2)
-			printf("\tshld");
-		else
-			printf("\tmov a,l\n\tsta");
-		printf(" _%s+%u\n", namestr(n->snum), WORD(n->value));
+			opcode(OP_SHLD, R_HL, R_M, "shld _%s+%u", namestr(n->snum), WORD(n->value));
+		else {
+			load_a_l();
+			opcode(OP_STA, R_A, R_M, "sta _%s+%u", namestr(n->snum), WORD(n->value));
+		}
+		track_store(n);
 		return 1;
 	}
 	/* Locals we can do on 8085, 8080 is doable but messy - so not worth it */
@@ -1593,18 +2865,26 @@ unsigned gen_shortcut(struct node *n)
 			/* The one case 8080 is worth doing */
 			codegen_lr(r);
 			if (n->flags & NORETURN)
-				printf("\txthl\n");
-			else
-				printf("\tpop psw\n\tpush h\n");
+				opcode(OP_XTHL, R_SP|R_M|R_HL, R_SP|R_M|R_HL, "xthl");
+			else {
+				opcode(OP_POP, R_SP, R_PSW|R_SP, "pop psw");
+				opcode(OP_PUSH, R_SP|R_HL, R_SP, "push h");
+				/* Push doesn't look like a store to the tracking */
+				track_write("", 2);
+				track_store(n);
+			}
 			return 1;
 		}
 		if (cpu == 8085 && n->value + sp < 255) {
 			codegen_lr(r);
 			opcode(OP_LDSI, R_SP, R_DE, "ldsi %u",WORD(n->value + sp));
 			if (s == 2)
-				printf("\tshlx\n");
-			else
-				printf("\tmov a,l\n\tstax d\n");
+				opcode(OP_SHLX, R_DE|R_HL, R_M, "shlx");
+			else {
+				load_a_l();
+				opcode(OP_STAX, R_DE|R_A, R_M, "stax d");
+			}
+			track_store(n);
 			return 1;
 		}
 	}
@@ -1621,9 +2901,9 @@ unsigned gen_shortcut(struct node *n)
 		if (!load_a_with(r)) {
 			codegen_lr(r);		/* If not then into HL */
 			in_l = 1;
-			opcode(OP_MOV, R_L, R_A, "mov a,l");
+			load_a_l();
 		}
-		printf("\tstax b\n");	/* Do in case volatile */
+		opcode(OP_STAX, R_BC|R_A, R_M, "stax b");	/* Do in case volatile */
 		if (!nr && !in_l)
 			opcode(OP_MOV, R_A, R_L, "mov l,a");
 		return 1;
@@ -1677,14 +2957,16 @@ unsigned gen_shortcut(struct node *n)
 				opcode(OP_MVI, 0, R_A, "mvi a, %u", v >> 8);
 				opcode(OP_ORA, R_B, R_A, "ora b");
 				opcode(OP_MOV, R_A, R_H, "mov h,a");
-			}
+			} else
+				opcode(OP_MOV, R_B, R_H, "mov h,b");
 			if ((v & 0xFF) == 0xFF)
 				opcode(OP_MVI, 0, R_L, "mvi l,0xff");
 			else if (v & 0xFF) {
 				opcode(OP_MVI, 0, R_A, "mvi a, %u", v & 0xFF);
-				opcode(OP_ORA, R_C, R_A, "ana c");
+				opcode(OP_ORA, R_C, R_A, "ora c");
 				opcode(OP_MOV, R_A, R_L, "mov l,a");
-			}
+			} else
+				opcode(OP_MOV, R_C, R_L, "mov l,c");
 			return 1;
 		}
 	}
@@ -1701,7 +2983,7 @@ unsigned gen_shortcut(struct node *n)
 				return 1;
 			}
 			if (!nr) {
-				printf("\tpush b\n");
+				out("\tpush b\n");
 				sp += 2;
 			}
 			/* Fall through */
@@ -1735,7 +3017,7 @@ unsigned gen_shortcut(struct node *n)
 				}
 				codegen_lr(r);
 				if (s == 1) {
-					printf("\tmov a,c\n\tsub l\n\tmov l,c\n\tmov c,a\n");
+					out("\tmov a,c\n\tsub l\n\tmov l,c\n\tmov c,a\n");
 					return 1;
 				}
 				/* Not worth messing with inlined constants as we need the original value */
@@ -1795,9 +3077,9 @@ unsigned gen_shortcut(struct node *n)
 					return 1;
 				}
 				if (s == 1) {
-					printf("\tmov a,c\n");
-					repeated_op("add a", v);
-					printf("\tmov c,a\n");
+					out("\tmov a,c\n");
+					repeated_op(OP_ADD, R_A, "add a", v);
+					out("\tmov c,a\n");
 					loadhl(n, s);
 					return 1;
 				}
@@ -1808,20 +3090,20 @@ unsigned gen_shortcut(struct node *n)
 					return 1;
 				}
 				if (v == 8) {
-					printf("\tmov b,c\n\tmvi c,0\n");
+					out("\tmov b,c\n\tmvi c,0\n");
 					loadhl(n, s);
 					return 1;
 				}
 				if (v > 8) {
-					printf("\tmov a,c\n");
-					repeated_op("add a", v - 8);
-					printf("\tmov b,a\nvi c,0\n");
+					out("\tmov a,c\n");
+					repeated_op(OP_ADD, R_A, "add a", v - 8);
+					out("\tmov b,a\nvi c,0\n");
 					loadhl(n, s);
 					return 1;
 				}
 				/* 16bit full shifting */
 				loadhl(NULL, s);
-				repeated_op("dad h", v);
+				repeated_op(OP_DAD, R_HL, "dad h", v);
 				loadbc(s);
 				return 1;
 			}
@@ -1841,13 +3123,13 @@ unsigned gen_shortcut(struct node *n)
 					return 1;
 				}
 				if (v == 8 && (n->type & UNSIGNED)) {
-					printf("\tmov c,b\nmvi b,0\n");
+					out("\tmov c,b\nmvi b,0\n");
 					loadhl(n, s);
 					return 1;
 				}
 				if (s == 2 && !(n->type & UNSIGNED) && cpu == 8085 && v < 2 + 4 * opt) {
 					loadhl(NULL,s);
-					repeated_op("arhl", v);
+					repeated_op(OP_ARHL, R_HL, "arhl", v);
 					loadbc(s);
 					return 1;
 				}
@@ -1923,7 +3205,46 @@ static unsigned gen_cast(struct node *n)
 	return 1;
 }
 
+/* Simple loads of things we can remember */
+static unsigned track_load(struct node *n)
+{
+	switch(n->op) {
+	case T_NREF:
+	case T_LBREF:
+	case T_LREF:
+	case T_RREF:
+	case T_LABEL:
+	case T_CONSTANT:
+	case T_NAME:
+	case T_LOCAL:
+	case T_ARGUMENT:
+		return get_size(n->type) <= 2;
+	}
+	return 0;
+}
+
+static unsigned do_node(struct node *n);
+
 unsigned gen_node(struct node *n)
+{
+	if (!track_load(n) || (n->flags & NORETURN))
+		return do_node(n);
+	/* Don't load something we already have */
+	if (holds_node(R_HL, n))
+		return 1;
+	if (get_size(n->type) == 1 && holds_node(R_A, n)) {
+		opcode(OP_MOV, R_A, R_L, "mov l,a");
+		return 1;
+	}
+	if (!do_node(n))
+		return 0;
+	set_node(R_HL, n);
+	if (get_size(n->type) == 1 && a_is_l)
+		add_node(R_A, n);
+	return 1;
+}
+
+static unsigned do_node(struct node *n)
 {
 	unsigned size = get_size(n->type);
 	unsigned v;
@@ -1952,29 +3273,29 @@ unsigned gen_node(struct node *n)
 			opcode(OP_LHLD, R_M, R_HL, "lhld _%s+%u\n", namestr(n->snum), v);
 			return 1;
 		} else if (size == 4) {
-			printf("\tlhld _%s+%u\n", namestr(n->snum), v + 2);
-			printf("\tshld __hireg\n");
-			printf("\tlhld _%s+%u\n", namestr(n->snum), v);
+			opcode(OP_LHLD, R_M, R_HL, "lhld _%s+%u", namestr(n->snum), v + 2);
+			opcode(OP_SHLD, R_HL, R_M, "shld __hireg");
+			opcode(OP_LHLD, R_M, R_HL, "lhld _%s+%u", namestr(n->snum), v);
 		} else
 			error("nrb");
 		return 1;
 	case T_LBREF:
 		if (size == 1) {
-			printf("\tlda T%u+%u\n", n->val2, v);
-			printf("\tmov l,a\n");
+			opcode(OP_LDA, R_M, R_A, "lda T%u+%u", n->val2, v);
+			opcode(OP_MOV, R_A, R_L, "mov l,a");
 		} else if (size == 2) {
-			printf("\tlhld T%u+%u\n", n->val2, v);
+			opcode(OP_LHLD, R_M, R_HL, "lhld T%u+%u", n->val2, v);
 		} else if (size == 4) {
-			printf("\tlhld T%u+%u\n", n->val2, v + 2);
-			printf("\tshld __hireg\n");
-			printf("\tlhld T%u+%u\n", n->val2, v);
+			opcode(OP_LHLD, R_M, R_HL, "lhld T%u+%u", n->val2, v + 2);
+			opcode(OP_SHLD, R_HL, R_M, "shld __hireg");
+			opcode(OP_LHLD, R_M, R_HL, "lhld T%u+%u", n->val2, v);
 		} else
 			error("lbrb");
 		return 1;
 	case T_LREF:
 		/* We are loading something then not using it, and it's local
 		   so can go away */
-		/* printf(";L sp %u %s(%ld)\n", sp, namestr(n->snum), n->value); */
+		/* out(";L sp %u %s(%ld)\n", sp, namestr(n->snum), n->value); */
 		if (nr)
 			return 1;
 		v += sp;
@@ -1988,37 +3309,44 @@ unsigned gen_node(struct node *n)
 		return 1;
 	case T_NSTORE:
 		if (size == 4) {
-			opcode(OP_SHLD, R_HL, R_M, "shld %s+%u", namestr(n->snum), v);
-			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+			opcode(OP_SHLD, R_HL, R_M, "shld _%s+%u", namestr(n->snum), v);
+			/* Keep HL if the result is wanted */
+			if (!nr)
+				opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
 			opcode(OP_LHLD, R_M, R_HL, "lhld __hireg");
-			opcode(OP_SHLD, R_HL, R_M, "shld %s+%u\n",
+			opcode(OP_SHLD, R_HL, R_M, "shld _%s+%u",
 				namestr(n->snum), v + 2);
-			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+			if (!nr)
+				opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
 			return 1;
 		}
-		if (size == 1)
-			printf("\tmov a,l\n\tsta");
-		else
-			printf("\tshld");
-		printf(" _%s+%u\n", namestr(n->snum), v);
+		if (size == 1) {
+			load_a_l();
+			opcode(OP_STA, R_A, R_M, "sta _%s+%u", namestr(n->snum), v);
+		} else
+			opcode(OP_SHLD, R_HL, R_M, "shld _%s+%u", namestr(n->snum), v);
+		track_store(n);
 		return 1;
 	case T_LBSTORE:
 		if (size == 4) {
-			printf("\tshld T%u+%u\n", n->val2, v);
-			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
-			printf("\tlhld __hireg\n\tshld T%u+%u\n",
-				n->val2, v + 2);
-			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+			opcode(OP_SHLD, R_HL, R_M, "shld T%u+%u", n->val2, v);
+			if (!nr)
+				opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+			opcode(OP_LHLD, R_M, R_HL, "lhld __hireg");
+			opcode(OP_SHLD, R_HL, R_M, "shld T%u+%u", n->val2, v + 2);
+			if (!nr)
+				opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
 			return 1;
 		}
 		if (size == 1) {
-			opcode(OP_MOV, R_L, R_A, "mov a,l");
+			load_a_l();
 			opcode(OP_STA, R_A, R_M, "sta T%u+%u\n", n->val2, v);
 		} else
 			opcode(OP_SHLD, R_HL, R_M, "shld T%u+%u\n", n->val2, v);
+		track_store(n);
 		return 1;
 	case T_LSTORE:
-/*		printf(";L sp %u spval %u %s(%ld)\n", sp, spval, namestr(n->snum), n->value); */
+/*		out(";L sp %u spval %u %s(%ld)\n", sp, spval, namestr(n->snum), n->value); */
 		v += sp;
 		if (v == 0 && size == 2 ) {
 			if (nr)
@@ -2026,6 +3354,8 @@ unsigned gen_node(struct node *n)
 			else {
 				opcode(OP_POP, R_SP, R_PSW|R_SP, "pop psw");
 				opcode(OP_PUSH, R_SP|R_HL, R_SP, "push h");
+				track_write("", 2);
+				track_store(n);
 			}
 			return 1;
 		}
@@ -2034,9 +3364,10 @@ unsigned gen_node(struct node *n)
 			if (size == 2)
 				opcode(OP_SHLX, R_DE|R_HL, R_M, "shlx");
 			else {
-				opcode(OP_MOV, R_L, R_A, "mov a,l");
+				load_a_l();
 				opcode(OP_STAX, R_DE|R_A, R_M, "stax d\n");
 			}
+			track_store(n);
 			return 1;
 		}
 		if (v == 2 && size == 2) {
@@ -2046,8 +3377,11 @@ unsigned gen_node(struct node *n)
 			else {
 				opcode(OP_POP, R_SP, R_PSW|R_SP, "pop psw");
 				opcode(OP_PUSH, R_SP|R_HL, R_SP, "push h");
+				track_write("", 2);
 			}
 			opcode(OP_PUSH, R_SP, R_DE|R_SP, "push d");
+			if (!nr)
+				track_store(n);
 			return 1;
 		}
 		/* Large offsets for word on 8085 are 7 bytes, a helper call is 5 (3 with rst hacks)
@@ -2058,20 +3392,28 @@ unsigned gen_node(struct node *n)
 			opcode(OP_DAD, R_HL|R_SP, R_HL, "dad sp");
 			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
 			opcode(OP_SHLX, R_HL|R_DE, R_M, "shlx");
+			track_store(n);
 			return 1;
 		}
 		if (size == 1 && (!optsize || v >= LWDIRECT)) {
-			printf("\tmov a,l\n\tlxi h,%u\n\tdad sp\n\tmov m,a\n", WORD(v));
-			if (!nr)
-				printf("\tmov l,a\n");
+			load_a_l();
+			opcode(OP_LXI, 0, R_HL, "lxi h,%u", WORD(v));
+			opcode(OP_DAD, R_SP|R_HL, R_HL, "dad sp");
+			opcode(OP_MOV, R_A, R_M, "mov m,a");
+			/* A still holds the value */
+			add_node(R_A, n);
+			if (!nr) {
+				opcode(OP_MOV, R_A, R_L, "mov l,a");
+				track_store(n);
+			}
 			return 1;
 		}
 		/* For -O3 they asked for it so inline the lot */
 		/* We dealt with size one above */
 		if (opt > 2 && size == 2) {
 			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
-			printf("\tlxi h,%u\n\tdad sp\n\tmov m,e\n\tinx h\n", WORD(v));
-			printf("\tmov m,d\n");
+			out("\tlxi h,%u\n\tdad sp\n\tmov m,e\n\tinx h\n", WORD(v));
+			out("\tmov m,d\n");
 			if (!nr)
 				opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
 			return 1;
@@ -2088,14 +3430,17 @@ unsigned gen_node(struct node *n)
 		/* Like load the helper is offset by two because of the
 		   stack */
 		if (v < 24)
-			printf("\tcall __%s%u\n", name, v + 2);
+			out("\tcall __%s%u\n", name, v + 2);
 		else if (v < 253)
-			printf("\tcall __%s\n\t.byte %u\n", name, v + 2);
+			out("\tcall __%s\n\t.byte %u\n", name, v + 2);
 		else
-			printf("\tcall __%sw\n\t.word %u\n", name, v + 2);
+			out("\tcall __%sw\n\t.word %u\n", name, v + 2);
+		/* The helpers preserve HL */
+		track_store(n);
 		return 1;
 	case T_RSTORE:
 		loadbc(size);
+		track_store(n);
 		return 1;
 		/* Call a function by name */
 	case T_CALLNAME:
@@ -2108,7 +3453,7 @@ unsigned gen_node(struct node *n)
 				opcode(OP_SHLX, R_DE|R_HL, R_M, "shlx");
 			} else {
 				opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
-				printf("\tpop h\n\tmov m,e\n\tinx h\n\tmov m,d\n");
+				out("\tpop h\n\tmov m,e\n\tinx h\n\tmov m,d\n");
 				if (!(nr))
 					opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
 			}
@@ -2153,13 +3498,22 @@ unsigned gen_node(struct node *n)
 			opcode(OP_INX, R_DE, R_DE, "inx d");
 			opcode(OP_LHLX, R_DE|R_M, R_HL, "lhlx");
 			opcode(OP_SHLD, R_HL, R_M, "shld __hireg");
-			opcode(OP_INX, R_DE, R_DE, "dcx d");
-			opcode(OP_INX, R_DE, R_DE, "dcx d");
+			opcode(OP_DCX, R_DE, R_DE, "dcx d");
+			opcode(OP_DCX, R_DE, R_DE, "dcx d");
 			opcode(OP_LHLX, R_DE|R_M, R_HL, "lhlx");
 			return 1;
 		}
 		break;
 	case T_FUNCCALL:
+		/* The first argument was stacked before we worked out the
+		   function pointer so bring it back into HL */
+		if (n->flags & REGARG) {
+			opcode(OP_POP, R_SP, R_SP|R_DE, "pop d");
+			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
+			opcode(OP_CALL, R_DE|R_HL, R_BC|R_DE|R_HL|R_PSW, "call __callde");
+			sp -= 2;
+			return 1;
+		}
 		opcode(OP_CALL, R_HL, R_BC|R_DE|R_HL|R_PSW, "\tcall __callhl\n");
 		return 1;
 	case T_LABEL:
@@ -2193,7 +3547,7 @@ unsigned gen_node(struct node *n)
 		if (nr)
 			return 1;
 		v += sp;
-/*		printf(";LO sp %u spval %u %s(%ld)\n", sp, spval, namestr(n->snum), n->value); */
+/*		out(";LO sp %u spval %u %s(%ld)\n", sp, spval, namestr(n->snum), n->value); */
 		if (cpu == 8085 && v <= 255) {
 			opcode(OP_LDSI, R_DE|R_SP, R_DE, "ldsi %u", v);
 			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
@@ -2206,7 +3560,7 @@ unsigned gen_node(struct node *n)
 		if (nr)
 			return 1;
 		v += frame_len + argbase + sp;
-/*		printf(";AR sp %u spval %u %s(%ld)\n", sp, spval, namestr(n->snum), n->value); */
+/*		out(";AR sp %u spval %u %s(%ld)\n", sp, spval, namestr(n->snum), n->value); */
 		if (cpu == 8085 && v <= 255) {
 			opcode(OP_LDSI, R_DE|R_SP, R_DE, "ldsi %u", v);
 			opcode(OP_XCHG, R_DE|R_HL, R_DE|R_HL, "xchg");
@@ -2232,6 +3586,12 @@ unsigned gen_node(struct node *n)
 			return 1;
 		}
 		break;
+	case T_ONESHL:
+		helper(n, "oneshl");
+		return 1;
+	case T_BITAND:
+		helper(n, "bitand");
+		return 1;
 	}
 	return 0;
 }
@@ -580,8 +580,20 @@ void gen_wvalue(unsigned type, unsigned long value)
 	}
 }
 
+/* Remove the argument space we left on the stack. The return reloads
+   the stack pointer from the frame pointer so on the way out we only
+   have to fix up our own tracking */
+static void flush_cleanup(unsigned v, unsigned exiting)
+{
+	if (exiting)
+		sp -= v;
+	else
+		gen_cleanup(v);
+}
+
 void gen_start(void)
 {
+	gen_flush_cleanup = flush_cleanup;
 	printf("\t.code\n");
 }
 
@@ -1052,7 +1064,8 @@ unsigned gen_direct(struct node *n)
 	   type of the function return so don't use that for the cleanup value
 	   in n->right */
 	case T_CLEANUP:
-		gen_cleanup(r->value / 2);
+		/* Locals are frame pointer relative so depth is no problem */
+		gen_cleanup(defer_cleanup(n, r->value / 2, sp, 0xFFFF));
 		return 1;
 	case T_PLUS:
 		if (r->op == T_CONSTANT && s == 2) {
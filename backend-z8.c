@@ -2,7 +2,6 @@
  *	Z8 code generator
  *
  *	TODO
- *	- using tcm/tm for bitops
  *	- using incw/decw for cmp -1 or 1
  *	- efficient comparisons
  *	- flag switching on jtrue/false for comparisons
@@ -59,6 +58,13 @@ static uint8_t r_type[16];	/* For now just unknown and const */
 
 static struct node ac_node;	/* What is in AC 0 type = unknown */
 
+#ifdef SUPER8
+static unsigned bt_pending;	/* Single bit test waiting for its branch */
+static unsigned bt_reg;		/* Register and bit being tested */
+static unsigned bt_bit;
+static unsigned bt_inv;		/* Condition is true when the bit is clear */
+#endif
+
 /* Minimal tracking on the working register only */
 
 static void invalidate_ac(void)
@@ -88,6 +94,13 @@ static void set_ac_node(struct node *n)
 
 static void flush_all(unsigned f)
 {
+#ifdef SUPER8
+	/* A bit test that didn't end up as a btjr needs its flags */
+	if (bt_pending) {
+		printf("\t%s r%u,#%u\n", bt_inv ? "tcm" : "tm", bt_reg, 1 << bt_bit);
+		bt_pending = 0;
+	}
+#endif
 }
 
 static void gen_symref(struct node *n)
@@ -824,6 +837,36 @@ static void rshift_r(unsigned r, unsigned size, unsigned l, unsigned uns)
 #define OP_OR	1
 #define OP_XOR	2
 
+/* Bit number if the byte has a single bit set, otherwise -1 */
+static int bitnum(unsigned n)
+{
+	int b = 0;
+	if (n == 0 || (n & (n - 1)))
+		return -1;
+	while (n >>= 1)
+		b++;
+	return b;
+}
+
+/* The only byte a logic op by a constant changes (0 is the low byte),
+   or -1 if it changes none or several */
+static int logic_byte(unsigned long v, unsigned size, unsigned op)
+{
+	unsigned keep = (op == OP_AND) ? 0xFF : 0x00;
+	unsigned i;
+	int b = -1;
+
+	for (i = 0; i < size; i++) {
+		if ((v & 0xFF) != keep) {
+			if (b != -1)
+				return -1;
+			b = i;
+		}
+		v >>= 8;
+	}
+	return b;
+}
+
 static void logic_r_const(unsigned r, unsigned long v, unsigned size, unsigned op)
 {
 	const char *opn = "and\0or\0\0xor" + op * 4;
@@ -858,7 +901,17 @@ static void logic_r_const(unsigned r, unsigned long v, unsigned size, unsigned o
 			/* OR and XOR do nothing */
 			continue;
 		} else {
-			int i = find_const(n, -1);
+			int i;
+#ifdef SUPER8
+			/* A single bit change can use bitr/bits/bitc */
+			int b = bitnum(op == OP_AND ? (~n & 0xFF) : n);
+			if (b != -1) {
+				printf("\t%s r%u.%u\n", "bitr\0bits\0bitc" + op * 5, r, b);
+				r_modify(r, 1);
+				continue;
+			}
+#endif
+			i = find_const(n, -1);
 			if (i != -1)
 				printf("\t%s r%u, r%u\n", opn, r, i);
 			else
@@ -1532,12 +1585,23 @@ static unsigned load_direct(unsigned r, struct node *n, unsigned mm)
 	return 0;
 }
 
-static unsigned logic_eq_direct_r(struct node *r,unsigned v, unsigned size, unsigned op)
+static unsigned logic_eq_direct_r(struct node *r,unsigned long v, unsigned size, unsigned op, unsigned nr)
 {
+	int b;
+
 	if (r->op == T_CONSTANT) {
 		/* Could spot 0000 and FFFF but prob no point */
 		load_r_r(R_INDEX, 2);
 		load_r_r(R_INDEX + 1, 3);
+		/* If the result is not used and only one byte changes then
+		   just do that byte */
+		if (nr && (b = logic_byte(v, size, op)) != -1) {
+			add_r_const(R_INDEX, size - 1 - b, 2);
+			load_r_memr(R_AC, R_INDEX, 1);
+			logic_r_const(R_AC, v >> (8 * b), 1, op);
+			store_r_memr(R_AC, R_INDEX, 1);
+			return 1;
+		}
 		load_r_memr(R_AC, R_INDEX, size);
 		logic_r_const(R_AC, v, size, op);
 		revstore_r_memr(R_AC, R_INDEX, size);
@@ -1912,6 +1976,7 @@ void gen_epilogue(unsigned size, unsigned argsize)
 
 void gen_label(const char *tail, unsigned n)
 {
+	flush_all(0);
 	unreachable = 0;
 	/* A branch label means the state is unknown so force any
 	   existing state and don't assume anything */
@@ -1937,14 +2002,30 @@ void gen_jump(const char *tail, unsigned n)
 }
 
 /* TODO: Will need work when we implement flag flipping and other compare tricks */
+/* btjrf/btjrt reach no further than jr so need the same assembler help
+   as gen_jump before they are safe in big functions */
 void gen_jfalse(const char *tail, unsigned n)
 {
+#ifdef SUPER8
+	if (bt_pending) {
+		printf("\tbtjr%c L%u%s,r%u.%u\n", bt_inv ? 't' : 'f', n, tail, bt_reg, bt_bit);
+		bt_pending = 0;
+		return;
+	}
+#endif
 	flush_all(1);	/* Must preserve flags */
 	printf("\tjr z,L%u%s\n", n, tail);
 }
 
 void gen_jtrue(const char *tail, unsigned n)
 {
+#ifdef SUPER8
+	if (bt_pending) {
+		printf("\tbtjr%c L%u%s,r%u.%u\n", bt_inv ? 'f' : 't', n, tail, bt_reg, bt_bit);
+		bt_pending = 0;
+		return;
+	}
+#endif
 	flush_all(1);	/* Must preserve flags */
 	printf("\tjr nz,L%u%s\n", n, tail);
 }
@@ -2131,6 +2212,7 @@ void gen_end(void)
 
 void gen_tree(struct node *n)
 {
+	flush_all(0);
 	codegen_lr(n);
 	printf(";\n");
 /*	printf(";SP=%d\n", sp); */
@@ -2725,11 +2807,11 @@ unsigned gen_direct(struct node *n)
 		}
 		return 0;
 	case T_ANDEQ:
-		return logic_eq_direct_r(r, v, size, OP_AND);
+		return logic_eq_direct_r(r, v, size, OP_AND, nr);
 	case T_OREQ:
-		return logic_eq_direct_r(r, v, size, OP_OR);
+		return logic_eq_direct_r(r, v, size, OP_OR, nr);
 	case T_HATEQ:
-		return logic_eq_direct_r(r, v, size, OP_XOR);
+		return logic_eq_direct_r(r, v, size, OP_XOR, nr);
 	/* Should do SHLEQ/SHREQ of const or r */
 	}
 	return 0;
@@ -2890,6 +2972,118 @@ static void gen_fcall(struct node *n)
  *	Allow the code generator to short cut any subtrees it can directly
  *	generate.
  */
+/*
+ *	Flags only tests of (x & mask) and !(x & mask) with the mask within
+ *	one byte. tm and tcm test a register in place so register variables
+ *	are tested where they live and anything else only needs the byte we
+ *	want loading. !(x & mask) needs tcm so is limited to a single bit.
+ *
+ *	On the Super8 a single bit test that goes straight to a branch is
+ *	left pending so gen_jtrue/gen_jfalse can turn it into btjrt/btjrf.
+ *	Not within && and || as they rely on the flags being left set.
+ */
+static unsigned bit_test(struct node *n)
+{
+	struct node *r = n->right;
+	struct node *l;
+	unsigned long m;
+	unsigned size;
+	unsigned inv = 0;
+	unsigned reg;
+	unsigned b = 0;
+	int bit;
+
+	if (r->op == T_BANG) {
+		inv = 1;
+		r = r->right;
+	}
+	if (r->op != T_AND || r->right->op != T_CONSTANT)
+		return 0;
+	l = r->left;
+	size = get_size(r->type);
+	m = r->right->value;
+	if (size > 2)
+		return 0;
+	if (size == 2)
+		m &= 0xFFFF;
+	/* The high byte ? */
+	if (m > 0xFF) {
+		if (m & 0xFF)
+			return 0;
+		m >>= 8;
+		b = 1;
+	}
+	bit = bitnum(m);
+	if (m == 0 || (inv && bit == -1))
+		return 0;
+
+	/* (int)c & mask only needs the char */
+	if (b == 0 && l->op == T_CAST && get_size(l->right->type) == 1) {
+		l = l->right;
+		size = 1;
+	}
+	if (l->op == T_RREF)
+		reg = R_REG_S(l->value, size) + size - 1 - b;
+	else {
+		/* Only load the byte we are testing. Big endian so the low
+		   byte is the higher address */
+		if (size == 2 && (l->op == T_NREF || l->op == T_LBREF ||
+			(l->op == T_LREF && (ac_node.op != T_LREF || ac_node.value != l->value)))) {
+			l->value += 1 - b;
+			l->type = UCHAR;
+			b = 0;
+		}
+		codegen_lr(l);
+		reg = 3 - b;
+	}
+#ifdef SUPER8
+	if (bit != -1 && !(n->flags & CCFIXED)) {
+		bt_pending = 1;
+		bt_reg = reg;
+		bt_bit = bit;
+		bt_inv = inv;
+		return 1;
+	}
+#endif
+	printf("\t%s r%u,#%u\n", inv ? "tcm" : "tm", reg, (unsigned)m);
+	return 1;
+}
+
+/*
+ *	Logic ops by a constant on a global where the result is not used and
+ *	only one byte changes. Just load, change and store that byte.
+ */
+static unsigned logic_eq_name(struct node *n, unsigned op)
+{
+	struct node *l = n->left;
+	unsigned size = get_size(n->type);
+	unsigned long v = n->right->value;
+	int b = logic_byte(v, size, op);
+
+	if (b == -1)
+		return 0;
+	/* Big endian */
+	l->value += size - 1 - b;
+#ifdef SUPER8
+	/* lde can address it directly */
+	l->op = (l->op == T_NAME) ? T_NREF : T_LBREF;
+	l->type = UCHAR;
+	load_da(R_AC, l);
+	logic_r_const(R_AC, v >> (8 * b), 1, op);
+	l->op = (l->op == T_NREF) ? T_NSTORE : T_LBSTORE;
+	store_da(R_AC, l);
+#else
+	if (l->op == T_NAME)
+		load_r_name(R_INDEX, l, l->value);
+	else
+		load_r_label(R_INDEX, l, l->value);
+	load_r_memr(R_AC, R_INDEX, 1);
+	logic_r_const(R_AC, v >> (8 * b), 1, op);
+	store_r_memr(R_AC, R_INDEX, 1);
+#endif
+	return 1;
+}
+
 unsigned gen_shortcut(struct node *n)
 {
 	unsigned size = get_size(n->type);
@@ -2938,6 +3132,8 @@ unsigned gen_shortcut(struct node *n)
 	 * until we generate the subtree. So generate the tree, then
 	 * either do nice things or use the helper */
 	if (n->op == T_BOOL) {
+		if ((n->flags & CCONLY) && bit_test(n))
+			return 1;
 		codegen_lr(r);
 		if (r->flags & ISBOOL)
 			return 1;
@@ -2994,6 +3190,12 @@ unsigned gen_shortcut(struct node *n)
 		}
 		return 1;
 	}
+	if (nr && (n->op == T_ANDEQ || n->op == T_OREQ || n->op == T_HATEQ) &&
+		r->op == T_CONSTANT && (l->op == T_NAME || l->op == T_LABEL)) {
+		x = (n->op == T_ANDEQ) ? OP_AND : ((n->op == T_OREQ) ? OP_OR : OP_XOR);
+		if (logic_eq_name(n, x))
+			return 1;
+	}
 	/* TODO: Do PLUSEQ/MINUSEQ for CONST non FLOAT akin to above */
 	if (n->op == T_RSTORE && (n->flags & NORETURN))
 		return load_direct(R_REG(n->value), r, 1);
@@ -3155,20 +3357,32 @@ unsigned gen_shortcut(struct node *n)
 			return 1;
 		/* TODO: reg/reg versions */
 		case T_ANDEQ:
-			codegen_lr(r);
-			logic_r_r(reg, R_AC, size, OP_AND);
+			if (r->op == T_CONSTANT)
+				logic_r_const(R_REG_S(reg, size), v, size, OP_AND);
+			else {
+				codegen_lr(r);
+				logic_r_r(R_REG_S(reg, size), R_AC, size, OP_AND);
+			}
 			if (!nr)
 				load_ac_reg(reg, size);
 			return 1;
 		case T_OREQ:
-			codegen_lr(r);
-			logic_r_r(reg, R_AC, size, OP_OR);
+			if (r->op == T_CONSTANT)
+				logic_r_const(R_REG_S(reg, size), v, size, OP_OR);
+			else {
+				codegen_lr(r);
+				logic_r_r(R_REG_S(reg, size), R_AC, size, OP_OR);
+			}
 			if (!nr)
 				load_ac_reg(reg, size);
 			return 1;
 		case T_HATEQ:
-			codegen_lr(r);
-			logic_r_r(reg, R_AC, size, OP_XOR);
+			if (r->op == T_CONSTANT)
+				logic_r_const(R_REG_S(reg, size), v, size, OP_XOR);
+			else {
+				codegen_lr(r);
+				logic_r_r(R_REG_S(reg, size), R_AC, size, OP_XOR);
+			}
 			if (!nr)
 				load_ac_reg(reg, size);
 			return 1;
@@ -1,19 +1,37 @@
-/* Until we do more testing */
-#define IS_EZ80		0	/* EZ80 has ld de,(hl) and friends but not offset */
-#define IS_RABBIT	0	/* Has ld hl,(rr + n) and vice versa but only 16bit */
-#define HAS_LDHLSP	0	/* Can ld hl,(sp + n) and vice versa */
-#define HAS_LDASP	0	/* Can ld a,(sp + n) and vice versa */
-#define HAS_LDHLHL	0	/* Can ld hl,(hl) or hl,(hl + 0) */
+/* CPU codes passed to us by cc */
+#define CPU_Z80		80
+#define CPU_Z180	180
+#define CPU_Z280	280
+#define CPU_EZ80	800	/* eZ80 in Z80 mode */
+#define CPU_RABBIT	2000
+
+#define IS_EZ80		(cpu == CPU_EZ80)	/* ld rr,(hl), ld rr,(ix/iy + n) and reverse */
+#define IS_RABBIT	(cpu == CPU_RABBIT)	/* Has ld hl,(rr + n) and vice versa but only 16bit */
+#define IS_Z280		(cpu == CPU_Z280)
+#define HAS_LDHLSP	(IS_RABBIT || IS_Z280)	/* Can ld hl,(sp + n) and vice versa */
+#define HAS_LDASP	IS_Z280			/* Can ld a,(sp + n) and vice versa */
+#define HAS_LDHLHL	(IS_RABBIT || IS_EZ80)	/* Can ld hl,(hl) or hl,(hl + 0) */
+#define HAS_ADDSP	IS_RABBIT		/* Can add sp,n (signed 8bit) */
+
+/* Feature bits passed to us by cc */
+#define FEAT_BANKED	1
+#define FEAT_REGCALL	8
+
+/* First argument in HL and the called function removes the arguments.
+   Banked calls have the bank on the stack so always use the usual rules */
+#define REGCALL		((cpufeat & (FEAT_BANKED|FEAT_REGCALL)) == FEAT_REGCALL)
 
 #define ARGBASE	2	/* Bytes between arguments and locals if no reg saves */
 
 #define BYTE(x)		(((unsigned)(x)) & 0xFF)
 #define WORD(x)		(((unsigned)(x)) & 0xFFFF)
 /*
- *	Upper node flag fields are ours
+ *	Upper node flag fields are ours. The first half belongs to the
+ *	byte analysis in backend-byte.h
  */
 
-#define USECC	0x0100
+#define USECC	0x1000
+#define REGARG	0x2000		/* Call passes the first argument in HL */
 
 #define T_NREF		(T_USER)		/* Load of C global/static */
 #define T_CALLNAME	(T_USER+1)		/* Function call by name */
@@ -29,6 +47,14 @@
 #define T_BTST		(T_USER+11)		/* Use bit n, for and bit conditionals */
 #define T_BYTEEQ	(T_USER+12)		/* Until we handle 8bit better */
 #define T_BYTENE	(T_USER+13)
+#define T_XREF		(T_USER+14)		/* Load of alternate register var */
+#define T_XSTORE	(T_USER+15)		/* Store to alternate register var */
+#define T_ONESHL	(T_USER+16)		/* 1 << n */
+#define T_BITAND	(T_USER+17)		/* x & (1 << n) */
+
+/* Register variables 4-6 live in hl' de' and bc' (-mz80-exx) */
+#define XREG_BASE	4
+#define F_XREGS		(F_REG(4) | F_REG(5) | F_REG(6))
 
 
 extern unsigned get_size(unsigned t);
@@ -37,6 +63,7 @@ extern int bitcheckb1(uint8_t n);
 extern int bitcheck1(unsigned n, unsigned s);
 extern int bitcheck0(unsigned n, unsigned s);
 extern void gen_cleanup(unsigned v);
+extern unsigned defer_limit(void);
 
 extern unsigned frame_len;	/* Number of bytes of stack frame */
 extern unsigned sp;		/* Stack pointer offset tracking */
@@ -45,6 +72,21 @@ extern unsigned unreachable;	/* Code after an unconditional jump */
 extern unsigned func_cleanup;	/* Zero if we can just ret out */
 extern unsigned use_fp;		/* Using a frame pointer this function */
 
+/* Register tracking */
+#define R_HL		0
+#define R_DE		1
+#define R_A		2
+
+extern void invalidate_all(void);
+extern void invalidate(unsigned r);
+extern unsigned track_valid(unsigned r);
+extern unsigned holds_node(unsigned r, struct node *n);
+extern void add_node(unsigned r, struct node *n);
+extern void set_node(unsigned r, struct node *n);
+extern void copy_track(unsigned r, unsigned f);
+extern unsigned same_byte(unsigned f);
+extern void invalidate_mem(struct node *n);
+
 extern const char ccnormal[];
 extern const char ccinvert[];
 
@@ -348,6 +348,277 @@ static void dump_tree(register struct node *n, unsigned depth)
 }
 #endif
 
+/*
+ *	Deferred stack cleanup. A target can leave the arguments of a call
+ *	on the stack and let us merge the adjustment with that of the calls
+ *	that follow. Every path into a label must agree on the stack depth
+ *	so we only defer in straight line expression statements and flush
+ *	before any header that changes the flow. We only defer a call that
+ *	is the whole statement as the targets assume that evaluating a
+ *	subtree leaves sp where it was. Targets that want this set
+ *	gen_flush_cleanup in gen_start.
+ */
+void (*gen_flush_cleanup)(unsigned v, unsigned exiting);
+static unsigned cleanup_pending;
+static unsigned no_defer;
+static struct node *expr_root;
+
+/* Called by the target at a T_CLEANUP with the argument size and the
+   current stack depth. Returns the amount the target must remove now */
+unsigned defer_cleanup(struct node *n, unsigned v, unsigned depth, unsigned limit)
+{
+	if (no_defer || n != expr_root || gen_flush_cleanup == NULL)
+		return v;
+	/* If the stack is getting deep offsets will go out of range */
+	if (depth >= limit) {
+		v += cleanup_pending;
+		cleanup_pending = 0;
+		return v;
+	}
+	cleanup_pending += v;
+	return 0;
+}
+
+static void flush_cleanup(unsigned exiting)
+{
+	if (cleanup_pending) {
+		gen_flush_cleanup(cleanup_pending, exiting);
+		cleanup_pending = 0;
+	}
+}
+
+/*
+ *	Index register rewriting. A target that can keep a pointer in an
+ *	index register for the whole of an expression sets gen_index_reg in
+ *	gen_start, along with the largest offset it can address from it.
+ *	When the same pointer is dereferenced more than once we load it into
+ *	the register up front and turn each use into *(reg + offset), the
+ *	same tree the target already handles for register variables.
+ *
+ *	gen_index_reg is passed the expression and returns the T_REG number
+ *	to use, or 0 if something in the expression needs that register.
+ */
+unsigned (*gen_index_reg)(struct node *n);
+unsigned index_max_off;
+
+/* The type once any LVAL has been turned into a pointer */
+static unsigned index_type(register struct node *n)
+{
+	if (n->flags & LVAL)
+		return n->type + 1;
+	return n->type;
+}
+
+/* The front end is not consistent about the type it gives a pointer
+   it is about to offset so treat all pointers as the same */
+static unsigned same_tree(register struct node *a, register struct node *b)
+{
+	register unsigned ta, tb;
+
+	if (a == NULL || b == NULL)
+		return a == b;
+	ta = index_type(a);
+	tb = index_type(b);
+	if (ta != tb && !(PTR(ta) && PTR(tb)))
+		return 0;
+	if (a->op != b->op || a->value != b->value ||
+		a->val2 != b->val2 || a->snum != b->snum)
+		return 0;
+	return same_tree(a->left, b->left) && same_tree(a->right, b->right);
+}
+
+/* Pointer calculations that can be evaluated early and held */
+static unsigned index_pure(register struct node *n)
+{
+	if (n == NULL)
+		return 1;
+	if (n->flags & SIDEEFFECT)
+		return 0;
+	switch(n->op) {
+	case T_CONSTANT:
+	case T_LOCAL:
+	case T_ARGUMENT:
+	case T_NAME:
+	case T_LABEL:
+	case T_REG:
+	case T_DEREF:
+	case T_PLUS:
+	case T_MINUS:
+	case T_STAR:
+	case T_LTLT:
+	case T_CAST:
+		return index_pure(n->left) && index_pure(n->right);
+	}
+	return 0;
+}
+
+/* Nothing may change what the pointer was worked out from before the
+   last use, and it must be safe to evaluate it unconditionally. A store
+   is only allowed at the top as it then happens after all the uses */
+static unsigned index_safe(register struct node *n, struct node *root)
+{
+	if (n == NULL)
+		return 1;
+	if (n != root && (n->flags & SIDEEFFECT))
+		return 0;
+	switch(n->op) {
+	case T_ANDAND:
+	case T_OROR:
+	case T_QUESTION:
+	case T_FUNCCALL:
+		return 0;
+	}
+	return index_safe(n->left, root) && index_safe(n->right, root);
+}
+
+/* Find where the pointer for a load or store is held, stepping over any
+   constant offset the index register can absorb */
+static struct node **index_slot(register struct node *n)
+{
+	register struct node **p;
+	register struct node *a;
+
+	if (n->op == T_DEREF)
+		p = &n->right;
+	else if (n->op == T_EQ)
+		p = &n->left;
+	else
+		return NULL;
+	a = *p;
+	if (a->op == T_PLUS && a->right->op == T_CONSTANT &&
+		a->right->value <= index_max_off) {
+		p = &a->left;
+		a = *p;
+	}
+	switch(a->op) {
+	/* Already directly addressable */
+	case T_LOCAL:
+	case T_ARGUMENT:
+	case T_NAME:
+	case T_LABEL:
+	case T_CONSTANT:
+	case T_REG:
+		return NULL;
+	case T_DEREF:
+		/* Register variable */
+		if (a->right->op == T_REG)
+			return NULL;
+	}
+	if (!PTR(index_type(a)) || !index_pure(a))
+		return NULL;
+	return p;
+}
+
+static unsigned index_count(register struct node *n, struct node *b)
+{
+	struct node **p;
+	unsigned c = 0;
+
+	if (n == NULL)
+		return 0;
+	p = index_slot(n);
+	if (p && same_tree(*p, b)) {
+		/* Only the stored value is left to look at */
+		if (n->op == T_EQ)
+			return 1 + index_count(n->right, b);
+		return 1;
+	}
+	c = index_count(n->left, b);
+	return c + index_count(n->right, b);
+}
+
+static struct node *index_find(register struct node *n, struct node *root)
+{
+	struct node **p;
+	struct node *b;
+
+	if (n == NULL)
+		return NULL;
+	p = index_slot(n);
+	if (p && index_count(root, *p) > 1)
+		return *p;
+	b = index_find(n->left, root);
+	if (b == NULL)
+		b = index_find(n->right, root);
+	return b;
+}
+
+static struct node *index_reg_node(unsigned type, unsigned r)
+{
+	register struct node *n = new_node();
+	n->op = T_REG;
+	n->type = type;
+	n->flags = LVAL;
+	n->value = r;
+	n->val2 = 0;
+	n->snum = 0;
+	return n;
+}
+
+/* Replace each use of b with a load of the index register */
+static void index_replace(register struct node *n, struct node *b, unsigned r)
+{
+	register struct node *d;
+	struct node **p;
+
+	if (n == NULL)
+		return;
+	p = index_slot(n);
+	if (p && same_tree(*p, b)) {
+		/* The first copy becomes the load, the rest go */
+		if (*p != b)
+			free_tree(*p);
+		d = new_node();
+		d->op = T_DEREF;
+		d->type = index_type(b);
+		d->val2 = 0;
+		d->snum = 0;
+		d->right = index_reg_node(d->type, r);
+		*p = d;
+		if (n->op == T_EQ)
+			index_replace(n->right, b, r);
+		return;
+	}
+	index_replace(n->left, b, r);
+	index_replace(n->right, b, r);
+}
+
+static struct node *index_rewrite(register struct node *n)
+{
+	register struct node *b;
+	register struct node *e;
+	struct node *c;
+	unsigned r;
+
+	if (!index_safe(n, n))
+		return n;
+	b = index_find(n, n);
+	if (b == NULL)
+		return n;
+	r = gen_index_reg(n);
+	if (r == 0)
+		return n;
+	index_replace(n, b, r);
+	/* (reg = b), n */
+	e = new_node();
+	e->op = T_EQ;
+	e->type = index_type(b);
+	e->flags = SIDEEFFECT | NORETURN;
+	e->val2 = 0;
+	e->snum = 0;
+	e->left = index_reg_node(e->type, r);
+	e->right = b;
+	c = new_node();
+	c->op = T_COMMA;
+	c->type = n->type;
+	c->flags = n->flags;
+	c->val2 = 0;
+	c->snum = 0;
+	c->left = e;
+	c->right = n;
+	return c;
+}
+
 static unsigned process_expression(void)
 {
 	register struct node *n = load_tree();
@@ -357,21 +628,44 @@ static unsigned process_expression(void)
 	dump_tree(n, 0);
 #endif
 	n = gen_rewrite(n);
+	if (gen_index_reg)
+		n = index_rewrite(n);
 	n = rewrite_tree(n);
 #ifdef DEBUG
 	fprintf(stderr, ":rewritten:\n");
 	dump_tree(n, 0);
 #endif
+	expr_root = n;
 	gen_tree(n);
+	expr_root = NULL;
 	t = n->type;
 	free_tree(n);
 	return t;
 }
 
+/* Headers that may change the flow of control. Data can appear in the
+   middle of a function and a return expression is still straight line
+   code */
+static unsigned flow_header(unsigned t)
+{
+	if (t == H_RETURN)
+		return 0;
+	switch(t & ~H_FOOTER) {
+	case H_EXPORT:
+	case H_STRING:
+	case H_DATA:
+	case H_BSS:
+	case H_SWITCHTAB:
+		return 0;
+	}
+	return 1;
+}
+
 static unsigned compile_expression(void)
 {
 	uint8_t h[2];
 	unsigned t;
+	no_defer++;
 	/* We can end up with literal headers before the expression if the
 	   expression is something like if (x = "eep"). Process up to and
 	   including our expression */
@@ -379,6 +673,7 @@ static unsigned compile_expression(void)
 		xread(0, h, 2);
 		t = process_one_block(h);
 	} while (h[1] != '^');
+	no_defer--;
 	return t;
 }
 
@@ -392,6 +687,7 @@ static unsigned frame_len;
 static unsigned argframe_len;
 static unsigned func_ret_used;
 unsigned func_flags;
+unsigned frame_label;
 
 static void process_literal(unsigned id)
 {
@@ -426,6 +722,9 @@ static void process_header(void)
 
 	xread(0, &h, sizeof(struct header));
 
+	if (flow_header(h.h_type))
+		flush_cleanup(h.h_type == (H_RETURN | H_FOOTER));
+
 	switch (h.h_type) {
 	case H_EXPORT:
 		gen_export(namestr(h.h_name));
@@ -444,6 +743,9 @@ static void process_header(void)
 	case H_ARGFRAME:
 		argframe_len = h.h_name;
 		break;
+	case H_FRAMELABEL:
+		frame_label = h.h_name;
+		break;
 	case H_FUNCTION | H_FOOTER:
 		if (func_ret_used)
 			gen_label("_r", h.h_name);
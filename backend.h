@@ -64,6 +64,14 @@ extern unsigned gen_shortcut(struct node *n);
 /* Build a node */
 extern void make_node(struct node *n);
 
+/* Deferred stack cleanup */
+extern void (*gen_flush_cleanup)(unsigned v, unsigned exiting);
+extern unsigned defer_cleanup(struct node *n, unsigned v, unsigned depth, unsigned limit);
+
+/* Holding a pointer in an index register across an expression */
+extern unsigned (*gen_index_reg)(struct node *n);
+extern unsigned index_max_off;
+
 #define A_CODE		1
 #define A_DATA		2
 #define A_BSS		3
@@ -72,3 +80,4 @@ extern void make_node(struct node *n);
 #define MAX_SEG		3
 
 extern unsigned func_flags;
+extern unsigned frame_label;	/* Label for static locals if not re-entrant */
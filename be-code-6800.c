@@ -127,6 +127,47 @@ void add_b_const(register uint8_t n)
 
 }
 
+/* Load the upper half of a long. This lives in Y if we have one and in
+   @hireg if not, in which case D is trashed unless it holds the value
+   already or the value is 0 */
+void load_hi_const(register uint16_t n)
+{
+	if (hi_valid && hi_val == n)
+		return;
+	if (cpu_has_y) {
+		if (hi_valid && (uint16_t)(n - hi_val) == 1)
+			puts("\tiny");
+		else if (hi_valid && (uint16_t)(hi_val - n) == 1)
+			puts("\tdey");
+		else
+			printf("\tldy #%u\n", n);
+	} else if (n == 0 && !(a_valid && b_valid && a_val == 0 && b_val == 0))
+		puts("\tclr @hireg\n\tclr @hireg+1");
+	else {
+		load_d_const(n);
+		if (cpu_has_d)
+			puts("\tstd @hireg");
+		else
+			puts("\tstaa @hireg\n\tstab @hireg+1");
+	}
+	modify_hi(n);
+	hi_valid = 1;
+}
+
+/* Only used when we have Y */
+void add_hi_const(register uint16_t n)
+{
+	if (n == 0)
+		return;
+	if (n <= 3)
+		repeated_op(n, "iny");
+	else if (n >= 0xFFFD)
+		repeated_op(-n & 0xFFFF, "dey");
+	else
+		printf("\txgdy\n\taddd #%u\n\txgdy\n", n);
+	modify_hi(hi_val + n);
+}
+
 void load_a_b(void)
 {
 	puts("\ttba");
@@ -165,6 +206,8 @@ void move_d_s(void)
 void swap_d_y(void)
 {
 	puts("\txgdy");
+	invalidate_work();
+	invalidate_hi();
 }
 
 void swap_d_x(void)
@@ -381,6 +424,7 @@ static void op32_on_ptr(const char *op, const char *op2, unsigned off)
 		puts("\tpshb\n\tpsha\n\tldaa @hireg\n\tldab @hireg+1");
 		printf("\t%sb %u,x\n\t%sa %u,x\n", op2, off + 1, op2, off);
 		puts("\tstaa @hireg\n\tstab @hireg+1\n\tpula\n\tpulb");
+		invalidate_hi();
 	}
 }
 
@@ -399,6 +443,7 @@ void op32d_on_ptr(const char *op, const char *op2, unsigned off)
 		puts("\tpshb\n\tpsha\n\tldd @hireg\n");
 		printf("\t%sb %u,x\n\t%sa %u,x\n", op2, off + 1, op2, off);
 		puts("\tstd @hireg\n\tpula\n\tpulb");
+		invalidate_hi();
 	}
 }
 
@@ -415,6 +460,8 @@ void load32(register unsigned off)
 			off + 2, off + 3, off);
 		invalidate_x();
 	}
+	invalidate_work();
+	invalidate_hi();
 }
 
 void store32(register unsigned off, unsigned nr)
@@ -666,6 +713,7 @@ unsigned op16y_on_node(register struct node *r, const char *op, unsigned off)
 	case T_NREF:
 	case T_NAME:
 		printf("\t%sy %s\n", op, addr_form(r, off, 2));
+		break;
 	default:
 		return 0;
 	}
@@ -806,14 +854,157 @@ unsigned write_tos_uniop(struct node *n, register const char *op)
 	return 1;
 }
 
-/* TODO: decide how much we inline for -Os */
+/*
+ *	32bit constant shifts. The value is held as @hireg, @hireg+1, A, B
+ *	(high to low). Whole bytes are moved and the remaining bits shifted
+ *	through the bytes that are not yet known to be zero or sign. On the
+ *	68HC11 the upper half is spilled from Y into @hireg to do this.
+ */
+
+/* Cost in bytes of the helper call including pushing the value */
+#define SHIFT16_HELPER	8
+#define SHIFT32_HELPER	12
+
+static void op_byte32(register unsigned b, register const char *op)
+{
+	if (b == 2)
+		printf("\t%sa\n", op);
+	else if (b == 3)
+		printf("\t%sb\n", op);
+	else
+		printf("\t%s @hireg%s\n", op, b ? "+1" : "");
+}
+
+/* Size of the bit shifting part. Bytes in @hireg cost two, registers one */
+static unsigned shift32_cost(unsigned k, unsigned r, unsigned left)
+{
+	unsigned b = 4 - k;
+	unsigned c;
+
+	if (left)
+		c = b < 2 ? b : 2;
+	else
+		c = k < 2 ? 2 - k : 0;
+	c = (c + b) * r;
+	/* Byte moves are roughly the same size whichever way we go */
+	return c + 2 * k;
+}
+
+static void load_d_hireg(void)
+{
+	if (cpu_has_d)
+		puts("\tldd @hireg");
+	else
+		puts("\tldaa @hireg\n\tldab @hireg+1");
+}
+
+static void store_d_hireg(void)
+{
+	if (cpu_has_d)
+		puts("\tstd @hireg");
+	else
+		puts("\tstaa @hireg\n\tstab @hireg+1");
+}
+
+static unsigned shift32(register struct node *n, unsigned left)
+{
+	register unsigned v = n->right->value;
+	register unsigned k, r, b;
+	const char *op = left ? "lsl" : "lsr";
+
+	if (n->right->op != T_CONSTANT || v >= 32 || v == 0)
+		return 0;
+	if (!left && !(n->type & UNSIGNED))
+		op = "asr";
+	k = v >> 3;
+	r = v & 7;
+	if (r > 3 || (optsize && shift32_cost(k, r, left) > SHIFT32_HELPER))
+		return 0;
+
+	/* Word moves on the 68HC11 are just an exchange with Y */
+	if (cpu_has_y && v == 16) {
+		if (left)
+			puts("\txgdy\n\tclra\n\tclrb");
+		else if (n->type & UNSIGNED)
+			puts("\txgdy\n\tldy #0");
+		else {
+			label++;
+			printf("\txgdy\n\tldy #0\n\ttsta\n\tbpl X%u\n\tdey\nX%u:\n",
+				label, label);
+		}
+		invalidate_work();
+		invalidate_hi();
+		return 1;
+	}
+	if (cpu_has_y && (!left || k < 2))
+		puts("\tsty @hireg");
+
+	if (left) {
+		switch(k) {
+		case 1:
+			puts("\tpsha\n\tldaa @hireg+1\n\tstaa @hireg\n\tpula\n\tstaa @hireg+1\n\ttba\n\tclrb");
+			break;
+		case 2:
+			store_d_hireg();
+			puts("\tclra\n\tclrb");
+			break;
+		case 3:
+			puts("\tstab @hireg\n\tclr @hireg+1\n\tclra\n\tclrb");
+			break;
+		}
+		/* Shift the bytes that can still be non zero */
+		while(r--) {
+			b = 3 - k;
+			op_byte32(b, "lsl");
+			while(b--)
+				op_byte32(b, "rol");
+		}
+	} else {
+		unsigned sign = !(n->type & UNSIGNED);
+		if (sign && k)
+			label++;
+		switch(k) {
+		case 1:
+			puts("\ttab\n\tldaa @hireg+1\n\tpsha\n\tldaa @hireg\n\tclr @hireg\n\tstaa @hireg+1");
+			if (sign)
+				printf("\tbpl X%u\n\tcom @hireg\nX%u:\n", label, label);
+			puts("\tpula");
+			break;
+		case 2:
+			load_d_hireg();
+			puts("\tclr @hireg\n\tclr @hireg+1");
+			if (sign)
+				printf("\ttsta\n\tbpl X%u\n\tcom @hireg\n\tcom @hireg+1\nX%u:\n",
+					label, label);
+			break;
+		case 3:
+			puts("\tldab @hireg\n\tclra\n\tclr @hireg\n\tclr @hireg+1");
+			if (sign)
+				printf("\ttstb\n\tbpl X%u\n\tcoma\n\tcom @hireg\n\tcom @hireg+1\nX%u:\n",
+					label, label);
+			break;
+		}
+		while(r--) {
+			op_byte32(k, op);
+			for (b = k + 1; b < 4; b++)
+				op_byte32(b, "ror");
+		}
+	}
+	if (cpu_has_y)
+		puts("\tldy @hireg");
+	invalidate_work();
+	invalidate_hi();
+	return 1;
+}
 
 unsigned left_shift(register struct node *n)
 {
 	register unsigned s = get_size(n->type);
 	register unsigned v;
 
-	if (s > 2 || n->right->op != T_CONSTANT)
+	if (s == 4)
+		return shift32(n, 1);
+	if (n->right->op != T_CONSTANT)
 		return 0;
 	v = n->right->value;
 	if (s == 1) {
@@ -840,6 +1031,8 @@ unsigned left_shift(register struct node *n)
 			}
 			return 1;
 		}
+		if (optsize && 2 * v > SHIFT16_HELPER)
+			return 0;
 		while(v--)
 			puts("\tlslb\n\trola");
 		invalidate_work();
@@ -857,7 +1050,9 @@ unsigned right_shift(register struct node *n)
 	if (n->type & UNSIGNED)
 		op = "lsr";
 
-	if (s > 2 || n->right->op != T_CONSTANT)
+	if (s == 4)
+		return shift32(n, 0);
+	if (n->right->op != T_CONSTANT)
 		return 0;
 	v = n->right->value;
 	if (s == 1) {
@@ -874,9 +1069,15 @@ unsigned right_shift(register struct node *n)
 			load_d_const(0);
 			return 1;
 		}
-		if (v >= 8 && (n->type & UNSIGNED)) {
-			load_b_a();
-			load_a_const(0);
+		if (v >= 8) {
+			if (n->type & UNSIGNED) {
+				load_b_a();
+				load_a_const(0);
+			} else {
+				/* Sign extend the old top byte */
+				puts("\ttab\n\tlsla\n\tldaa #0\n\tsbca #0");
+				invalidate_work();
+			}
 			v -= 8;
 			if (v) {
 				while(v--)
@@ -885,6 +1086,8 @@ unsigned right_shift(register struct node *n)
 			}
 			return 1;
 		}
+		if (optsize && 2 * v > SHIFT16_HELPER)
+			return 0;
 		while(v--)
 			printf("\t%sa\n\trorb\n", op);
 		invalidate_work();
@@ -983,6 +1186,11 @@ unsigned load_u_with(struct node *r, unsigned off)
 	return load_r_with('u', r, off);
 }
 
+unsigned load_y_with(struct node *r, unsigned off)
+{
+	return load_r_with('y', r, off);
+}
+
 unsigned cmp_direct(struct node *n, const char *uop, const char *op)
 {
 	register struct node *r = n->right;
@@ -99,6 +99,31 @@ void add_b_const(uint8_t n)
 
 }
 
+/* Upper half of a long lives in Y */
+void load_hi_const(uint16_t n)
+{
+	int16_t d = n - hi_val;
+
+	if (hi_valid && d == 0)
+		return;
+	if (hi_valid && d >= -16 && d <= 15)
+		printf("\tleay %d,y\n", d);
+	else if (a_valid && b_valid && n == ((a_val << 8) | b_val))
+		puts("\ttfr d,y");
+	else
+		printf("\tldy #%u\n", n);
+	modify_hi(n);
+	hi_valid = 1;
+}
+
+void add_hi_const(uint16_t n)
+{
+	if (n == 0)
+		return;
+	printf("\tleay %d,y\n", (int16_t)n);
+	modify_hi(hi_val + n);
+}
+
 void load_a_b(void)
 {
 	puts("\ttfr b,a");
@@ -129,6 +154,8 @@ void move_d_s(void)
 void swap_d_y(void)
 {
 	puts("\texg d,y");
+	invalidate_work();
+	invalidate_hi();
 }
 
 void swap_d_x(void)
@@ -236,6 +263,8 @@ void op32d_on_ptr(const char *op, const char *op2, unsigned off)
 void load32(unsigned off)
 {
 	printf("\tldy %u,x\n\tldd %u,x\n", off, off + 2);
+	invalidate_work();
+	invalidate_hi();
 }
 
 void store32(unsigned off, unsigned nr)
@@ -299,7 +328,7 @@ static char *addr_form(register struct node *r, unsigned off, unsigned s)
 		return addr;
 	/* Only occurs on 6809 */
 	case T_RDEREF:
-		sprintf(addr, "%u,u", r->val2 + off);
+		sprintf(addr, "%u,%c", r->val2 + off, REGNAME(r));
 		return addr;
 	/* TODO: Can we do locals safely via ,s ?? */
 	default:
@@ -336,6 +365,7 @@ unsigned op8_on_node(struct node *r, const char *op, unsigned off)
 	case T_NSTORE:
 	case T_NREF:
 	case T_NAME:
+	case T_RDEREF:
 		printf("\t%sb %s\n", op, addr_form(r, off, 1));
 		break;
 	default:
@@ -366,6 +396,7 @@ unsigned op16_on_node(struct node *r, const char *op, const char *op2, unsigned
 	case T_NSTORE:
 	case T_NREF:
 	case T_NAME:
+	case T_RDEREF:
 		printf("\t%sa %s\n", op, addr_form(r, off, 1));
 		printf("\t%sb %s\n", op2, addr_form(r, off + 1, 1));
 		break;
@@ -392,6 +423,7 @@ unsigned op16d_on_node(struct node *r, const char *op, const char *op2, unsigned
 	case T_NSTORE:
 	case T_NREF:
 	case T_NAME:
+	case T_RDEREF:
 		printf("\t%sd %s\n", op, addr_form(r, off, 2));
 		break;
 	default:
@@ -416,6 +448,7 @@ unsigned op16y_on_node(struct node *r, const char *op, unsigned off)
 	case T_NREF:
 	case T_NAME:
 		printf("\t%sy %s\n", op, addr_form(r, off, 2));
+		break;
 	default:
 		return 0;
 	}
@@ -688,8 +721,8 @@ static unsigned load_r_with(char reg, struct node *r, unsigned off)
 		printf("\tld%c %s\n", reg, addr_form(r, off, 2));
 		break;
 	case T_RREF:
-		if (reg != 'u')
-			printf("\ttfr u,%c\n", reg);
+		if (reg != REGNAME(r))
+			printf("\ttfr %c,%c\n", REGNAME(r), reg);
 		break;
 	case T_PLUS:
 		/* Special case array/struct */
@@ -702,7 +735,7 @@ static unsigned load_r_with(char reg, struct node *r, unsigned off)
 	case T_MINUS:
 		if (cpu_is_09 && can_load_r_simple(r->left, off) &&
 			r->right->op == T_CONSTANT) {
-			load_r_with(reg, r->right, off);
+			load_r_with(reg, r->left, off);
 			return -r->right->value;
 		}
 		break;
@@ -725,30 +758,57 @@ unsigned load_u_with(struct node *r, unsigned off)
 	return load_r_with('u', r, off);
 }
 
+unsigned load_y_with(struct node *r, unsigned off)
+{
+	return load_r_with('y', r, off);
+}
+
+/* Compare the working value with a simple right hand side. If all we need
+   is the condition then leave it in the flags for the branch, otherwise
+   go via the boolean helpers */
 unsigned cmp_direct(struct node *n, const char *uop, const char *op)
 {
-	unsigned s = get_size(n->right->type);
-	unsigned v = n->right->value;
+	struct node *r = n->right;
+	unsigned s = get_size(r->type);
+	unsigned v = r->value;
 
-	if (n->right->op != T_CONSTANT)
+	switch(r->op) {
+	case T_CONSTANT:
+	case T_NAME:
+	case T_LABEL:
+	case T_NREF:
+	case T_LBREF:
+	case T_LREF:
+		break;
+	default:
 		return 0;
-	if (n->right->type & UNSIGNED)
-		op = uop;
-	if (s == 1) {
-		printf("\tcmpb #%u\n", v & 0xFF);
-		printf("\t%s %s\n", jsr_op, op);
-		n->flags |= ISBOOL;
-		invalidate_b();
-		return 1;
 	}
-	if (s == 2) {
+	if (s > 2)
+		return 0;
+	if (r->type & UNSIGNED)
+		op = uop;
+	/* cmp leaves D alone, but subd # is a byte shorter so use it if we
+	   don't know anything useful about D */
+	if (s == 2 && r->op == T_CONSTANT && !d_valid) {
 		printf("\tsubd #%u\n", v & 0xFFFF);
-		printf("\t%s %s\n", jsr_op, op);
-		n->flags |= ISBOOL;
 		invalidate_work();
+	} else if (r->op == T_LREF) {
+		if (s == 1)
+			op8_on_s("cmp", v + sp);
+		else
+			op16d_on_s("cmp", "cmp", v + sp);
+	} else if (s == 1)
+		printf("\tcmpb %s\n", addr_form(r, 0, 1));
+	else
+		printf("\tcmpd %s\n", addr_form(r, 0, 2));
+	n->flags |= ISBOOL;
+	if ((n->flags & (CCONLY | CCFIXED)) == CCONLY) {
+		set_cc_branch(n->op, r->type & UNSIGNED, 0);
 		return 1;
 	}
-	return 0;
+	printf("\t%s %s\n", jsr_op, op);
+	invalidate_work();
+	return 1;
 }
 
 /*
@@ -885,14 +945,18 @@ unsigned cmp_op(struct node *n, const char *uop, const char *op)
 		op = uop;
 	if (s > 2)	/* For now anyway */
 		return 0;
-	/* We can do this versus s+ or s++ */
-	/* FIXME: 6809 has cmpd unlike 6803 */
+	/* We can do this versus s+ or s++. The right side is in D so the
+	   compare is the wrong way around */
 	if (s == 1)
 		op8_on_tos("cmp");
 	else if (s == 2)
 		op16d_on_tos("cmp");
-	printf("\t%s %s\n", jsr_op, op);
 	n->flags |= ISBOOL;
+	if ((n->flags & (CCONLY | CCFIXED)) == CCONLY) {
+		set_cc_branch(n->op, n->right->type & UNSIGNED, 1);
+		return 1;
+	}
+	printf("\t%s %s\n", jsr_op, op);
 	invalidate_work();
 	return 1;
 }
@@ -246,11 +246,11 @@ struct node *gen_rewrite_node(struct node *n)
 		free_node(r);			/* Discsrd plus */
 		return n;
 	}
-	/* *regptr */
-	if (op == T_DEREF && r->op == T_RREF) {
+	/* *regptr, or *(regptr + offset) once folded into a DEREFPLUS */
+	if ((op == T_DEREF || op == T_DEREFPLUS) && r->op == T_RREF) {
 		n->op = T_RDEREF;
 		n->right = NULL;
-		n->val2 = 0;
+		n->val2 = n->value;
 		n->value = r->value;
 		free_node(r);
 		return n;
@@ -268,9 +268,9 @@ struct node *gen_rewrite_node(struct node *n)
 		return n;
 	}
 	/* *regptr = */
-	if (op == T_EQ && l->op == T_RREF) {
+	if ((op == T_EQ || op == T_EQPLUS) && l->op == T_RREF) {
 		n->op = T_REQ;
-		n->val2 = 0;
+		n->val2 = n->value;
 		n->value = l->value;
 		n->left = NULL;
 		free_node(l);
@@ -373,6 +373,28 @@ struct node *gen_rewrite_node(struct node *n)
 			n->left = r;
 		}
 	}
+	/* Comparisons can be swapped in the same way if we reverse the test */
+	if (op == T_EQEQ || op == T_BANGEQ || op == T_LT || op == T_GT ||
+		op == T_LTEQ || op == T_GTEQ) {
+		if (is_simple(n->left) > is_simple(n->right)) {
+			n->right = l;
+			n->left = r;
+			switch(op) {
+			case T_LT:
+				n->op = T_GT;
+				break;
+			case T_GT:
+				n->op = T_LT;
+				break;
+			case T_LTEQ:
+				n->op = T_GTEQ;
+				break;
+			case T_GTEQ:
+				n->op = T_LTEQ;
+				break;
+			}
+		}
+	}
 	return n;
 }
 
@@ -417,7 +439,7 @@ unsigned gen_direct(struct node *n)
 				return 1;
 			} else if (s == 4 && cpu_has_y) {
 				load_d_const(v);
-				printf("\tldy #%u\n", (unsigned)(r->value >> 16));
+				load_hi_const(r->value >> 16);
 				op32d_on_ptr("st", "st", off);
 				return 1;
 			}
@@ -429,8 +451,6 @@ unsigned gen_direct(struct node *n)
 		break;
 	case T_PLUS:
 		/* So we can track this common case later */
-		/* TODO: if the low word is zero or low 24 bits are 0 we can generate stuff like
-			leay %d,y */
 		if (r->op == T_CONSTANT && r->type != FLOAT) {
 			if (s == 4 && cpu_has_y) {
 				/* Handle the zero case specially as we can optimzie it, and also
@@ -442,13 +462,8 @@ unsigned gen_direct(struct node *n)
 					printf("\tadcb #%u\n", (unsigned)((r->value >> 16) & 0xFF));
 					printf("\tadca #%u\n", (unsigned)((r->value >> 24) & 0xFF));
 					swap_d_y();
-				} else if (cpu_is_09)
-					printf("\tleay %u,y\n", (unsigned)(r->value >> 16));
-				else {
-					swap_d_y();
-					printf("\taddd #%u\n", (unsigned)(r->value >> 16));
-					swap_d_y();
-				}
+				} else
+					add_hi_const(r->value >> 16);
 				return 1;
 			}
 			if (s == 2) {
@@ -471,13 +486,8 @@ unsigned gen_direct(struct node *n)
 					printf("\tadcb #%u\n", (unsigned)((r->value >> 16) & 0xFF));
 					printf("\tadca #%u\n", (unsigned)((r->value >> 24) & 0xFF));
 					swap_d_y();
-				} else if (cpu_has_lea)
-					printf("\tleay %u,y\n", (unsigned)(r->value >> 16));
-				else {
-					swap_d_y();
-					printf("\taddd #%u\n", (unsigned)(r->value >> 16));
-					swap_d_y();
-				}
+				} else
+					add_hi_const(r->value >> 16);
 				return 1;
 			}
 			if (s == 2) {
@@ -519,13 +529,9 @@ unsigned gen_direct(struct node *n)
 				modify_a(a_val & v);
 			}
 			if (s == 4) {
-				if (hv == 0x0000) {
-					if (cpu_has_y)
-						puts("\tldy #0");
-					else {
-						puts("\tclr @hireg\n\tclr @hireg+1");
-					}
-				} else if (hv != 0xFFFF) {
+				if (hv == 0x0000)
+					load_hi_const(0);
+				else if (hv != 0xFFFF) {
 					swap_d_y();
 					if (hv & 0xFF)
 						printf("\tandb #%u\n", hv & 0xFF);
@@ -562,7 +568,7 @@ unsigned gen_direct(struct node *n)
 			}
 			if (s == 4) {
 				if (hv == 0xFFFF)
-					puts("\tldy #0xFFFF");
+					load_hi_const(0xFFFF);
 				else if (hv) {
 					swap_d_y();
 					if (hv & 0xFF)
@@ -598,6 +604,7 @@ unsigned gen_direct(struct node *n)
 			if (s == 4) {
 				if (hv == 0xFFFF && !cpu_has_y) {
 					puts("\tcom @hireg\n\tcom @hireg+1");
+					modify_hi(~hi_val);
 				} else if (hv) {
 					swap_d_y();
 					if ((hv & 0xFF) == 0xFF)
@@ -848,6 +855,11 @@ unsigned write_xsimple(struct node *n, unsigned via_ptr)
 		return 0;
 	}
 	top = deref_op(l->op);
+	/* Arguments are just locals further up */
+	if (l->op == T_ARGUMENT && !via_ptr) {
+		l->value += argbase + frame_len;
+		top = T_LREF;
+	}
 	if (via_ptr || top == 0) {
 		off = load_x_with(l, 0);
 		opd_on_ptr(n, "ld", "ld", off);
@@ -872,13 +884,67 @@ unsigned write_xsimple(struct node *n, unsigned via_ptr)
 	return 1;
 }
 
-/* TODO: 6809 could index locals via S so if n->left is LOCAL or
-   ARGUMENT we can special case it */
+/* The 6809 can index locals via S so if n->left is LOCAL or ARGUMENT we
+   can work on it directly without going via X */
+static unsigned do_seqop(struct node *n)
+{
+	struct node *l = n->left;
+	unsigned s = get_size(n->type);
+	const char *op, *op2;
+	unsigned op16 = 0;
+
+	switch(n->op) {
+	case T_ANDEQ:
+		op = op2 = "and";
+		break;
+	case T_OREQ:
+		op = op2 = "or";
+		break;
+	case T_HATEQ:
+		op = op2 = "eor";
+		break;
+	case T_PLUSEQ:
+	case T_MINUSEQ:
+		op = "add";
+		op2 = "adc";
+		op16 = 1;
+		break;
+	default:
+		return 0;
+	}
+	codegen_lr(n->right);
+	/* We want to subtract D from the local so negate it and add */
+	if (n->op == T_MINUSEQ) {
+		if (s == 1) {
+			puts("\tnegb");
+			modify_b(-b_val);
+		} else {
+			puts("\tcoma\n\tcomb");
+			modify_a(~a_val);
+			modify_b(~b_val);
+			add_d_const(1);
+		}
+	}
+	if (l->op == T_ARGUMENT)
+		l->value += argbase + frame_len;
+	l->op = T_LREF;
+	l->type = n->type;
+	if (op16)
+		write_opd(l, op, op2, 0);
+	else
+		write_op(l, op, op2, 0);
+	write_opd(l, "st", "st", 0);
+	invalidate_mem();
+	set_d_node(l);
+	return 1;
+}
+
 unsigned do_xeqop(struct node *n, const char *op)
 {
 	unsigned off;
 	struct node *l = n->left;
 	struct node *r = n->right;
+
 	/* Handle simpler cases of -= the other way around */
 	if (is_simple(r) && get_size(n->type) <= 2) {
 		if (is_simple(l)) {
@@ -890,6 +956,9 @@ unsigned do_xeqop(struct node *n, const char *op)
 				return 1;
 		}
 	}
+	if (cpu_is_09 && get_size(n->type) <= 2 &&
+		(l->op == T_LOCAL || l->op == T_ARGUMENT) && do_seqop(n))
+		return 1;
 	if (!can_load_r_with(n->left, 0)) {
 		printf(";can't load x %u\n", n->left->op);
 		/* Compute the left side and stack it */
@@ -910,7 +979,13 @@ unsigned do_xeqop(struct node *n, const char *op)
 	/* Things we can then inline */
 	if (do_xptrop(n, op, off) == 0)
 		error("xptrop");
-	set_d_node_ptr(n->left);
+	/* Postfix forms hand back the old value */
+	if (n->op == T_PLUSPLUS || n->op == T_MINUSMINUS)
+		return 1;
+	if (get_size(n->type) == 4)
+		set_dy_node_ptr(n->left);
+	else
+		set_d_node_ptr(n->left);
 	return 1;
 }
 
@@ -1004,6 +1079,125 @@ unsigned memop_shift(struct node *n, const char *op, const char *opu)
 	return 0;
 }
 
+/*
+ *	Point X at the byte the tree n addresses for the 6303 and 68HC11
+ *	memory bit operations. These have no extended forms so globals also
+ *	go via X, but it's still shorter than a load, op and store through B
+ *	and leaves D alone. Returns the offset from X or -1 if we can't.
+ */
+static int bitop_ptr(struct node *n)
+{
+	unsigned off = 0;
+
+	if (n->op == T_PLUS && n->right->op == T_CONSTANT) {
+		off = n->right->value;
+		n = n->left;
+		/* A pointer we load into X and index off */
+		if (n->op != T_LREF && n->op != T_NREF && n->op != T_LBREF)
+			return -1;
+		if (off > 255)
+			return -1;
+	}
+	if (!can_load_r_with(n, 0))
+		return -1;
+	return off + load_x_with(n, 0);
+}
+
+unsigned memop_bit(struct node *n)
+{
+	struct node *r = n->right;
+	unsigned v = r->value & 0xFF;
+	int off;
+
+	if (r->op != T_CONSTANT)
+		return 0;
+	if (n->op == T_HATEQ && !cpu_has_aim)
+		return 0;
+	if (!cpu_has_aim && !cpu_has_bset)
+		return 0;
+	off = bitop_ptr(n->left);
+	if (off < 0)
+		return 0;
+	if (cpu_has_aim) {
+		switch(n->op) {
+		case T_ANDEQ:
+			printf("\taim #%u,%u,x\n", v, off);
+			break;
+		case T_OREQ:
+			printf("\toim #%u,%u,x\n", v, off);
+			break;
+		case T_HATEQ:
+			printf("\teim #%u,%u,x\n", v, off);
+			break;
+		}
+	} else if (n->op == T_ANDEQ)
+		printf("\tbclr %u,x #%u\n", off, BYTE(~v));
+	else
+		printf("\tbset %u,x #%u\n", off, v);
+	invalidate_mem();
+	return 1;
+}
+
+/*
+ *	Flags only tests of a byte against a mask, ie if (x & 4). Work on
+ *	just the byte with bitb, or on the 6303 test memory directly with tim.
+ *	The 68HC11 brset/brclr have only a short branch and we can't fix them
+ *	up when the target is out of range so they are not used.
+ */
+static unsigned bit_test(struct node *n)
+{
+	struct node *r = n->right;
+	struct node *l;
+	unsigned invert = 0;
+	unsigned v;
+	unsigned off;
+
+	if (cpu_is_09 || !(n->flags & CCONLY))
+		return 0;
+	if (n->op == T_BANG)
+		invert = 1;
+	else if (r->op == T_BANG) {
+		invert = 1;
+		r = r->right;
+	}
+	/* We can't flip the sense in the middle of an && or || chain */
+	if (invert && (n->flags & CCFIXED))
+		return 0;
+	if (r->op != T_AND || r->right->op != T_CONSTANT || get_size(r->type) > 2)
+		return 0;
+	v = r->right->value & 0xFFFF;
+	l = r->left;
+	/* The upper byte of a widened char doesn't matter if the mask
+	   doesn't cover it */
+	if (l->op == T_CAST && get_size(l->right->type) == 1 && v < 256)
+		l = l->right;
+	if (get_size(l->type) == 1) {
+		if (cpu_has_aim && (l->op == T_LREF ||
+			(l->op == T_LDEREF && l->val2 < 256))) {
+			off = make_local_ptr(l->value, l->op == T_LREF ? 255 : 254);
+			if (l->op == T_LDEREF) {
+				printf("\tldx %u,x\n", off);
+				invalidate_x();
+				off = l->val2;
+			}
+			printf("\ttim #%u,%u,x\n", v & 0xFF, off);
+		} else {
+			codegen_lr(l);
+			printf("\tbitb #%u\n", v & 0xFF);
+		}
+	} else if (!(v & 0xFF00)) {
+		codegen_lr(l);
+		printf("\tbitb #%u\n", v);
+	} else if (!(v & 0x00FF)) {
+		codegen_lr(l);
+		printf("\tbita #%u\n", v >> 8);
+	} else
+		return 0;
+	if (invert)
+		set_cc_branch(T_EQEQ, 0, 0);
+	return 1;
+}
+
 /* Generate inline code for ++ and -- operators when it makes sense */
 unsigned add_to_node(struct node *n, int sign, int retres)
 {
@@ -1100,6 +1294,10 @@ unsigned gen_shortcut(struct node *n)
 	/* Don't generate unreachable code */
 	if (unreachable)
 		return 1;
+	/* If only the condition of a bool matters then the 6809 can leave
+	   the result of a compare below it purely in the flags */
+	if (cpu_is_09 && n->op == T_BOOL && (n->flags & CCONLY) && r)
+		r->flags |= n->flags & (CCONLY | CCFIXED);
 	/* Handle operations that are of the form (OP (REG) (thing)) as we can't really
 	   talk about 'address' of a register variable for 6809 */
 	if (l && l->op == T_REG && cpu_is_09) {
@@ -1299,11 +1497,20 @@ unsigned gen_shortcut(struct node *n)
 			return 1;
 		return do_xeqop(n, "xshreq");
 	case T_ANDEQ:
+		if (s == 1 && nr && memop_bit(n))
+			return 1;
 		return do_xeqop(n, "xandeq");
 	case T_OREQ:
+		if (s == 1 && nr && memop_bit(n))
+			return 1;
 		return do_xeqop(n, "xoreq");
 	case T_HATEQ:
+		if (s == 1 && nr && memop_bit(n))
+			return 1;
 		return do_xeqop(n, "xhateq");
+	case T_BOOL:
+	case T_BANG:
+		return bit_test(n);
 #if 0
 	/* This won't work as is and requires a rethink	*/
 	/* Thankfully it's only the expression/expression case */
@@ -1328,12 +1535,19 @@ unsigned gen_shortcut(struct node *n)
 		return 1;
 #endif
 	case T_RSTORE:
+		if (n->value == REG_IDX)
+			invalidate_hi();
 		if (can_load_r_with(r, 0)) {
-			load_u_with(r, 0);
+			if (n->value == REG_IDX)
+				v = load_y_with(r, 0);
+			else
+				v = load_u_with(r, 0);
+			if (v)
+				printf("\tlea%c %d,%c\n", REGNAME(n), (int16_t)v, REGNAME(n));
 			return 1;
 		}
 		codegen_lr(r);
-		puts("\ttfr d,u");
+		printf("\ttfr d,%c\n", REGNAME(n));
 		return 1;
 	case T_REQ:
 		codegen_lr(r);
@@ -1342,10 +1556,10 @@ unsigned gen_shortcut(struct node *n)
 			printf("\tsty %u,u\n\tstd %u,u\n", n->val2, n->val2 + 2);
 			return 1;
 		case 2:
-			printf("\tstd %u,u\n", n->val2);
+			printf("\tstd %u,%c\n", n->val2, REGNAME(n));
 			return 1;
 		case 1:
-			printf("\tstb %u,u\n", n->val2);
+			printf("\tstb %u,%c\n", n->val2, REGNAME(n));
 			return 1;
 		}
 		break;
@@ -1410,24 +1624,23 @@ static unsigned gen_cast(struct node *n)
 
 		if (opt && rs == 1) {
 			puts("\tclra\n\tasrb\n\trolb\n\tsbca #0");
-			if(ls == 4)
+			if(ls == 4) {
 				puts("\tstaa @hireg\n\tstaa @hireg+1");
+				invalidate_hi();
+			}
 			return 1;
 		}
 		if (opt > 2 && ls == 4 && rs == 2) {
 			puts("\tpshb\n\tclrb\n\tasra\n\trola\n\tsbcb #0\n\tstab @hireg\n\tstab @hireg+1\n\tpulb");
+			invalidate_hi();
 			return 1;
 		}
 		return 0;
 	}
 	if (rs == 1)
 		load_a_const(0);
-	if (ls == 4) {
-		if (cpu_has_y)
-			puts("\tldy #0");
-		else
-			puts("\tclr @hireg\n\tclr @hireg+1");
-	}
+	if (ls == 4)
+		load_hi_const(0);
 	return 1;
 }
 
@@ -1464,7 +1677,8 @@ unsigned gen_node(struct node *n)
 		}
 		if (s == 4 && cpu_has_y) {
 			printf("\tldy %u,x\n\tldd %u,x\n", v, v + 2);
-			set_d_node(n);	/* TODO: review 32 bit cases */
+			invalidate_work();
+			invalidate_hi();
 			return 1;
 		}
 		load32(v);
@@ -1497,22 +1711,17 @@ unsigned gen_node(struct node *n)
 			load_d_const(v);
 			return 1;
 		}
-		/* size 4 varies */
+		/* size 4 varies. With Y we can use D to help load Y, without
+		   it we go via D to @hireg unless it already holds the value */
 		if (cpu_has_y) {
 			load_d_const(v);
-			if (cpu_is_09 && (n->value >> 16) == (v & 0xFFFF))
-				puts("\ttfr d,y");
-			else
-				/* TODO: tracking on Y ? */
-				printf("\tldy #%u\n", (unsigned)((n->value >> 16) & 0xFFFF));
+			load_hi_const(n->value >> 16);
 			return 1;
 		}
-		load_d_const(n->value >> 16);
-		if (cpu_has_d)
-			puts("\tstd @hireg");
-		else
-			puts("\tstaa @hireg\n\tstab @hireg+1");
-		load_d_const(n->value);
+		if (!hi_valid || hi_val != (uint16_t)(n->value >> 16))
+			load_d_const(n->value >> 16);
+		load_hi_const(n->value >> 16);
+		load_d_const(v);
 		return 1;
 	case T_LABEL:
 	case T_NAME:
@@ -1529,6 +1738,7 @@ unsigned gen_node(struct node *n)
 			op16y_on_node(n, "ld", 0);
 			op16d_on_node(n, "ld", "ld",  2);
 			invalidate_work();
+			set_dy_node(n);
 			return 1;
 		}
 		/* TODO: 6800/3 cases for dword */
@@ -1544,17 +1754,21 @@ unsigned gen_node(struct node *n)
 		if (s == 4 && cpu_has_y) {
 			op16y_on_node(n, "st", 0);
 			op16d_on_node(n, "st", "st", 2);
+			invalidate_mem();
+			set_dy_node(n);
 			return 1;
 		}
 		break;
 	case T_RREF:
 		if (d_holds_node(n))
 			return 1;
-		puts("\ttfr u,d");
+		printf("\ttfr %c,d\n", REGNAME(n));
 		set_d_node(n);
 		return 1;
 	case T_RSTORE:
-		puts("\ttfr d,u");
+		printf("\ttfr d,%c\n", REGNAME(n));
+		if (n->value == REG_IDX)
+			invalidate_hi();
 		set_d_node(n);
 		return 1;
 	case T_ARGUMENT:
@@ -1642,10 +1856,11 @@ unsigned gen_node(struct node *n)
 		if (s == 4)
 			printf("\tldy %u,u\n\tldd %u,u\n", n->val2, n->val2 + 2);
 		else if (s == 2)
-			printf("\tldd %u,u\n", n->val2);
+			printf("\tldd %u,%c\n", n->val2, REGNAME(n));
 		else
-			printf("\tldb %u,u\n", n->val2);
+			printf("\tldb %u,%c\n", n->val2, REGNAME(n));
 		invalidate_work();
+		invalidate_hi();
 		return 1;
 	case T_RDEREFPLUS:
 		if (s == 4)
@@ -1655,6 +1870,7 @@ unsigned gen_node(struct node *n)
 		else
 			puts("\tldb ,u+");
 		invalidate_work();
+		invalidate_hi();
 		return 1;
 	case T_LEQ:
 		/* We probably want some indirecting helpers later */
@@ -43,12 +43,15 @@
 #include "compiler.h"
 #include "backend.h"
 #include "backend-z80.h"
+#include "backend-byte.h"
 
 #define LWDIRECT 24	/* Number of __ldword1 __ldword2 etc forms for fastest access */
 
 
 const char ccnormal[] = "nzz ";
 const char ccinvert[] = "z nz";
+const char cccarry[] = "c nc";
+const char ccnocarry[] = "ncc ";
 
 /*
  *	State for the current function
@@ -70,10 +73,19 @@ static const char *regnames[] = {	/* Register variable names */
 	"iy"
 };
 
+static const char *xregnames[] = {	/* Alternate register variables */
+	"hl",
+	"de",
+	"bc"
+};
+
 void gen_tree(struct node *n)
 {
 	codegen_lr(n);
-	printf(";\n");
+	/* If we know what HL holds the next statement may want it so don't
+	   tell the optimizer it is dead */
+	if (!track_valid(R_HL))
+		printf(";\n");
 /*	printf(";SP=%u\n", sp); */
 }
 
@@ -103,9 +115,13 @@ unsigned generate_lref(register unsigned v, register unsigned size, unsigned to_
 		return 0;
 
 	/* Rabbit amd Z280 have LD HL,(SP + n) */
-	if (HAS_LDHLSP && v + sp <= 255 && !to_de) {
-		/* FIXME: We will load an extra byte for 16bit, so hopefully non MMIO TODO */
+	if (HAS_LDHLSP && v + sp <= 255) {
+		/* FIXME: We will load an extra byte for 8bit, so hopefully non MMIO TODO */
+		if (to_de)
+			printf("\tex de,hl\n");
 		printf("\tld hl,(sp+%u)\n", v + sp);
+		if (to_de)
+			printf("\tex de,hl\n");
 		return 1;
 	}
 	/* This has to be a local so if it is byte sized we will load the
@@ -116,6 +132,11 @@ unsigned generate_lref(register unsigned v, register unsigned size, unsigned to_
 	}
 	/* Frame pointers */
 	if (use_fp && v < 128 - size) {
+		/* eZ80 can load any pair, Rabbit just HL */
+		if (size == 2 && (IS_EZ80 || (IS_RABBIT && !to_de))) {
+			printf("\tld %s,(iy + %u)\n", rp, v);
+			return 1;
+		}
 		printf("\tld %c,(iy + %u)\n", rp[1], v);
 		if (size == 2)
 			printf("\tld %c,(iy + %u)\n", rp[0], v + 1);
@@ -134,17 +155,20 @@ unsigned generate_lref(register unsigned v, register unsigned size, unsigned to_
 			printf("\tex de,hl\n");
 		return 1;
 	}
-	/* Word load is long winded on Z80 */
+	/* Word load is long winded on Z80. We must keep HL intact when
+	   loading DE so work in HL and swap */
 	if (size == 2 && opt > 2) {
+		if (to_de)
+			printf("\tex de,hl\n");
 		printf("\tld hl,0x%x\n\tadd hl,sp\n", WORD(v));
 		if (IS_RABBIT)
-			printf("\tld hl,(hl + %u\n)\n", 0);
-		else if (IS_EZ80 && to_de)
-			printf("\tld de,(hl)\n");
-		else if (to_de)
-			printf("\tld e,(hl)\n\tinc hl\n\tld d,(hl)\n");
+			printf("\tld hl,(hl + 0)\n");
+		else if (IS_EZ80)
+			printf("\tld hl,(hl)\n");
 		else
 			printf("\tld a,(hl)\n\tinc hl\n\tld h,(hl)\n\tld l,a\n");
+		if (to_de)
+			printf("\tex de,hl\n");
 		return 1;
 	}
 	/* Via helper magic for compactness on Z80 */
@@ -193,6 +217,10 @@ unsigned generate_lref_a(register unsigned v)
 		printf("\tpop af\n\tpush af\n");
 		return 1;
 	}
+	if (HAS_LDASP && v <= 255) {
+		printf("\tld a,(sp+%u)\n", v);
+		return 1;
+	}
 	if (use_fp) {
 		printf("\tld a,(iy + %d)\n", v - sp);
 		return 1;
@@ -279,6 +307,10 @@ static unsigned load_r_with(register const char *rp, register struct node *n)
 		/* One oddity here - we can't load IX or IY from (ix) or (iy) */
 		if (*rp == 'i')
 			return 0;
+		if (IS_EZ80 || (IS_RABBIT && r == 'h')) {
+			printf("\tld %s,(%s + %u)\n", rp, regnames[n->value], n->val2);
+			return 1;
+		}
 		printf("\tld %c,(%s + %u)\n", rp[1], regnames[n->value], n->val2);
 		printf("\tld %c,(%s + %u)\n", *rp, regnames[n->value], n->val2 + 1);
 		return 1;
@@ -370,6 +402,74 @@ static void load_regvar(unsigned r, unsigned s)
 	printf("\tpush hl\n\tpop %s\n", regnames[r]);
 }
 
+/* The alternate registers can only be reached by swapping the whole set
+   so words go via the stack and bytes via A */
+static void get_xreg(unsigned reg, unsigned s)
+{
+	const char *rp = xregnames[reg - XREG_BASE];
+	if (s == 1)
+		printf("\texx\n\tld a,%c\n\texx\n\tld l,a\n", rp[1]);
+	else
+		printf("\texx\n\tpush %s\n\texx\n\tpop hl\n", rp);
+}
+
+static void put_xreg(unsigned reg, unsigned s)
+{
+	const char *rp = xregnames[reg - XREG_BASE];
+	if (s == 1)
+		printf("\tld a,l\n\texx\n\tld %c,a\n\texx\n", rp[1]);
+	else
+		printf("\tpush hl\n\texx\n\tpop %s\n\texx\n", rp);
+}
+
+/* Add a constant to an alternate register variable. The rest of the
+   alternate set may be in use so only A is free to help */
+static void xreg_add(unsigned reg, unsigned s, unsigned v)
+{
+	const char *rp = xregnames[reg - XREG_BASE];
+	const char *r = rp;
+	unsigned n = WORD(-v);
+	char buf[8];
+
+	/* Byte sized uses the low half */
+	if (s == 1) {
+		r = rp + 1;
+		v = BYTE(v);
+		n = BYTE(n);
+	}
+	printf("\texx\n");
+	if (v <= 4) {
+		sprintf(buf, "inc %s", r);
+		repeated_op(buf, v);
+	} else if (n <= 4) {
+		sprintf(buf, "dec %s", r);
+		repeated_op(buf, n);
+	} else {
+		printf("\tld a,%c\n\tadd a,0x%x\n\tld %c,a\n", rp[1], BYTE(v), rp[1]);
+		if (s == 2)
+			printf("\tld a,%c\n\tadc a,0x%x\n\tld %c,a\n", *rp, BYTE(v >> 8), *rp);
+	}
+	printf("\texx\n");
+}
+
+/* Get the low byte of HL into A unless it is known to be there already */
+static void load_a_l(void)
+{
+	if (!same_byte(R_HL)) {
+		printf("\tld a,l\n");
+		copy_track(R_A, R_HL);
+	}
+}
+
+/* HL, and A if asked, now hold the value just stored into n */
+static void track_store(struct node *n, unsigned a)
+{
+	invalidate_mem(n);
+	add_node(R_HL, n);
+	if (a)
+		add_node(R_A, n);
+}
+
 /* We use "DE" as a name but A as register for 8bit ops... probably ought to rework one day */
 static unsigned gen_deop(const char *op, register struct node *n,
 				register struct node *r, unsigned sign)
@@ -404,15 +504,56 @@ static unsigned gen_deop(const char *op, register struct node *n,
 	return 1;
 }
 
+/*
+ *	Signed compares against 0 or -1 only need the sign bit. a > -1 is
+ *	a >= 0 and a <= -1 is a < 0. The caller has checked CCONLY.
+ */
+static unsigned gen_cc_sign(register struct node *n, unsigned s, unsigned v)
+{
+	unsigned op = n->op;
+	char r = s == 1 ? 'l' : 'h';
+
+	if (s > 2 || (n->type & UNSIGNED) || PTR(n->type))
+		return 0;
+	if (v == (s == 1 ? 0xFF : 0xFFFF)) {
+		if (op == T_GT)
+			op = T_GTEQ;
+		else if (op == T_LTEQ)
+			op = T_LT;
+		else
+			return 0;
+	} else if (v != 0)
+		return 0;
+	if (op == T_LT) {
+		printf("\tbit 7,%c\n", r);
+		n->flags |= USECC;
+		return 1;
+	}
+	if (op != T_GTEQ)
+		return 0;
+	if (n->flags & CCFIXED)
+		printf("\tld a,%c\n\tcpl\n\tand 0x80\n", r);
+	else {
+		printf("\tbit 7,%c\n", r);
+		ccflags = ccinvert;
+	}
+	n->flags |= USECC;
+	return 1;
+}
+
 static unsigned gen_compc(const char *op, register struct node *n,
 			register struct node *r, unsigned sign)
 {
 	unsigned s = get_size(n->type);
+	unsigned v;
 	/* TODO: Z280 has CPW HL,DE CPW HL, const */
 	if (r->op == T_CONSTANT) {
+		v = s == 1 ? BYTE(r->value) : WORD(r->value);
+		if ((n->flags & CCONLY) && gen_cc_sign(n, s, v))
+			return 1;
 		/* Some minimal cases to work out how best to use CCONLY */
 		if (n->op == T_BANGEQ && (n->flags & CCONLY)) {
-			if (r->value == 0) {
+			if (v == 0) {
 				if (s == 1) {
 					printf("\txor a\n\tcp l\n");
 					n->flags |= USECC;
@@ -424,40 +565,58 @@ static unsigned gen_compc(const char *op, register struct node *n,
 					return 1;
 				}
 			}
-			if (s == 1 && r->value == 255) {
+			if (s == 1 && v == 255) {
 				printf("\tinc l\n");
 				n->flags |= USECC;
 				return 1;
 			}
-			if (s == 2 && r->value == 0xFFFF) {
+			if (s == 2 && v == 0xFFFF) {
 				printf("\tld a,h\n\tand l\n\tinc a\n");
 				n->flags |= USECC;
 				return 1;
 			}
-			if (s == 2 && r->value <= 0xFF) {
+			if (s == 2 && v <= 0xFF) {
 				/* The xor is a compare resulting in 0 if equal,
 				   and the or h then checks the high byte matches */
-				printf("\tld a,0x%x\n", (unsigned)r->value);
+				printf("\tld a,0x%x\n", v);
 				printf("\txor l\n");
 				printf("\tor h\n");
 				n->flags |= USECC;
 				return 1;
 			}
-			if (s == 2 && (r->value & 0xFF) == 0) {
-				printf("\tld a,0x%x\n", (unsigned)r->value >> 8);
+			if (s == 2 && (v & 0xFF) == 0) {
+				printf("\tld a,0x%x\n", v >> 8);
 				printf("\txor h\n");
 				printf("\tor l\n");
 				n->flags |= USECC;
 				return 1;
 			}
 			if (s == 1) {
-				printf("\tld a,0x%x\n", (unsigned)r->value & 0xFF);
+				printf("\tld a,0x%x\n", v & 0xFF);
 				printf("\tcp l\n");
+				n->flags |= USECC;
 				return 1;
 			}
 		}
+		/* The true sense is fixed as nz so turn zero into 0xFF */
+		if (n->op == T_EQEQ && (n->flags & (CCONLY|CCFIXED)) == (CCONLY|CCFIXED) &&
+			s <= 2 && (v == 0 || v == (s == 1 ? 0xFF : 0xFFFF))) {
+			printf("\tld a,%c\n", s == 1 ? 'l' : 'h');
+			if (v == 0) {
+				if (s == 2)
+					printf("\tor l\n");
+				printf("\tsub 0x1\n");
+			} else {
+				if (s == 2)
+					printf("\tand l\n");
+				printf("\tadd a,0x1\n");
+			}
+			printf("\tsbc a,a\n");
+			n->flags |= USECC;
+			return 1;
+		}
 		if (n->op == T_EQEQ && (n->flags & CCONLY) && !(n->flags & CCFIXED)) {
-			if (r->value == 0) {
+			if (v == 0) {
 				if (s == 1) {
 					printf("\txor a\n\tcp l\n");
 					ccflags = ccinvert;
@@ -471,30 +630,30 @@ static unsigned gen_compc(const char *op, register struct node *n,
 					return 1;
 				}
 			}
-			if (r->value == 255 && s == 1) {
+			if (v == 255 && s == 1) {
 				printf("\tinc l\n");
 				ccflags = ccinvert;
 				n->flags |= USECC;
 				return 1;
 			}
-			if (r->value == 0xFFFF && s == 2) {
+			if (v == 0xFFFF && s == 2) {
 				printf("\tld a,h\n\tand l\n\tinc a\n");
 				ccflags = ccinvert;
 				n->flags |= USECC;
 				return 1;
 			}
-			if (s == 2 && r->value <= 0xFF) {
+			if (s == 2 && v <= 0xFF) {
 				/* The xor is a compare resulting in 0 if equal,
 				   and the or h then checks the high byte matches */
-				printf("\tld a,0x%x\n", (unsigned)r->value);
+				printf("\tld a,0x%x\n", v);
 				printf("\txor l\n");
 				printf("\tor h\n");
 				ccflags = ccinvert;
 				n->flags |= USECC;
 				return 1;
 			}
-			if (s == 2 && (r->value & 0xFF) == 0) {
-				printf("\tld a,0x%x\n", (unsigned)r->value >> 8);
+			if (s == 2 && (v & 0xFF) == 0) {
+				printf("\tld a,0x%x\n", v >> 8);
 				printf("\txor h\n");
 				printf("\tor l\n");
 				ccflags = ccinvert;
@@ -503,7 +662,7 @@ static unsigned gen_compc(const char *op, register struct node *n,
 				return 1;
 			}
 			if (s == 1) {
-				printf("\tld a,0x%x\n", (unsigned)r->value & 0xFF);
+				printf("\tld a,0x%x\n", v & 0xFF);
 				printf("\tcp l\n");
 				ccflags = ccinvert;
 				n->flags |= USECC;
@@ -683,8 +842,8 @@ static unsigned gen_logicc(register struct node *n, unsigned s, const char *op,
 	register unsigned h = (v >> 8) & 0xFF;
 	register unsigned l = v & 0xFF;
 
-	/* Rabbit has 16bit logic operators */
-	if (s == 2 && IS_RABBIT) {
+	/* Rabbit has 16bit and/or */
+	if (s == 2 && IS_RABBIT && n && code != 3) {
 		if (load_de_with(n) == 0)
 			return 0;
 		printf("\t%s hl,de\n", op);
@@ -765,6 +924,13 @@ unsigned gen_direct(register struct node *n)
 	unsigned v;
 	unsigned nr = n->flags & NORETURN;
 
+	/* Only add and subtract know how to keep what is in DE */
+	if (n->op == T_PLUS || n->op == T_MINUS) {
+		invalidate(R_HL);
+		invalidate(R_A);
+	} else
+		invalidate_all();
+
 	/* We only deal with simple cases for now */
 	if (r) {
 		if (!access_direct(n->right))
@@ -774,7 +940,22 @@ unsigned gen_direct(register struct node *n)
 
 	switch (n->op) {
 	case T_CLEANUP:
-		gen_cleanup(v);
+		/* The called function removed the arguments */
+		if (n->left->flags & REGARG)
+			sp -= v - 2;
+		else
+			gen_cleanup(defer_cleanup(n, v, sp, defer_limit()));
+		return 1;
+	case T_CALLNAME:
+		/* The first argument stays in HL. Only the upper half of a long
+		   or float goes on the stack */
+		if (!(n->flags & REGARG))
+			return 0;
+		if (get_stack_size(n->left->type) == 4) {
+			printf("\tld de,(__hireg)\n\tpush de\n");
+			sp += 2;
+		}
+		printf("\tcall _%s+%u\n", namestr(n->snum), WORD(n->value));
 		return 1;
 	case T_NSTORE:
 		if (s > 2)
@@ -879,12 +1060,16 @@ unsigned gen_direct(register struct node *n)
 		if (s <= 2) {
 			/* LHS is in HL at the moment, end up with the result in HL */
 			if (s == 1) {
+				invalidate(R_DE);
 				if (load_a_with(r) == 0)
 					return 0;
 				printf("\tld e,a\n");
 			}
-			if (s > 2 || load_de_with(r) == 0)
-				return 0;
+			if (!holds_node(R_DE, r)) {
+				if (load_de_with(r) == 0)
+					return 0;
+				set_node(R_DE, r);
+			}
 			printf("\tadd hl,de\n");
 			return 1;
 		}
@@ -902,6 +1087,7 @@ unsigned gen_direct(register struct node *n)
 			}
 			printf("\tld de,0x%x\n", 65536 - v);
 			printf("\tadd hl,de\n");
+			invalidate(R_DE);
 			return 1;
 		}
 		/* Avoid loading BC into DE unnecessarily. No shortcut for IXY though */
@@ -910,8 +1096,11 @@ unsigned gen_direct(register struct node *n)
 			return 1;
 		}
 		/* TODO: Can we ex de,hl, load into hl and go? - check direction too */
-		if (load_de_with(r) == 0)
-			return 0;
+		if (!holds_node(R_DE, r)) {
+			if (load_de_with(r) == 0)
+				return 0;
+			set_node(R_DE, r);
+		}
 		printf("\tor a\n\tsbc hl,de\n");
 		return 1;
 	case T_STAR:
@@ -1024,6 +1213,8 @@ unsigned gen_direct(register struct node *n)
 			return 1;
 		}
 		return gen_deop("shrde", n, r, 1);
+	case T_BITAND:
+		return gen_deop("bitandde", n, r, 0);
 	/* Shorten post inc/dec if result not needed - in which case it's the same as
 	   pre inc/dec */
 	case T_PLUSPLUS:
@@ -1275,6 +1466,452 @@ static void reg_logic(register struct node *n, unsigned s, unsigned op, const ch
 	}
 }
 
+/*
+ *	8bit expressions. backend-byte.c marks the parts of the tree where
+ *	only the low byte of the result matters. Where that part is simple
+ *	enough we work it in A instead of widening it into HL and trimming it
+ *	back again. Only A and HL are used so a pointer can be held in DE.
+ */
+
+/* Casts within a byte tree don't change the low byte */
+static struct node *byte_strip(register struct node *n)
+{
+	while (n->op == T_CAST && (n->flags & BYTEOP))
+		n = n->right;
+	return n;
+}
+
+/* Something we can use directly as the argument of an 8bit ALU op */
+static unsigned byte_operand(register struct node *n)
+{
+	switch(n->op) {
+	case T_CONSTANT:
+	case T_NREF:
+	case T_LBREF:
+	case T_LREF:
+		return 1;
+	case T_RREF:
+		return n->value == 1;
+	case T_RDEREF:
+		return n->value != 1;
+	}
+	return 0;
+}
+
+static unsigned byte_swap_ok(unsigned op)
+{
+	return op == T_PLUS || op == T_AND || op == T_OR || op == T_HAT;
+}
+
+/* Can we compute the low byte of n into A */
+static unsigned can_byte_a(register struct node *n)
+{
+	register struct node *r;
+
+	n = byte_strip(n);
+	if (byte_operand(n))
+		return 1;
+	if (!(n->flags & BYTEOP))
+		return 0;
+	switch(n->op) {
+	case T_LTLT:
+		r = byte_strip(n->right);
+		if (r->op != T_CONSTANT || r->value > 7)
+			return 0;
+		break;
+	case T_PLUS:
+	case T_MINUS:
+	case T_AND:
+	case T_OR:
+	case T_HAT:
+		if (!byte_operand(byte_strip(n->right))) {
+			/* Both sides are work so the right goes via the stack */
+			if (!byte_swap_ok(n->op) || !byte_operand(byte_strip(n->left)))
+				return can_byte_a(n->right) && can_byte_a(n->left);
+			r = n->right;
+			n->right = n->left;
+			n->left = r;
+		}
+		break;
+	default:
+		return 0;
+	}
+	return can_byte_a(n->left);
+}
+
+/* A byte tree that is worth doing in A rather than a simple load */
+static unsigned is_byte_tree(register struct node *n)
+{
+	return !byte_operand(n) && can_byte_a(n);
+}
+
+/* Point HL at a stack byte unless it already is */
+static void byte_lref_hl(unsigned v)
+{
+	struct node m;
+
+	memset(&m, 0, sizeof(m));
+	m.op = T_LOCAL;
+	m.type = CCHAR + 1;
+	m.value = v;
+	if (holds_node(R_HL, &m))
+		return;
+	printf("\tld hl,0x%x\n\tadd hl,sp\n", WORD(v + sp));
+	set_node(R_HL, &m);
+}
+
+static void byte_load(register struct node *n)
+{
+	register unsigned v = WORD(n->value);
+
+	if (get_size(n->type) == 1 && holds_node(R_A, n))
+		return;
+	if (holds_node(R_HL, n)) {
+		load_a_l();
+		return;
+	}
+	switch(n->op) {
+	case T_CONSTANT:
+		printf("\tld a,0x%x\n", BYTE(v));
+		break;
+	case T_NREF:
+		printf("\tld a,(_%s+%u)\n", namestr(n->snum), v);
+		break;
+	case T_LBREF:
+		printf("\tld a,(T%u+%u)\n", n->val2, v);
+		break;
+	case T_LREF:
+		if (use_fp && v < 128)
+			printf("\tld a,(iy + %u)\n", v);
+		else if (HAS_LDASP && v + sp <= 255)
+			printf("\tld a,(sp+%u)\n", v + sp);
+		else {
+			byte_lref_hl(v);
+			printf("\tld a,(hl)\n");
+		}
+		break;
+	case T_RREF:
+		printf("\tld a,c\n");
+		break;
+	case T_RDEREF:
+		printf("\tld a,(%s + %u)\n", regnames[n->value], n->val2);
+		break;
+	}
+	invalidate(R_A);
+	if (get_size(n->type) == 1)
+		set_node(R_A, n);
+}
+
+/* Write "op n" where op is the instruction with any leading "a,". A NULL
+   node is a value we stacked and popped back into H */
+static void byte_op(const char *op, register struct node *n)
+{
+	register unsigned v;
+
+	if (n == NULL) {
+		printf("\t%sh\n", op);
+		invalidate(R_A);
+		return;
+	}
+	v = WORD(n->value);
+	switch(n->op) {
+	case T_CONSTANT:
+		printf("\t%s0x%x\n", op, BYTE(v));
+		break;
+	case T_NREF:
+		printf("\tld hl,_%s+%u\n\t%s(hl)\n", namestr(n->snum), v, op);
+		invalidate(R_HL);
+		break;
+	case T_LBREF:
+		printf("\tld hl,T%u+%u\n\t%s(hl)\n", n->val2, v, op);
+		invalidate(R_HL);
+		break;
+	case T_LREF:
+		if (use_fp && v < 128)
+			printf("\t%s(iy + %u)\n", op, v);
+		else {
+			byte_lref_hl(v);
+			printf("\t%s(hl)\n", op);
+		}
+		break;
+	case T_RREF:
+		printf("\t%sc\n", op);
+		break;
+	case T_RDEREF:
+		printf("\t%s(%s + %u)\n", op, regnames[n->value], n->val2);
+		break;
+	}
+	invalidate(R_A);
+}
+
+/* Generate a tree that passed can_byte_a into A */
+static void gen_byte_a(register struct node *n)
+{
+	register struct node *r;
+	unsigned v;
+
+	n = byte_strip(n);
+	if (byte_operand(n)) {
+		byte_load(n);
+		return;
+	}
+	r = byte_strip(n->right);
+	if (!byte_operand(r)) {
+		/* Work out the right, stack it and use it from H */
+		gen_byte_a(r);
+		printf("\tpush af\n");
+		sp += 2;
+		gen_byte_a(n->left);
+		printf("\tpop hl\n");
+		sp -= 2;
+		invalidate(R_HL);
+		r = NULL;
+	} else
+		gen_byte_a(n->left);
+	v = 0;
+	if (r && r->op == T_CONSTANT)
+		v = BYTE(r->value);
+	switch(n->op) {
+	case T_LTLT:
+		repeated_op("add a,a", v);
+		invalidate(R_A);
+		break;
+	case T_PLUS:
+		/* inc and dec don't set carry but nobody wants it */
+		if (v == 1)
+			printf("\tinc a\n");
+		else if (v == 0xFF)
+			printf("\tdec a\n");
+		else
+			byte_op("add a,", r);
+		invalidate(R_A);
+		break;
+	case T_MINUS:
+		if (v == 1) {
+			printf("\tdec a\n");
+			invalidate(R_A);
+		} else
+			byte_op("sub ", r);
+		break;
+	case T_AND:
+		byte_op("and ", r);
+		break;
+	case T_OR:
+		byte_op("or ", r);
+		break;
+	case T_HAT:
+		byte_op("xor ", r);
+		break;
+	}
+}
+
+/* Byte stores and narrowing casts of a tree we can do in A */
+static unsigned gen_byte_store(register struct node *n)
+{
+	register struct node *r = n->right;
+	unsigned nr = n->flags & NORETURN;
+	unsigned v = WORD(n->value);
+
+	switch(n->op) {
+	case T_CAST:
+		if (!(n->flags & BYTEROOT) || !is_byte_tree(r))
+			return 0;
+		gen_byte_a(r);
+		printf("\tld l,a\n");
+		copy_track(R_HL, R_A);
+		return 1;
+	case T_RSTORE:
+		if (v != 1)
+			return 0;
+	case T_NSTORE:
+	case T_LBSTORE:
+	case T_LSTORE:
+		if (!can_byte_a(r) || byte_operand(r))
+			return 0;
+		gen_byte_a(r);
+		break;
+	case T_EQ:
+		if (!can_byte_a(r) || byte_operand(r))
+			return 0;
+		codegen_lr(n->left);
+		printf("\tex de,hl\n");
+		invalidate(R_HL);
+		invalidate(R_DE);
+		gen_byte_a(r);
+		printf("\tld (de),a\n");
+		invalidate_all();
+		if (!nr)
+			printf("\tld l,a\n");
+		return 1;
+	default:
+		return 0;
+	}
+	switch(n->op) {
+	case T_RSTORE:
+		printf("\tld c,a\n");
+		break;
+	case T_NSTORE:
+		printf("\tld (_%s+%u),a\n", namestr(n->snum), v);
+		break;
+	case T_LBSTORE:
+		printf("\tld (T%u+%u),a\n", n->val2, v);
+		break;
+	case T_LSTORE:
+		if (use_fp && v < 128)
+			printf("\tld (iy + %u),a\n", v);
+		else if (HAS_LDASP && v + sp <= 255)
+			printf("\tld (sp+%u),a\n", v + sp);
+		else if (v + sp == 0) {
+			printf("\tpop hl\n\tld l,a\n\tpush hl\n");
+			invalidate(R_HL);
+		} else {
+			byte_lref_hl(v);
+			printf("\tld (hl),a\n");
+		}
+		break;
+	}
+	invalidate_mem(n);
+	add_node(R_A, n);
+	if (!nr) {
+		printf("\tld l,a\n");
+		copy_track(R_HL, R_A);
+	}
+	return 1;
+}
+
+/* The compare side of a byte compare. Either a constant in the range of
+   the type or a widening of a byte value with the same signedness */
+static struct node *byte_cmp_side(register struct node *n, unsigned *t)
+{
+	unsigned v;
+
+	if (n->op == T_CONSTANT) {
+		v = WORD(n->value);
+		if (v <= 0x7F || (*t == CCHAR && v >= 0xFF80) ||
+			(*t == UCHAR && v <= 0xFF))
+			return n;
+		return NULL;
+	}
+	if (n->op != T_CAST || get_size(n->right->type) != 1)
+		return NULL;
+	if (*t == 0xFF)
+		*t = n->right->type;
+	else if (*t != n->right->type)
+		return NULL;
+	return n->right;
+}
+
+/* Turn the flags from a byte compare into the condition for op. When
+   the direction is fixed we turn carry into nz with sbc a,a */
+static void byte_cmp_flags(unsigned op, unsigned fixed)
+{
+	switch(op) {
+	case T_EQEQ:
+		if (fixed) {
+			printf("\tsub 0x1\n\tsbc a,a\n");
+			return;
+		}
+		ccflags = ccinvert;
+		break;
+	case T_LT:
+		if (fixed) {
+			printf("\tsbc a,a\n");
+			return;
+		}
+		ccflags = cccarry;
+		break;
+	case T_GTEQ:
+		if (fixed) {
+			printf("\tccf\n\tsbc a,a\n");
+			return;
+		}
+		ccflags = ccnocarry;
+		break;
+	}
+}
+
+/* Compare the result of a tree in A with a constant or simple value. We
+   only have z and c conditions so signed ordering goes the long way */
+static unsigned gen_byte_cmp(register struct node *n)
+{
+	register struct node *l, *r, *t;
+	unsigned op = n->op;
+	unsigned type = 0xFF;
+	unsigned fixed = n->flags & CCFIXED;
+
+	if (!(n->flags & CCONLY))
+		return 0;
+	if (op == T_BYTEEQ || op == T_BYTENE) {
+		if (!can_byte_a(n->right))
+			return 0;
+		gen_byte_a(n->right);
+		/* For a fixed == we want a zero result to compare */
+		if (op == T_BYTEEQ && fixed) {
+			if (BYTE(n->value))
+				printf("\tsub 0x%x\n", BYTE(n->value));
+		} else if (BYTE(n->value) == 0)
+			printf("\tor a\n");
+		else
+			printf("\tcp 0x%x\n", BYTE(n->value));
+		if (op == T_BYTEEQ)
+			byte_cmp_flags(T_EQEQ, fixed);
+		n->flags |= USECC;
+		return 1;
+	}
+	if (op != T_EQEQ && op != T_BANGEQ && op != T_LT && op != T_GT &&
+		op != T_LTEQ && op != T_GTEQ)
+		return 0;
+	if (get_size(n->left->type) != 2)
+		return 0;
+	/* Work out the type first as constants depend on it */
+	if (n->left->op == T_CONSTANT) {
+		r = byte_cmp_side(n->right, &type);
+		l = byte_cmp_side(n->left, &type);
+	} else {
+		l = byte_cmp_side(n->left, &type);
+		r = l ? byte_cmp_side(n->right, &type) : NULL;
+	}
+	if (l == NULL || r == NULL || type == 0xFF)
+		return 0;
+	if (op != T_EQEQ && op != T_BANGEQ && type != UCHAR)
+		return 0;
+	/* a > b is b < a and a <= b is b >= a unless we can adjust a constant */
+	if ((op == T_GT || op == T_LTEQ) &&
+		(r->op != T_CONSTANT || WORD(r->value) >= 0xFF)) {
+		t = l;
+		l = r;
+		r = t;
+		op = (op == T_GT) ? T_LT : T_GTEQ;
+	}
+	if (!byte_operand(byte_strip(r))) {
+		if (op != T_EQEQ && op != T_BANGEQ)
+			return 0;
+		t = l;
+		l = r;
+		r = t;
+	}
+	r = byte_strip(r);
+	if (!byte_operand(r) || !can_byte_a(l))
+		return 0;
+	gen_byte_a(l);
+	if (op == T_GT || op == T_LTEQ) {
+		printf("\tcp 0x%x\n", BYTE(r->value + 1));
+		op = (op == T_GT) ? T_GTEQ : T_LT;
+	} else if (r->op == T_CONSTANT && BYTE(r->value) == 0) {
+		/* A fixed == turns a zero A into carry for itself */
+		if (op != T_LT && op != T_GTEQ && !(op == T_EQEQ && fixed))
+			printf("\tor a\n");
+		else if (op != T_EQEQ)
+			byte_op("cp ", r);
+	} else if (op == T_EQEQ && fixed)
+		byte_op("sub ", r);
+	else
+		byte_op("cp ", r);
+	byte_cmp_flags(op, fixed);
+	n->flags |= USECC;
+	return 1;
+}
+
 /* Operators where we can push CCONLY downwards */
 static unsigned is_ccdown(struct node *n)
 {
@@ -1297,6 +1934,9 @@ static unsigned is_cconly(struct node *n)
 		op == T_BYTENE || op == T_ANDAND || op == T_OROR ||
 		op == T_BOOL || op == T_BTST)
 		return 1;
+	/* Byte and sign bit compares use these, anything else ignores it */
+	if (op == T_LT || op == T_GT || op == T_LTEQ || op == T_GTEQ)
+		return 1;
 	if (op == T_BANG && !(n->flags & CCFIXED))
 		return 1;
 	return 0;
@@ -1365,11 +2005,39 @@ static void propogate_cconly(register struct node *n)
 	}
 }
 
+/* Write the address of a global or static reference plus an offset */
+static void print_ref(register struct node *n, unsigned off)
+{
+	if (n->op == T_NSTORE || n->op == T_NREF)
+		printf("_%s+%u", namestr(n->snum), WORD(n->value + off));
+	else
+		printf("T%u+%u", n->val2, WORD(n->value + off));
+}
+
+/* Store a long constant a word at a time through HL */
+static void gen_long_cstore(register struct node *n)
+{
+	unsigned lo = WORD(n->right->value);
+	unsigned hi = WORD(n->right->value >> 16);
+
+	printf("\tld hl,0x%x\n\tld (", hi);
+	print_ref(n, 2);
+	printf("),hl\n");
+	if (!(n->flags & NORETURN))
+		printf("\tld (__hireg),hl\n");
+	if (lo != hi)
+		printf("\tld hl,0x%x\n", lo);
+	printf("\tld (");
+	print_ref(n, 0);
+	printf("),hl\n");
+	invalidate_all();
+}
+
 /*
  *	Allow the code generator to short cut any subtrees it can directly
  *	generate. Also our point to do any private tree mods downwards
  */
-unsigned gen_shortcut(register struct node *n)
+static unsigned do_shortcut(register struct node *n)
 {
 	register unsigned s = get_size(n->type);
 	unsigned v;
@@ -1414,18 +2082,23 @@ unsigned gen_shortcut(register struct node *n)
 			/* Should never happen */
 			printf("\t;BOTCH %04X:%04X\n", r->op, r->flags);
 			printf("\tcall __cctobool\n");
+			invalidate_all();
 		}
 		/* If the result is bool do nothing */
 		if (r->flags & ISBOOL)
 			return 1;
 		s = get_size(r->type);
 		if (s <= 2 && (n->flags & CCONLY)) {
-			if (s == 2)
+			if (s == 2) {
 				printf("\tld a,h\n\tor l\n");
-			else
-				printf("\tld a,l\n\tor a\n");
+				invalidate(R_A);
+			} else {
+				load_a_l();
+				printf("\tor a\n");
+			}
 			return 1;
 		}
+		invalidate_all();
 		if (IS_RABBIT && s <= 2) {
 			/* quick way to bool byte */
 			if (s == 1)
@@ -1437,22 +2110,40 @@ unsigned gen_shortcut(register struct node *n)
 		n->flags |= ISBOOL;
 		return 1;
 	}
+	/* Byte sized work we can do entirely in A */
+	if ((opt || optsize) && s == 1 && gen_byte_store(n))
+		return 1;
+	if ((opt || optsize) && gen_byte_cmp(n))
+		return 1;
+	/* Long constant into a global or static */
+	if ((n->op == T_NSTORE || n->op == T_LBSTORE) && s == 4 &&
+		r->op == T_CONSTANT) {
+		gen_long_cstore(n);
+		return 1;
+	}
 	/* Re-order assignments we can do the simple way */
 	/* TODO: LBSTORE */
 	if (n->op == T_NSTORE && s <= 2) {
 		/* Handle const nr specially */
 		if (s == 1 && r->op == T_CONSTANT && (n->flags & NORETURN)) {
-			printf("\tld a,0x%x\n", (uint8_t)r->value);
-		} else {
-			codegen_lr(n->right);
-			if (s == 1)
-				printf("\tld a,l\n");
+			if (!holds_node(R_A, r)) {
+				printf("\tld a,0x%x\n", (uint8_t)r->value);
+				set_node(R_A, r);
+			}
+			printf("\tld (_%s+%u), a\n", namestr(n->snum), WORD(n->value));
+			invalidate_mem(n);
+			add_node(R_A, n);
+			return 1;
 		}
+		codegen_lr(n->right);
+		if (s == 1)
+			load_a_l();
 		/* Expression result is now in HL or A or both as needed */
 		if (s == 1)
 			printf("\tld (_%s+%u), a\n", namestr(n->snum), WORD(n->value));
 		else
 			printf("\tld (_%s+%u), hl\n", namestr(n->snum), WORD(n->value));
+		track_store(n, s == 1);
 		return 1;
 	}
 	/* Locals we can do on some later processors, Z80 is doable but messy - so not worth it */
@@ -1465,36 +2156,53 @@ unsigned gen_shortcut(register struct node *n)
 			if (s == 2)
 				printf("\tld (iy + %u), %d\n", v + 1,
 					((unsigned)r->value) >> 8);
+			invalidate_mem(n);
 			return 1;
 		}
 		/* Rabbit and Z280 */
 		if (HAS_LDHLSP && v + sp < 255 && s == 2) {
 			codegen_lr(n->right);
 			printf("\tld (sp + %u),hl\n", v + sp);
+			track_store(n, 0);
 			return 1;
 		}
 		if (use_fp && v <= 128 - s) {
 			codegen_lr(n->right);
-			printf("\tld (iy + %u), l\n", v);
-			if (s == 2)
-				printf("\tld (iy + %u), h\n", v + 1);
+			if (s == 2 && (IS_EZ80 || IS_RABBIT))
+				printf("\tld (iy + %u), hl\n", v);
+			else {
+				printf("\tld (iy + %u), l\n", v);
+				if (s == 2)
+					printf("\tld (iy + %u), h\n", v + 1);
+			}
+			track_store(n, 0);
 			return 1;
 		}
 		/* General case */
 		if (v + sp == 0 && s == 2) {
 			/* The one case Z80 is worth doing */
 			codegen_lr(n->right);
-			if (nr)
+			if (nr) {
 				printf("\tex (sp),hl\n");
-			else
+				invalidate_mem(n);
+				invalidate(R_HL);
+			} else {
 				printf("\tpop af\n\tpush hl\n");
+				invalidate(R_A);
+				track_store(n, 0);
+			}
 			return 1;
 		}
 	}
 	/* Shortcut any initialization of BC/IX/IY we can do directly */
 	if (n->op == T_RSTORE) {
-		if (s == 2 && nr)
-			return load_r_with(regnames[n->value], r);
+		if (s == 2 && nr && load_r_with(regnames[n->value], r)) {
+			/* Copying BC to itself goes via HL */
+			if (r->op == T_RREF)
+				invalidate(R_HL);
+			invalidate_mem(n);
+			return 1;
+		}
 		/* Can in theory do byte sized shortcuts but need a suitable
 		   helper adding for the few we can - notably c,(ix+n) */
 	}
@@ -1578,6 +2286,18 @@ unsigned gen_shortcut(register struct node *n)
 		}
 		/* TODO: we can also do >= 0 and < 0 (bit 7,b) */
 	}
+	/* The rewrite leaves only constant adds and subtracts for these */
+	if (l && l->op == T_REG && l->value >= XREG_BASE) {
+		v = r->value;
+		if (n->op == T_MINUSMINUS || n->op == T_MINUSEQ)
+			v = -v;
+		if (!nr && (n->op == T_PLUSPLUS || n->op == T_MINUSMINUS))
+			get_xreg(l->value, s);
+		xreg_add(l->value, s, v);
+		if (!nr && (n->op == T_PLUSEQ || n->op == T_MINUSEQ))
+			get_xreg(l->value, s);
+		return 1;
+	}
 	/* Register targetted ops. These are totally different to the normal EQ ops because
 	   we don't have an address we can push and then do a memory op */
 	if (l && l->op == T_REG) {
@@ -1782,6 +2502,25 @@ unsigned gen_shortcut(register struct node *n)
 	return 0;
 }
 
+unsigned gen_shortcut(register struct node *n)
+{
+	if (!do_shortcut(n))
+		return 0;
+	/* The loads and stores we understand track the registers themselves,
+	   anything else leaves them unknown */
+	switch(n->op) {
+	case T_COMMA:
+	case T_BOOL:
+	case T_NSTORE:
+	case T_LSTORE:
+	case T_RSTORE:
+		break;
+	default:
+		invalidate_all();
+	}
+	return 1;
+}
+
 /* Stack the node which is currently in the working register */
 unsigned gen_push(struct node *n)
 {
@@ -1795,8 +2534,10 @@ unsigned gen_push(struct node *n)
 	switch(size) {
 	case 2:
 		printf("\tpush hl\n;\n");
+		invalidate(R_HL);
 		return 1;
 	case 4:
+		invalidate_all();
 		if (optsize)
 			printf("\tcall __pushl\n;\n");
 		else
@@ -1834,6 +2575,27 @@ static unsigned gen_cast(register struct node *n)
 	return 1;
 }
 
+/* Nodes that keep track of what they leave in HL, DE and A */
+static unsigned track_op(unsigned op)
+{
+	switch(op) {
+	case T_NREF:
+	case T_LBREF:
+	case T_LREF:
+	case T_RREF:
+	case T_LBSTORE:
+	case T_LSTORE:
+	case T_RSTORE:
+	case T_LABEL:
+	case T_CONSTANT:
+	case T_NAME:
+	case T_ARGUMENT:
+	case T_LOCAL:
+		return 1;
+	}
+	return 0;
+}
+
 unsigned gen_node(register struct node *n)
 {
 	register unsigned size = get_size(n->type);
@@ -1855,29 +2617,50 @@ unsigned gen_node(register struct node *n)
 	if (n->left && n->op != T_ARGCOMMA && n->op != T_CALLNAME && n->op != T_FUNCCALL)
 		sp -= get_stack_size(n->left->type);
 
+	/* Only the simple loads and stores know what they leave in the
+	   registers */
+	if (size > 2 || !track_op(n->op))
+		invalidate_all();
+
 	switch (n->op) {
 		/* Load from a name */
 	case T_NREF:
+		if (holds_node(R_HL, n))
+			return 1;
 		name = namestr(n->snum);
-		if (size == 1)
-			printf("\tld a,(_%s+%u)\n\tld l,a\n", name, v);
-		else {
+		if (size == 1) {
+			if (!holds_node(R_A, n)) {
+				printf("\tld a,(_%s+%u)\n", name, v);
+				set_node(R_A, n);
+			}
+			printf("\tld l,a\n");
+			copy_track(R_HL, R_A);
+		} else {
 			if (size == 4) {
 				printf("\tld hl,(_%s+%u)\n"
 				       "\tld (__hireg),hl\n", name, v + 2);
 			}
 			printf("\tld hl,(_%s+%u)\n", name, v);
+			set_node(R_HL, n);
 		}
 		return 1;
 	case T_LBREF:
-		if (size == 1)
-			printf("\tld a,(T%u+%u)\n\tld l,a\n", n->val2, v);
-		else {
+		if (holds_node(R_HL, n))
+			return 1;
+		if (size == 1) {
+			if (!holds_node(R_A, n)) {
+				printf("\tld a,(T%u+%u)\n", n->val2, v);
+				set_node(R_A, n);
+			}
+			printf("\tld l,a\n");
+			copy_track(R_HL, R_A);
+		} else {
 			if (size == 4) {
-				printf("\tld hl, (T%u+%u)\n"
+				printf("\tld hl,(T%u+%u)\n"
 				       "\tld (__hireg),hl\n", n->val2, v + 2);
 			}
 			printf("\tld hl,(T%u+%u)\n", n->val2, v);
+			set_node(R_HL, n);
 		}
 		return 1;
 	case T_LREF:
@@ -1885,13 +2668,22 @@ unsigned gen_node(register struct node *n)
 		   so can go away */
 		if (nr)
 			return 1;
-		if (generate_lref(v, size, 0))
+		if (holds_node(R_HL, n))
 			return 1;
+		if (generate_lref(v, size, 0)) {
+			/* The helpers may use A and DE */
+			invalidate(R_A);
+			invalidate(R_DE);
+			set_node(R_HL, n);
+			return 1;
+		}
 		error("lrb");
 		return 0;
 	case T_RREF:
 		if (nr)
 			return 1;
+		if (holds_node(R_HL, n))
+			return 1;
 		if (n->value == 1) {
 			printf("\tld l,c\n");
 			if (size == 2)
@@ -1899,28 +2691,43 @@ unsigned gen_node(register struct node *n)
 		} else {
 			printf("\tpush %s\n\tpop hl\n", regnames[n->value]);
 		}
+		set_node(R_HL, n);
  		return 1;
 	case T_NSTORE:
 		name = namestr(n->snum);
 		if (size == 1) {
 			printf("\tld a,l\n"
-			       "\tld (_%s+%u),", name, v);
+			       "\tld (_%s+%u),a\n", name, v);
 			return 1;
 		}
-		printf("\tld (%s+%u), hl\n", name, v);
-		if (size == 4)
-			printf("\tld de,(__hireg)\nld (%s+%u),de\n",
-				name, v + 2);
+		printf("\tld (_%s+%u),hl\n", name, v);
+		if (size == 4) {
+			/* Keep HL if the result is wanted */
+			if (nr)
+				printf("\tld hl,(__hireg)\n\tld (_%s+%u),hl\n",
+					name, v + 2);
+			else
+				printf("\tld de,(__hireg)\n\tld (_%s+%u),de\n",
+					name, v + 2);
+		}
 		return 1;
 	case T_LBSTORE:
 		if (size == 1) {
-			printf("\tld a,l\n\tld (T%u+%u),a\n", n->val2, v);
+			load_a_l();
+			printf("\tld (T%u+%u),a\n", n->val2, v);
+			track_store(n, 1);
 			return 1;
 		}
 		printf("\tld (T%u+%u),hl\n", n->val2, v);
-		if (size == 4)
-			printf("\tld de,(__hireg)\n\tld (T%u+%u),de\n",
-				n->val2, v + 2);
+		if (size == 4) {
+			if (nr)
+				printf("\tld hl,(__hireg)\n\tld (T%u+%u),hl\n",
+					n->val2, v + 2);
+			else
+				printf("\tld de,(__hireg)\n\tld (T%u+%u),de\n",
+					n->val2, v + 2);
+		} else
+			track_store(n, 0);
 		return 1;
 	case T_LSTORE:
 /*		printf(";L sp %u spval %u %s(%ld)\n", sp, spval, namestr(n->snum), n->value); */
@@ -1928,29 +2735,38 @@ unsigned gen_node(register struct node *n)
 		if (HAS_LDHLSP && v <= 255) {
 			if (size == 2) {
 				printf("\tld (sp+%u),hl\n", v);
+				track_store(n, 0);
 				return 1;
 			}
 			if (HAS_LDASP && size == 1) {
-				printf("\tld a,l\n\tld (sp + %u),a d\n", v);
+				load_a_l();
+				printf("\tld (sp + %u),a\n", v);
+				track_store(n, 1);
 				return 1;
 			}
 		}
 		if (v == 0 && size == 2) {
-			if (nr)
-				printf("\tex (sp).hl\n");
-			else
+			if (nr) {
+				printf("\tex (sp),hl\n");
+				invalidate_mem(n);
+				invalidate(R_HL);
+			} else {
 				printf("\tpop af\n\tpush hl\n");
-			return 1;
-		}
-		/* Rabbit can LD HL,(HL + 0) so we can construct a load fairly ok */
-		if (IS_RABBIT && size == 2) {
-			printf("\tld hl,0x%x\n\tadd hl,sp\n\tld hl,(hl + 0)\n", v);
+				invalidate(R_A);
+				track_store(n, 0);
+			}
 			return 1;
 		}
 		if (size == 1 && (!optsize || v >= LWDIRECT)) {
-			printf("\tld a,l\n\tld hl,%u\n\tadd hl,sp\n\tld (hl),a\n", WORD(v));
-			if (!(n->flags & NORETURN))
+			load_a_l();
+			printf("\tld hl,%u\n\tadd hl,sp\n\tld (hl),a\n", WORD(v));
+			invalidate_mem(n);
+			add_node(R_A, n);
+			if (!(n->flags & NORETURN)) {
 				printf("\tld l,a\n");
+				copy_track(R_HL, R_A);
+			} else
+				invalidate(R_HL);
 			return 1;
 		}
 		/* For -O3 they asked for it so inline the lot */
@@ -1959,8 +2775,16 @@ unsigned gen_node(register struct node *n)
 			printf("\tex de,hl\n\tld hl,0x%x\n\tadd hl,sp\n"
 			        "\tld (hl),e\n\tinc hl\n\tld (hl),d\n"
 					, WORD(v));
-			if (!nr)
+			invalidate_mem(n);
+			if (!nr) {
 				printf("\tex de,hl\n");
+				invalidate(R_DE);
+				add_node(R_HL, n);
+			} else {
+				copy_track(R_DE, R_HL);
+				add_node(R_DE, n);
+				invalidate(R_HL);
+			}
 			return 1;
 		}
 		/* Via helper magic for compactness on Z80 */
@@ -1977,9 +2801,21 @@ unsigned gen_node(register struct node *n)
 			printf("\tcall __%s\n\t.byte %u\n", name, v + 2);
 		else
 			printf("\tcall __%sw\n\t.word %u\n", name, v + 2);
+		/* The helpers preserve HL only */
+		invalidate(R_A);
+		invalidate(R_DE);
+		track_store(n, 0);
 		return 1;
 	case T_RSTORE:
 		load_regvar(n->value, size);
+		track_store(n, 0);
+		return 1;
+	case T_XREF:
+		if (!nr)
+			get_xreg(n->value, size);
+		return 1;
+	case T_XSTORE:
+		put_xreg(n->value, size);
 		return 1;
 		/* Call a function by name */
 	case T_CALLNAME:
@@ -1992,7 +2828,7 @@ unsigned gen_node(register struct node *n)
 	case T_EQ:
 		if (size == 2) {
 			if (IS_EZ80)
-				printf("\tex de,hl\npop hl\nld (hl),de\n");
+				printf("\tex de,hl\n\tpop hl\n\tld (hl),de\n");
 			else
 				printf("\tex de,hl\n\tpop hl\n\tld (hl),e\n\tinc hl\n\tld (hl),d\n");
 			if (!nr)
@@ -2020,6 +2856,10 @@ unsigned gen_node(register struct node *n)
 				printf("\tld l,(ix + %u)\n", n->val2 + 2);
 				printf("\tld (__hireg),hl\n");
 			}
+			if (size > 1 && (IS_EZ80 || IS_RABBIT)) {
+				printf("\tld hl,(ix + %u)\n", n->val2);
+				return 1;
+			}
 			if (size > 1)
 				printf("\tld h,(ix + %u)\n", n->val2 + 1);
 			printf("\tld l,(ix + %u)\n", n->val2);
@@ -2030,6 +2870,10 @@ unsigned gen_node(register struct node *n)
 				printf("\tld l,(iy + %u)\n", n->val2 + 2);
 				printf("\tld (__hireg),hl\n");
 			}
+			if (size > 1 && (IS_EZ80 || IS_RABBIT)) {
+				printf("\tld hl,(iy + %u)\n", n->val2);
+				return 1;
+			}
 			if (size > 1)
 				printf("\tld h,(iy + %u)\n", n->val2 + 1);
 			printf("\tld l,(iy + %u)\n", n->val2);
@@ -2038,11 +2882,13 @@ unsigned gen_node(register struct node *n)
 		return 0;
 	case T_DEREF:
 		if (size == 4 && IS_EZ80) {
-			printf("\tld de,(hl)\n\tinc hl\n\tinc hl\n\tld hl,(hl)\n\tld (_hireg),hl\n\tex de.hl\n");
+			printf("\tld de,(hl)\n\tinc hl\n\tinc hl\n\tld hl,(hl)\n\tld (__hireg),hl\n\tex de,hl\n");
 			return 1;
 		}
 		if (size == 2) {
-			if (HAS_LDHLHL)
+			if (IS_RABBIT)
+				printf("\tld hl,(hl + 0)\n");
+			else if (HAS_LDHLHL)
 				printf("\tld hl,(hl)\n");
 			else
 				printf("\tld e,(hl)\n\tinc hl\n\tld d,(hl)\n\tex de,hl\n");
@@ -2054,38 +2900,58 @@ unsigned gen_node(register struct node *n)
 		}
 		break;
 	case T_FUNCCALL:
+		/* The first argument was stacked before we worked out the
+		   function pointer so bring it back into HL */
+		if (n->flags & REGARG) {
+			printf("\tpop de\n\tex de,hl\n\tcall __callde\n");
+			sp -= 2;
+			return 1;
+		}
 		/* Banking has no other effect as indirectly referenced calls go via the stub
 		   table so the function has a valid 16bit "address". callhl must live in common */
 		printf("\tcall __callhl\n");
 		return 1;
 	case T_LABEL:
 		/* Used for const strings and local static */
+		if (holds_node(R_HL, n))
+			return 1;
 		printf("\tld hl,T%u+%u\n", n->val2, v);
+		set_node(R_HL, n);
 		return 1;
 	case T_CONSTANT:
+		if (holds_node(R_HL, n))
+			return 1;
 		switch(size) {
 		case 4:
 			printf("\tld hl,0x%x\n", ((v >> 16) & 0xFFFF));
 			printf("\tld (__hireg),hl\n");
 		case 2:
 			printf("\tld hl,0x%x\n", (v & 0xFFFF));
+			set_node(R_HL, n);
 			return 1;
 		case 1:
 			printf("\tld l,0x%x\n", (v & 0xFF));
+			set_node(R_HL, n);
 			return 1;
 		}
 		break;
 	case T_NAME:
+		if (holds_node(R_HL, n))
+			return 1;
 		printf("\tld hl,");
 		printf("_%s+%u\n", namestr(n->snum), v);
+		set_node(R_HL, n);
 		return 1;
 	case T_ARGUMENT:
-		v += frame_len + argbase;
-		/* Fall through */
 	case T_LOCAL:
+		if (holds_node(R_HL, n))
+			return 1;
+		if (n->op == T_ARGUMENT)
+			v += frame_len + argbase;
 		v += sp;
 		printf("\tld hl,0x%x\n", v);
 		printf("\tadd hl,sp\n");
+		set_node(R_HL, n);
 		return 1;
 	case T_REG:
 		if (nr)
@@ -2132,11 +2998,14 @@ unsigned gen_node(register struct node *n)
 		/* Already CC format */
 		if (r->flags & USECC) {
 			if (!(n->flags & CCFIXED)) {
-				/* Will need work when we add > >= and friends TODO */
 				if (ccflags == ccinvert)
 					ccflags = ccnormal;
 				else if (ccflags == ccnormal)
 					ccflags = ccinvert;
+				else if (ccflags == cccarry)
+					ccflags = ccnocarry;
+				else if (ccflags == ccnocarry)
+					ccflags = cccarry;
 				else
 					error("ccf");
 				n->flags |= USECC;
@@ -2161,6 +3030,12 @@ unsigned gen_node(register struct node *n)
 			return 1;
 		}
 		return 0;
+	case T_ONESHL:
+		helper(n, "oneshl");
+		return 1;
+	case T_BITAND:
+		helper(n, "bitand");
+		return 1;
 	case T_BTST:
 		/* Always CCONLY */
 		if (v < 8)
@@ -17,12 +17,20 @@ unsigned cpu_has_pshx;		/* Has PSHX PULX */
 unsigned cpu_has_y;		/* Has Y register */
 unsigned cpu_has_lea;		/* Has LEA. For now 6809 but if we get to HC12... */
 unsigned cpu_is_09;		/* Bulding for 6x09 so a bit different */
+unsigned cpu_has_aim;		/* 6303 AIM/OIM/EIM/TIM on memory */
+unsigned cpu_has_bset;		/* 68HC11 BSET/BCLR on memory */
 unsigned cpu_pic;		/* Position independent output (6809 only) */
 
 const char *jmp_op = "jmp";
 const char *jsr_op = "jsr";
 const char *pic_op = "";
 
+/* Conditions for the next gen_jtrue/gen_jfalse. Normally these test the
+   Z flag left by a boolean, but a compare can leave its result purely in
+   the flags (6809 only) */
+static const char *cc_true = "ne";
+static const char *cc_false = "eq";
+
 /*
  *	State for the current function
  */
@@ -68,21 +76,57 @@ void gen_prologue(const char *name)
 void gen_frame(unsigned size, unsigned aframe)
 {
 	argbase = ARGBASE;
+	frame_len = size;
 	/* Only occurs on 6809 */
 	if (func_flags & F_REG(1)) {
-		puts("\tpshs u");
 		argbase += 2;
+		/* Push scratch registers along with U to make small frames
+		   for free. The values pushed don't matter */
+		switch(size) {
+		case 2:
+			puts("\tpshs x,u");
+			return;
+		case 4:
+			puts("\tpshs x,y,u");
+			return;
+		case 6:
+			puts("\tpshs d,x,y,u");
+			return;
+		}
+		puts("\tpshs u");
 	}
-	/* TODO: there is an optimization trick here for 09 where you
-	   can use a pshs combining the pshs u to make some size of frame */
-	frame_len = size;
 	adjust_s(-size, 0);
 }
 
+/* On the 6809 the final puls can also drop a small frame. X is never
+   part of the return value, D only for non void functions */
+static const char *puls_frame(unsigned size)
+{
+	if (!cpu_is_09)
+		return NULL;
+	if (size == 2)
+		return "x,";
+	if (!(func_flags & F_VOIDRET))
+		return NULL;
+	if (size == 4)
+		return "d,x,";
+	if (size == 6)
+		return "d,x,y,";
+	return NULL;
+}
+
 void gen_epilogue(unsigned size, unsigned argsize)
 {
+	const char *r;
+
 	if (sp)
 		error("sp");
+	r = puls_frame(size);
+	if (r) {
+		printf("\tpuls %s%spc\n", r, (func_flags & F_REG(1)) ? "u," : "");
+		unreachable = 1;
+		return;
+	}
 	adjust_s(size, (func_flags & F_VOIDRET) ? 0 : 1);
 	if (func_flags & F_REG(1))
 		/* 6809 only */
@@ -121,20 +165,67 @@ void gen_jump(const char *tail, unsigned n)
 	unreachable = 1;
 }
 
-void gen_jfalse(const char *tail, unsigned n)
+/* The last compare left the result of op in the flags. If flip is set
+   the operands were compared the other way around */
+void set_cc_branch(unsigned op, unsigned uns, unsigned flip)
+{
+	static const char *cc_signed[] = {
+		"lt", "ge", "gt", "le", "le", "gt", "ge", "lt"
+	};
+	static const char *cc_unsigned[] = {
+		"lo", "hs", "hi", "ls", "ls", "hi", "hs", "lo"
+	};
+	const char **cc = uns ? cc_unsigned : cc_signed;
+	unsigned i;
+
+	switch(op) {
+	case T_EQEQ:
+		cc_true = "eq";
+		cc_false = "ne";
+		return;
+	case T_BANGEQ:
+		return;
+	case T_LT:
+		i = 0;
+		break;
+	case T_GT:
+		i = 2;
+		break;
+	case T_LTEQ:
+		i = 4;
+		break;
+	case T_GTEQ:
+		i = 6;
+		break;
+	default:
+		error("ccb");
+		return;
+	}
+	/* Swapping the operands turns lt into gt and le into ge */
+	if (flip)
+		i ^= 2;
+	cc_true = cc[i];
+	cc_false = cc[i + 1];
+}
+
+static void gen_cc_jump(const char *cc, const char *tail, unsigned n)
 {
 	if (cpu_is_09)
-		printf("\tbeq L%d%s\n", n, tail);
+		printf("\tb%s L%d%s\n", cc, n, tail);
 	else
-		printf("\tjeq L%d%s\n", n, tail);
+		printf("\tj%s L%d%s\n", cc, n, tail);
+	cc_true = "ne";
+	cc_false = "eq";
+}
+
+void gen_jfalse(const char *tail, unsigned n)
+{
+	gen_cc_jump(cc_false, tail, n);
 }
 
 void gen_jtrue(const char *tail, unsigned n)
 {
-	if (cpu_is_09)
-		printf("\tbne L%d%s\n", n, tail);
-	else
-		printf("\tjne L%d%s\n", n, tail);
+	gen_cc_jump(cc_true, tail, n);
 }
 
 void gen_switch(unsigned n, unsigned type)
@@ -268,6 +359,28 @@ void gen_value(unsigned type, unsigned long value)
 	}
 }
 
+/* Y can hold a pointer for the expression unless it is needed for the
+   upper half of a long, or by a call or helper that uses it */
+static unsigned index_y(struct node *n)
+{
+	register unsigned t;
+
+	if (n == NULL)
+		return REG_IDX;
+	t = n->type;
+	if (!PTR(t) && t != CCHAR && t != UCHAR && t != CSHORT && t != USHORT)
+		return 0;
+	switch(n->op) {
+	case T_FUNCCALL:
+	case T_SLASH:
+	case T_PERCENT:
+		return 0;
+	}
+	if (index_y(n->left) && index_y(n->right))
+		return REG_IDX;
+	return 0;
+}
+
 void gen_start(void)
 {
 	switch(cpu) {
@@ -284,6 +397,8 @@ void gen_start(void)
 		jmp_op = "bra";	/* Maybe a choice will be needed for jmp v bra/lbra ? */
 		jsr_op = "lbsr";
 		pic_op = ",pcr";
+		gen_index_reg = index_y;
+		index_max_off = 255;
 		break;
 	case 6811:
 		cpu_has_y = 1;
@@ -297,6 +412,9 @@ void gen_start(void)
 	case 6800:
 		break;
 	}
+	/* The two extended parts have different bit operations on memory */
+	cpu_has_aim = (cpu == 6303);
+	cpu_has_bset = (cpu == 6811);
 	/* For the moment. Needs adding to assembler for 6809 v 6309 */
 	if (cpu != 6809 && cpu != 6811)
 		printf("\t.setcpu %u\n", cpu);
@@ -43,6 +43,14 @@ void gen_prologue(const char *name)
 {
 	printf("_%s:\n", name);
 	unreachable = 0;
+	invalidate_all();
+}
+
+/* With the register calling convention a function that takes a fixed
+   set of arguments gets the first in HL and removes them on return */
+static unsigned callee_cleanup(unsigned argsize)
+{
+	return REGCALL && argsize && !(func_flags & F_VARARG);
 }
 
 /* Generate the stack frame */
@@ -52,18 +60,43 @@ void gen_frame(unsigned size,  unsigned aframe)
 	frame_len = size;
 	sp = 0;
 	use_fp = 0;
+	invalidate_all();
 
-	if (size || (func_flags & (F_REG(1)|F_REG(2)|F_REG(3))))
+	if (size || (func_flags & (F_REG(1)|F_REG(2)|F_REG(3)|F_XREGS)))
 		func_cleanup = 1;
 	else
 		func_cleanup = 0;
 
+	/* Put the first argument back under the return address so that the
+	   arguments are where they normally are */
+	if (callee_cleanup(aframe)) {
+		printf("\tex (sp),hl\n\tpush hl\n");
+		func_cleanup = 1;
+	}
+
 	argbase = ARGBASE;
 
 	/* In banked mode the arguments are two bytes further out */
 	if (cpufeat & 1)
 		argbase += 2;
 
+	/* The alternate register variables are saved as a set */
+	if (func_flags & F_XREGS) {
+		printf("\texx\n");
+		if (func_flags & F_REG(4)) {
+			printf("\tpush hl\n");
+			argbase += 2;
+		}
+		if (func_flags & F_REG(5)) {
+			printf("\tpush de\n");
+			argbase += 2;
+		}
+		if (func_flags & F_REG(6)) {
+			printf("\tpush bc\n");
+			argbase += 2;
+		}
+		printf("\texx\n");
+	}
 	if (func_flags & F_REG(1)) {
 		printf("\tpush bc\n");
 		argbase += 2;
@@ -76,8 +109,10 @@ void gen_frame(unsigned size,  unsigned aframe)
 		printf("\tpush iy\n");
 		argbase += 2;
 	} else {
-		/* IY is free use it as a frame pointer ? */
-		if (!optsize && size > 4) {
+		/* IY is free use it as a frame pointer ? On the eZ80 word
+		   loads and stores via IY make it a win even when optimizing
+		   for size */
+		if ((!optsize || IS_EZ80) && size > 4) {
 			argbase += 2;
 			printf("\tpush iy\n");
 			/* Remember we need to restore IY */
@@ -92,6 +127,10 @@ void gen_frame(unsigned size,  unsigned aframe)
 		printf("\tld sp,iy\n");
 		return;
 	}
+	if (HAS_ADDSP && size > 2 && size <= 128) {
+		printf("\tadd sp,%d\n", -(int)size);
+		return;
+	}
 	if (size > 10) {
 		printf("\tld hl,0x%x\n", (uint16_t) -size);
 		printf("\tadd hl,sp\n");
@@ -108,6 +147,42 @@ void gen_frame(unsigned size,  unsigned aframe)
 	}
 }
 
+/* Return to the caller removing the arguments if they are ours to
+   clean up. HL and __hireg hold the result unless we are void */
+static void gen_return(register unsigned argsize)
+{
+	if (!callee_cleanup(argsize)) {
+		printf("\tret\n");
+		return;
+	}
+	/* A char argument last in the list still occupies a whole word */
+	argsize = (argsize + 1) & ~1;
+	if (func_flags & F_VOIDRET) {
+		printf("\tpop hl\n");
+		if (HAS_ADDSP && argsize <= 127)
+			printf("\tadd sp,%u\n", argsize);
+		else if (argsize > 10)
+			printf("\tex de,hl\n\tld hl,0x%x\n\tadd hl,sp\n\tld sp,hl\n\tex de,hl\n", argsize);
+		else while (argsize) {
+			printf("\tpop de\n");
+			argsize -= 2;
+		}
+		printf("\tjp (hl)\n");
+		return;
+	}
+	if (HAS_ADDSP && argsize <= 127)
+		printf("\tpop de\n\tadd sp,%u\n\tpush de\n\tret\n", argsize);
+	else if (argsize <= 6) {
+		printf("\tpop de\n");
+		while (argsize) {
+			printf("\tpop af\n");
+			argsize -= 2;
+		}
+		printf("\tpush de\n\tret\n");
+	} else
+		printf("\tld de,0x%x\n\tjp __cleanup\n", argsize);
+}
+
 void gen_epilogue(register unsigned size, unsigned argsize)
 {
 	if (sp != 0)
@@ -122,7 +197,9 @@ void gen_epilogue(register unsigned size, unsigned argsize)
 	if (unreachable)
 		return;
 
-	if (size > 10) {
+	if (HAS_ADDSP && size > 2 && size <= 127)
+		printf("\tadd sp,%u\n", size);
+	else if (size > 10) {
 		unsigned x = func_flags & F_VOIDRET;
 		if (!x)
 			printf("\tex de,hl\n");
@@ -147,13 +224,24 @@ void gen_epilogue(register unsigned size, unsigned argsize)
 		printf("\tpop ix\n");
 	if (func_flags & F_REG(1))
 		printf("\tpop bc\n");
-	printf("\tret\n");
+	if (func_flags & F_XREGS) {
+		printf("\texx\n");
+		if (func_flags & F_REG(6))
+			printf("\tpop bc\n");
+		if (func_flags & F_REG(5))
+			printf("\tpop de\n");
+		if (func_flags & F_REG(4))
+			printf("\tpop hl\n");
+		printf("\texx\n");
+	}
+	gen_return(argsize);
 	unreachable = 1;
 }
 
 void gen_label(const char *tail, unsigned n)
 {
 	unreachable = 0;
+	invalidate_all();
 	printf("L%u%s:\n", n, tail);
 }
 
@@ -193,7 +281,9 @@ void gen_cleanup(register unsigned v)
 {
 	/* CLEANUP is special and needs to be handled directly */
 	sp -= v;
-	if (v > 10) {
+	if (HAS_ADDSP && v > 2 && v <= 127)
+		printf("\tadd sp,%u\n", v);
+	else if (v > 10) {
 		/* This is more expensive, but we don't often pass that many
 		   arguments so it seems a win to stay in HL */
 		/* TODO: spot void function and skip ex de,hl */
@@ -238,6 +328,7 @@ void gen_helpcall(struct node *n)
 	   C call format */
 	if (c_style(n))
 		gen_push(n->right);
+	invalidate_all();
 	printf("\tcall __");
 }
 
@@ -283,6 +374,7 @@ void gen_switchdata(unsigned n, unsigned size)
 void gen_case_label(unsigned tag, unsigned entry)
 {
 	unreachable = 0;
+	invalidate_all();
 	printf("Sw%u_%u:\n", tag, entry);
 }
 
@@ -348,10 +440,43 @@ void gen_value(unsigned type, unsigned long value)
 	}
 }
 
+/* How deep we let the stack get before we stop deferring argument
+   cleanup. Locals and arguments have to stay within reach of the byte
+   offset helpers with room left for the calls that follow */
+#define DEFER_MAX	128
+
+unsigned defer_limit(void)
+{
+	unsigned n = frame_len + argbase;
+	if (n >= DEFER_MAX)
+		return 0;
+	return DEFER_MAX - n;
+}
+
+/* Remove the argument space we left on the stack. Between statements
+   HL is dead so we can skip the work gen_cleanup does to keep it */
+static void flush_cleanup(unsigned v, unsigned exiting)
+{
+	if ((exiting && !(func_flags & F_VOIDRET)) || v <= 10 ||
+		(HAS_ADDSP && v <= 127))
+		gen_cleanup(v);
+	else {
+		sp -= v;
+		printf("\tld hl,0x%x\n", v);
+		printf("\tadd hl,sp\n");
+		printf("\tld sp,hl\n");
+		invalidate(R_HL);
+	}
+	invalidate(R_DE);
+}
+
 void gen_start(void)
 {
-	/* For now.. */
+	gen_flush_cleanup = flush_cleanup;
 	printf("\t.z80\n");
+	/* Tell the assembler about the extended instruction sets */
+	if (IS_EZ80 || IS_RABBIT || IS_Z280)
+		printf("\t.setcpu %u\n", cpu);
 }
 
 void gen_end(void)
@@ -5,6 +5,7 @@
 #include "compiler.h"
 #include "backend.h"
 #include "backend-z80.h"
+#include "backend-byte.h"
 
 /* Check if a single bit is set or clear */
 
@@ -125,6 +126,7 @@ static unsigned is_simple(struct node *n)
  */
 struct node *gen_rewrite(struct node *n)
 {
+	byte_label_tree(n, 0);
 	return n;
 }
 
@@ -139,12 +141,81 @@ static int type_compatible(struct node *n, unsigned t)
 		return 0;
 	return 1;			/* IX and IY can do all sizes */
 }
+/*
+ *	Long globals and statics become direct references when optimizing
+ *	for speed. Storing a constant is smaller inline as well so we do
+ *	that whenever we optimize.
+ */
+static unsigned long_direct(unsigned op, struct node *r, unsigned nt)
+{
+	if (nt != CLONG && nt != ULONG)
+		return 0;
+	if (opt > 1 && !optsize)
+		return 1;
+	return op == T_EQ && r->op == T_CONSTANT && (opt || optsize);
+}
+
 /*
  *	Our chance to do tree rewriting. We don't do much for the Z80
  *	at this point, but we do rewrite name references and function calls
  *	to make them easier to process. We also rewrite dereferences with
  *	offsets so we can use ix and iy nicely.
  */
+/* The operation an assignment operator performs */
+static unsigned assign_op(unsigned op)
+{
+	switch(op) {
+	case T_PLUSEQ:
+		return T_PLUS;
+	case T_MINUSEQ:
+		return T_MINUS;
+	case T_STAREQ:
+		return T_STAR;
+	case T_SLASHEQ:
+		return T_SLASH;
+	case T_PERCENTEQ:
+		return T_PERCENT;
+	case T_ANDEQ:
+		return T_AND;
+	case T_OREQ:
+		return T_OR;
+	case T_HATEQ:
+		return T_HAT;
+	case T_SHLEQ:
+		return T_LTLT;
+	case T_SHREQ:
+		return T_GTGT;
+	}
+	return 0;
+}
+
+/*
+ *	We can't get at an alternate register without swapping the whole
+ *	set so there is nowhere to do the work in place. The code generator
+ *	handles adding and subtracting constants. Turn anything else into a
+ *	load, the operation and a store.
+ */
+static struct node *rewrite_xreg_op(register struct node *n)
+{
+	register struct node *l = n->left;
+	struct node *m;
+	unsigned op = assign_op(n->op);
+
+	if (op == 0 || ((op == T_PLUS || op == T_MINUS) && n->right->op == T_CONSTANT))
+		return n;
+	m = new_node();
+	m->op = T_XSTORE;
+	m->type = n->type;
+	m->value = l->value;
+	m->flags = n->flags;
+	m->right = n;
+	n->op = op;
+	n->flags = 0;
+	l->op = T_XREF;
+	l->type = n->type;
+	return m;
+}
+
 struct node *gen_rewrite_node(register struct node *n)
 {
 	register struct node *r = n->right;
@@ -254,6 +325,18 @@ struct node *gen_rewrite_node(register struct node *n)
 		free_node(n);
 		return l;
 	}
+	/* Register variables in the alternate registers */
+	if (op == T_DEREF && r->op == T_REG && r->value >= XREG_BASE) {
+		squash_right(n, T_XREF);
+		return n;
+	}
+	if (l && l->op == T_REG && l->value >= XREG_BASE) {
+		if (op == T_EQ) {
+			squash_left(n, T_XSTORE);
+			return n;
+		}
+		return rewrite_xreg_op(n);
+	}
 	/* Rewrite references into a load operation */
 	if (nt == CCHAR || nt == UCHAR || nt == CSHORT || nt == USHORT || PTR(nt)) {
 		if (op == T_DEREF) {
@@ -302,6 +385,24 @@ struct node *gen_rewrite_node(register struct node *n)
 			}
 		}
 	}
+	if (long_direct(op, r, nt)) {
+		if (op == T_DEREF && r->op == T_NAME) {
+			squash_right(n, T_NREF);
+			return n;
+		}
+		if (op == T_DEREF && r->op == T_LABEL) {
+			squash_right(n, T_LBREF);
+			return n;
+		}
+		if (op == T_EQ && l->op == T_NAME) {
+			squash_left(n, T_NSTORE);
+			return n;
+		}
+		if (op == T_EQ && l->op == T_LABEL) {
+			squash_left(n, T_LBSTORE);
+			return n;
+		}
+	}
 	/* Eliminate casts for sign, pointer conversion or same */
 	if (op == T_CAST) {
 		if (nt == r->type || (nt ^ r->type) == UNSIGNED ||
@@ -319,6 +420,33 @@ struct node *gen_rewrite_node(register struct node *n)
 		free_node(r);
 		n->right = NULL;
 	}
+	/* A prototyped call with arguments passes the first one in HL when
+	   using the register calling convention. Varargs use the stack */
+	if (op == T_CLEANUP && REGCALL && n->val2 == 0 && r->value)
+		l->flags |= REGARG;
+	/* 1 << n is a table lookup rather than a shift loop */
+	if (op == T_LTLT && get_size(nt) == 2 && l->op == T_CONSTANT &&
+		l->value == 1 && r->op != T_CONSTANT) {
+		n->op = T_ONESHL;
+		n->left = NULL;
+		free_node(l);
+		return n;
+	}
+	/* x & (1 << n) is a bit test, mask x directly with the table */
+	if (op == T_AND && get_size(nt) == 2) {
+		if (l->op == T_ONESHL) {
+			c = l;
+			l = r;
+			r = c;
+		}
+		if (r->op == T_ONESHL) {
+			n->op = T_BITAND;
+			n->left = l;
+			n->right = r->right;
+			free_node(r);
+			return n;
+		}
+	}
 	/* Commutive operations. We can swap the sides over on these */
 	if (op == T_AND || op == T_OR || op == T_HAT || op == T_STAR || op == T_PLUS) {
 /*		printf(";left %d right %d\n", is_simple(n->left), is_simple(n->right)); */
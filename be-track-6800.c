@@ -19,6 +19,10 @@ unsigned a_valid;
 unsigned b_valid;
 unsigned d_valid;
 static struct node d_node;
+/* Upper word of a long: Y on 6809 and 68HC11, @hireg otherwise */
+uint16_t hi_val;
+unsigned hi_valid;
+static unsigned hi_node;	/* d_node is a long and the upper half is live */
 
 void invalidate_all(void)
 {
@@ -26,6 +30,8 @@ void invalidate_all(void)
 	a_valid = 0;
 	b_valid = 0;
 	d_valid = 0;
+	hi_valid = 0;
+	hi_node = 0;
 }
 
 void invalidate_x(void)
@@ -48,6 +54,12 @@ void invalidate_d(void)
 	d_valid = 0;
 }
 
+void invalidate_hi(void)
+{
+	hi_valid = 0;
+	hi_node = 0;
+}
+
 void invalidate_work(void)
 {
 	a_valid = 0;
@@ -69,6 +81,7 @@ void invalidate_mem(void)
 void set_d_node(struct node *n)
 {
 	memcpy(&d_node, n, sizeof(struct node));
+	hi_node = 0;
 	switch(d_node.op) {
 	case T_LSTORE:
 		d_node.op = T_LREF;
@@ -101,6 +114,7 @@ void set_d_node(struct node *n)
 void set_d_node_ptr(struct node *n)
 {
 	memcpy(&d_node, n, sizeof(struct node));
+	hi_node = 0;
 	switch(d_node.op) {
 	case T_NAME:
 		d_node.op = T_NREF;
@@ -121,12 +135,32 @@ void set_d_node_ptr(struct node *n)
 	d_valid = 1;
 }
 
+/* D and the upper word together hold the long described by n. The
+   upper word value itself is not known */
+void set_dy_node(struct node *n)
+{
+	set_d_node(n);
+	hi_node = d_valid;
+	hi_valid = 0;
+}
+
+void set_dy_node_ptr(struct node *n)
+{
+	set_d_node_ptr(n);
+	hi_node = d_valid;
+	hi_valid = 0;
+}
+
 /* Do we need to check fields by type or will the default filling
    be sufficient ? */
 unsigned d_holds_node(struct node *n)
 {
 	if (d_valid == 0)
 		return 0;
+	/* A long match needs the upper half too, and a long in D:Y is
+	   not the same thing as a word at the same address */
+	if (hi_node != (get_size(n->type) == 4))
+		return 0;
 	if (d_node.op != n->op)
 		return 0;
 	if (d_node.val2 != n->val2)
@@ -149,3 +183,9 @@ void modify_b(uint8_t val)
 	b_val = val;
 	d_valid = 0;
 }
+
+void modify_hi(uint16_t val)
+{
+	hi_val = val;
+	hi_node = 0;
+}
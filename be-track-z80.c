@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "compiler.h"
+#include "backend.h"
+#include "backend-z80.h"
+
+/*
+ *	Track what HL, DE and A hold so that we can skip reloading a value
+ *	the working registers already contain. A register can be known to
+ *	hold up to two equivalent things at once, typically the value we
+ *	loaded and the object we then stored it into.
+ *
+ *	The code generator has to invalidate anything it does not
+ *	explicitly understand. As with the 6800 tracking we assume memory
+ *	only changes through stores we can see, so a pointer store, call or
+ *	label must throw the lot away.
+ */
+
+#define TRACK_MAX	2
+
+struct regtrack {
+	unsigned num;
+	struct node node[TRACK_MAX];
+};
+
+static struct regtrack track[3];	/* R_HL R_DE R_A */
+
+void invalidate_all(void)
+{
+	track[R_HL].num = 0;
+	track[R_DE].num = 0;
+	track[R_A].num = 0;
+}
+
+void invalidate(unsigned r)
+{
+	track[r].num = 0;
+}
+
+unsigned track_valid(unsigned r)
+{
+	return track[r].num;
+}
+
+/* Turn a node into the form we remember it as. Stores become the matching
+   reference and arguments become locals so that the same object always
+   looks the same to us */
+static unsigned track_form(register struct node *d, register struct node *n)
+{
+	unsigned size = get_size(n->type);
+
+	if (size > 2)
+		return 0;
+	memcpy(d, n, sizeof(struct node));
+	d->left = NULL;
+	d->right = NULL;
+	switch(d->op) {
+	case T_LSTORE:
+		d->op = T_LREF;
+		break;
+	case T_LBSTORE:
+		d->op = T_LBREF;
+		break;
+	case T_NSTORE:
+		d->op = T_NREF;
+		break;
+	case T_RSTORE:
+		d->op = T_RREF;
+		break;
+	case T_ARGUMENT:
+		d->value += argbase + frame_len;
+		d->op = T_LOCAL;
+		break;
+	case T_CONSTANT:
+		if (size == 1)
+			d->value = BYTE(d->value);
+		else
+			d->value = WORD(d->value);
+		return 1;
+	case T_NREF:
+	case T_LBREF:
+	case T_LREF:
+	case T_RREF:
+	case T_NAME:
+	case T_LABEL:
+	case T_LOCAL:
+		break;
+	default:
+		return 0;
+	}
+	d->value = WORD(d->value);
+	return 1;
+}
+
+static unsigned track_match(register struct node *a, register struct node *b)
+{
+	if (a->op != b->op)
+		return 0;
+	if (a->value != b->value)
+		return 0;
+	if (a->val2 != b->val2)
+		return 0;
+	if (a->snum != b->snum)
+		return 0;
+	if (get_size(a->type) != get_size(b->type))
+		return 0;
+	return 1;
+}
+
+unsigned holds_node(unsigned r, struct node *n)
+{
+	register struct regtrack *t = track + r;
+	struct node m;
+	unsigned i;
+
+	if (t->num == 0 || !track_form(&m, n))
+		return 0;
+	for (i = 0; i < t->num; i++)
+		if (track_match(t->node + i, &m))
+			return 1;
+	return 0;
+}
+
+/* Register r now also holds the value described by n */
+void add_node(unsigned r, struct node *n)
+{
+	register struct regtrack *t = track + r;
+	struct node m;
+
+	if (!track_form(&m, n) || holds_node(r, &m))
+		return;
+	/* Keep the most recent */
+	if (t->num == TRACK_MAX)
+		memmove(t->node, t->node + 1, (TRACK_MAX - 1) * sizeof(struct node));
+	else
+		t->num++;
+	memcpy(t->node + t->num - 1, &m, sizeof(struct node));
+}
+
+/* Register r has been loaded with the value described by n */
+void set_node(unsigned r, struct node *n)
+{
+	track[r].num = 0;
+	add_node(r, n);
+}
+
+/* Register r has been loaded from register f. We only copy the byte sized
+   knowledge into A as the low byte of a word is not the same object */
+void copy_track(unsigned r, unsigned f)
+{
+	register struct regtrack *s = track + f;
+	unsigned i;
+
+	if (r == f)
+		return;
+	track[r].num = 0;
+	for (i = 0; i < s->num; i++)
+		if ((r != R_A && f != R_A) || get_size(s->node[i].type) == 1)
+			add_node(r, s->node + i);
+}
+
+/* True if the low byte of f is known to be the same as A */
+unsigned same_byte(unsigned f)
+{
+	register struct regtrack *t = track + R_A;
+	unsigned i;
+
+	for (i = 0; i < t->num; i++)
+		if (get_size(t->node[i].type) == 1 && holds_node(f, t->node + i))
+			return 1;
+	return 0;
+}
+
+static void track_drop(register struct regtrack *t, unsigned i)
+{
+	t->num--;
+	memmove(t->node + i, t->node + i + 1, (t->num - i) * sizeof(struct node));
+}
+
+/* Two memory references to the same storage class overlap if they are the
+   same object and the byte ranges intersect */
+static unsigned track_overlap(register struct node *a, register struct node *b)
+{
+	unsigned as = get_size(a->type);
+	unsigned bs = get_size(b->type);
+
+	if (a->op != b->op)
+		return 0;
+	if (a->op == T_RREF)
+		return a->value == b->value;
+	if (a->op == T_NREF && a->snum != b->snum)
+		return 0;
+	if (a->op == T_LBREF && a->val2 != b->val2)
+		return 0;
+	if (a->value + as <= b->value || b->value + bs <= a->value)
+		return 0;
+	return 1;
+}
+
+/* Memory described by the store n has been written, forget anything
+   that was a copy of it. Register stores kill anything using that
+   register variable */
+void invalidate_mem(struct node *n)
+{
+	struct node m;
+	register struct regtrack *t;
+	unsigned i;
+
+	if (!track_form(&m, n)) {
+		invalidate_all();
+		return;
+	}
+	for (t = track; t < track + 3; t++) {
+		i = 0;
+		while (i < t->num) {
+			if (track_overlap(t->node + i, &m))
+				track_drop(t, i);
+			else
+				i++;
+		}
+	}
+}
@@ -15,6 +15,7 @@ static unsigned switch_default;
 static unsigned func_type;
 
 unsigned func_flags;
+unsigned func_name;
 unsigned arg_flags;
 
 /* C keyword statements */
@@ -364,6 +365,123 @@ static void load_registers(void)
 	}
 }
 
+/*
+ *	A function may only have a static frame if nothing can get back into
+ *	it while it is running. Record the direct calls each function in the
+ *	file makes and decide once we have seen them all. Calls to functions
+ *	in other files are taken on trust.
+ */
+struct func {
+	unsigned name;
+	unsigned indirect;	/* Calls through a pointer */
+	unsigned long hlab;	/* H_FRAMELABEL to fill in, 0 if none */
+};
+
+struct call {
+	unsigned caller;	/* Index into funcs */
+	unsigned callee;	/* Name, then index into funcs or NUM_FUNC */
+};
+
+static struct func funcs[NUM_FUNC];
+static struct func *funcp = funcs;
+static struct func *this_func;
+static struct call calls[NUM_CALL];
+static struct call *callp = calls;
+static struct call *func_calls;
+static unsigned call_overflow;
+
+static void new_func(unsigned name)
+{
+	this_func = NULL;
+	if (funcp == &funcs[NUM_FUNC]) {
+		call_overflow = 1;
+		return;
+	}
+	this_func = funcp++;
+	this_func->name = name;
+	this_func->indirect = 0;
+	this_func->hlab = 0;
+	func_calls = callp;
+}
+
+void note_call(unsigned name)
+{
+	register struct call *c = func_calls;
+
+	if (name == 0 || name == func_name)
+		func_flags |= F_REENTRANT;
+	if (this_func == NULL)
+		return;
+	if (name == 0) {
+		this_func->indirect = 1;
+		return;
+	}
+	if (name == func_name)
+		return;
+	while(c < callp) {
+		if (c->callee == name)
+			return;
+		c++;
+	}
+	if (callp == &calls[NUM_CALL]) {
+		call_overflow = 1;
+		return;
+	}
+	callp->caller = this_func - funcs;
+	callp->callee = name;
+	callp++;
+}
+
+/* Follow the calls out of f and see if they lead back to f, or to a call
+   through a pointer that might */
+static unsigned may_reenter(struct func *f)
+{
+	static unsigned char seen[NUM_FUNC];
+	register struct call *c;
+	register unsigned i;
+	unsigned n = f - funcs;
+	unsigned more = 1;
+
+	for (i = 0; i < NUM_FUNC; i++)
+		seen[i] = 0;
+	seen[n] = 1;
+	while(more) {
+		more = 0;
+		for (c = calls; c < callp; c++) {
+			i = c->callee;
+			if (!seen[c->caller] || i == NUM_FUNC)
+				continue;
+			if (i == n || funcs[i].indirect)
+				return 1;
+			if (!seen[i]) {
+				seen[i] = 1;
+				more = 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Called at the end of the file. Give each function that asked for one
+   a static frame label unless it might be re-entered */
+void static_frames(void)
+{
+	register struct func *f;
+	register struct call *c;
+
+	if (call_overflow)
+		return;
+	for (c = calls; c < callp; c++) {
+		for (f = funcs; f < funcp; f++)
+			if (f->name == c->callee)
+				break;
+		c->callee = f < funcp ? f - funcs : NUM_FUNC;
+	}
+	for (f = funcs; f < funcp; f++)
+		if (f->hlab && !may_reenter(f))
+			rewrite_header(f->hlab, H_FRAMELABEL, ++label_tag, 0);
+}
+
 /*
  *	We have parsed the declaration part of a function and found it
  *	is followed by a body. Set up the headersfor the backend and turn
@@ -374,6 +492,7 @@ void function_body(unsigned st, unsigned name, unsigned type)
 	/* This makes me sad, but there isn't a nice way to work out
 	   the frame size ahead of time */
 	unsigned long hrw;
+	unsigned long hlab;
 	register unsigned *p;
 	register unsigned n;
 
@@ -384,6 +503,8 @@ void function_body(unsigned st, unsigned name, unsigned type)
 	func_type = func_return(type);
 	if (func_type == VOID)
 		func_flags |= F_VOIDRET;
+	else if (IS_ARITH(func_type) && type_sizeof(func_type) > 2)
+		func_flags |= F_LONGRET;
 	p = func_args(type);
 	n = *p++;
 	if (n == 1 && *p == VOID)
@@ -398,7 +519,11 @@ void function_body(unsigned st, unsigned name, unsigned type)
 	if (st == S_AUTO || st == S_EXTERN)
 		error("invalid storage class");
 	func_tag = next_tag++;
+	func_name = name;
+	new_func(name);
 	header(H_FUNCTION, func_tag, name);
+	hlab = mark_header();
+	header(H_FRAMELABEL, 0, 0);
 	hrw = mark_header();
 	header(H_FRAME, 0, 0);
 
@@ -412,6 +537,12 @@ void function_body(unsigned st, unsigned name, unsigned type)
 
 	footer(H_FUNCTION, func_tag, name);
 
+	/* A function that does not re-enter itself directly may get a label
+	   the target can use to place the locals in static memory. We can't
+	   tell if it is safe until we have seen the rest of the file */
+	if (frame_size() && !(func_flags & F_REENTRANT) && this_func)
+		this_func->hlab = hlab;
+	this_func = NULL;
 	rewrite_header(hrw, H_FRAME, frame_size(), func_flags);
 	check_labels();
 }
@@ -1,12 +1,17 @@
 extern void statement_block(unsigned need_brack);
 extern void function_body(unsigned st, unsigned name, unsigned type);
+extern void note_call(unsigned name);
+extern void static_frames(void);
 
 extern unsigned func_flags;
+extern unsigned func_name;
 extern unsigned arg_flags;
 
 #define F_VOIDRET		1
 #define F_VOID			2
 #define F_VARARG		4
+#define F_REENTRANT		8	/* Calls itself or calls via a pointer */
+#define F_LONGRET		16	/* Returns a value wider than 16bits */
 
 /* Registers start at 1 and bit 8 to 15 */
 #define F_REG(n)		(1 << (n + 7))
@@ -129,8 +129,16 @@ struct cpu_table {
 };
 
 const char *def6502[] = { "__6502__", NULL };
+const char *m6502feat[] = {
+	"static",
+	NULL
+};
 const char *def65c02[] = { "__6502__", "__65c02__", NULL };
 const char *def65c816[] = { "__65c816__", NULL };
+const char *m65c816feat[] = {
+	"dpframe",
+	NULL
+};
 const char *def6303[] = { "__6803__", "__6303__", NULL };
 const char *def6800[] = { "__6800__", "__6800__", NULL };
 const char *def6803[] = { "__6803__", NULL };
@@ -138,15 +146,24 @@ const char *def68hc11[] = { "__68hc11__", "__6803__", NULL };
 const char *def6809[] = { "__6809__", NULL };
 const char *def8080[] = { "__8080__", NULL };
 const char *def8085[] = { "__8085__", NULL };
+const char *i8080feat[] = {
+	"regcall",
+	NULL
+};
 const char *defz80[] = { "__z80__", NULL };
 const char *z80feat[] = {
 	"banked",
 	"noix",
 	"noiy",
+	"regcall",
+	"exx",
 	NULL
 };
 
 const char *defz180[] = { "__z80__", "__z180__", NULL };
+const char *defz280[] = { "__z80__", "__z280__", NULL };
+const char *defez80[] = { "__z80__", "__ez80__", NULL };
+const char *defrabbit[] = { "__z80__", "__rabbit__", NULL };
 const char *defbyte[] = { "__byte__", NULL };
 const char *defthread[] = { "__thread__", NULL };
 const char *defz8[] = { "__z8__", NULL };
@@ -177,9 +194,9 @@ const char *ldthread[] = { NULL };
 const char *cpucode;
 
 struct cpu_table cpu_rules[] = {
-	{ "6502", "6502", ".6502", "lib6502.a", "6502", def6502, ld6502, "0", 0, NULL },
-	{ "65c02", "6502", ".6502", "lib65c02.a", "65c02", def65c02, ld6502, "1" , 0, NULL},
-	{ "65c816", "6502", ".65c816", "lib65c816.a", "65c816", def65c816, ld6502, "0" , 0, NULL},
+	{ "6502", "6502", ".6502", "lib6502.a", "6502", def6502, ld6502, "0", 0, m6502feat },
+	{ "65c02", "6502", ".6502", "lib65c02.a", "65c02", def65c02, ld6502, "1" , 0, m6502feat},
+	{ "65c816", "6502", ".65c816", "lib65c816.a", "65c816", def65c816, ld6502, "0" , 0, m65c816feat},
 	{ "6303", "6800", ".6800", "lib6303.a", "6303", def6303, ld6800, "6303" , 1, NULL},
 	{ "6800", "6800", ".6800", "lib6800.a", "6800", def6800, ld6800, "6800" , 1, NULL},
 	{ "6803", "6800", ".6800", "lib6803.a", "6803", def6803, ld6800, "6803" , 1, NULL},
@@ -187,10 +204,16 @@ struct cpu_table cpu_rules[] = {
 	{ "6309", "6809", ".6809", "lib6809.a", "6809", def6809, ld6809, "6809" , 1, NULL},
 	{ "6809", "6809", ".6809", "lib6809.a", "6809", def6809, ld6809, "6809" , 1, NULL},
 	{ "68hc11", "hc11", ".6800", "lib68hc11.a", "68hc11", def68hc11, ld6800, "6811" , 1, NULL},
-	{ "8080", "8080", ".8080", "lib8080.a", "8080", def8080, ld8080, "8080" , 0, NULL},
-	{ "8085", "8080", ".8080", "lib8085.a", "8085", def8085, ld8080, "8085" , 0, NULL},
+	{ "8080", "8080", ".8080", "lib8080.a", "8080", def8080, ld8080, "8080" , 0, i8080feat},
+	{ "8085", "8080", ".8080", "lib8085.a", "8085", def8085, ld8080, "8085" , 0, i8080feat},
 	{ "z80", "z80", ".z80", "libz80.a", "z80", defz80, ld8080, "80" , 1, z80feat},
 	{ "z180", "z80", ".z80", "libz180.a", "z80", defz180, ld8080, "180" , 1, z80feat},
+	/* The eZ80 (in Z80 mode) and Z280 run Z80 code so can share the library */
+	{ "z280", "z80", ".z80", "libz80.a", "z80", defz280, ld8080, "280" , 1, z80feat},
+	{ "ez80", "z80", ".z80", "libz80.a", "z80", defez80, ld8080, "800" , 1, z80feat},
+	/* Rabbit 2000 and later drop some Z80 instructions so have their own
+	   support library built in supportz80 */
+	{ "rabbit", "z80", ".z80", "librabbit.a", "z80", defrabbit, ld8080, "2000" , 1, z80feat},
 	/* Other Z80 variants TODO */
 	/* Similar issues. We may end up making this a bunch of CPU specifics
 	   anyway because of endianness, alignment etc */
@@ -224,6 +247,7 @@ const char **ldopts;		/* Linker opts for default link */
 unsigned has_relocs;		/* Do we have relocations ? */
 const char **feats;		/* CPU features */
 unsigned long features;		/* Bit mask of feature info for pass 2 */
+unsigned regcall;		/* Register calling convention libraries */
 
 /* We will need to do more with ldopts for different OS and machine targets
    eventually */
@@ -580,10 +604,29 @@ void convert_s_to_o(char *path)
 	free(origpath);
 }
 
+/* Use the compiled form of the optimizer rules if it is up to date. The
+   caller frees the returned name */
+static char *rules_name(void)
+{
+	struct stat st, cst;
+	char *r = xstrdup(make_lib_name("rules.", cpuset), 4);
+	char *c = xstrdup(r, 4);
+
+	strcat(c, ".bin");
+	if (stat(c, &cst) == 0 && (stat(r, &st) == -1 ||
+			cst.st_mtime >= st.st_mtime)) {
+		free(r);
+		return c;
+	}
+	free(c);
+	return r;
+}
+
 void convert_c_to_s(char *path)
 {
-	char *tmp, *t, *p;
+	char *tmp, *t, *p, *r;
 	char optstr[2];
+	char coptstr[4] = "-O";
 	char featstr[16];
 
 	snprintf(featstr, 16, "%lu", features);
@@ -633,12 +676,19 @@ void convert_c_to_s(char *path)
 	/* TODO: with the new copt we may end up with a copt per cpu */
 	p = xstrdup(make_lib_name("copt", ""), 0);
 	build_arglist(p);
-	add_argument(make_lib_name("rules.", cpuset));
+	/* Stream the file a function at a time to keep memory use down */
+	add_argument("-s");
+	/* Rules with a cost favour size at -Os and speed otherwise */
+	coptstr[2] = optimize;
+	add_argument(coptstr);
+	r = rules_name();
+	add_argument(r);
 	redirect_in(tmp);
 	redirect_out(pathmod(path, ".#", ".s", 2, 2));
 	run_command();
 	free(t);
 	free(p);
+	free(r);
 }
 
 void convert_S_to_s(char *path)
@@ -740,7 +790,7 @@ void link_phase(void)
 		add_argument(c);
 		append_obj(&libpathlist, l, 0);
 		append_obj(&libpathlist, ".", 0);
-		append_obj(&liblist, "c", TYPE_A);
+		append_obj(&liblist, regcall ? "crc" : "c", TYPE_A);
 	}
 	/* Will be <root>/8080/lib/lib8080.a etc */
 	append_obj(&liblist, make_lib_file("", "lib", cpulib), TYPE_A);
@@ -929,6 +979,19 @@ void extended_opt(const char *p)
 	usage();
 }
 
+/* Code built with the register calling convention must be linked with
+   libraries built the same way. They are named with an rc suffix */
+static void set_regcall(void)
+{
+	static char rclib[32];
+	int n = strlen(cpulib) - 2;
+
+	snprintf(rclib, sizeof(rclib), "%.*src.a", n, cpulib);
+	cpulib = rclib;
+	append_obj(&deflist, (char *)"__regcall__", 0);
+	regcall = 1;
+}
+
 void find_opt(const char *p)
 {
 	const char **op = feats;
@@ -937,6 +1000,8 @@ void find_opt(const char *p)
 		while(*op) {
 			if (strcmp(p, *op) == 0) {
 				features |= n;
+				if (strcmp(p, "regcall") == 0)
+					set_regcall();
 				return;
 			}
 			op++;
@@ -19,6 +19,11 @@
 #define NUM_SWITCH		128
 /* Number of constants from enum. 4 bytes per entry */
 #define NUM_CONSTANT		50
+/* Functions and distinct direct calls per file kept to find recursion
+   for static frames. 8 and 4 bytes per entry. If either fills up no
+   function in the file gets a static frame */
+#define NUM_FUNC		64
+#define NUM_CALL		256
 
 #include <stdio.h>
 
@@ -9,12 +9,22 @@
 
 int rpn_eval(const char* expr, char** vars);
 
-#define HSIZE 107
+#define HSIZE 256 /* initial string table size, a power of two */
+#define POOLBLK 16384 /* pool block size */
+#define PALIGN 8 /* pool allocation alignment */
 #define MAXLINE 128
 #define MAXFIRECOUNT 65535L
 #define MAX_PASS 16
+#define NKEY 64 /* match index buckets */
+#define KEYLEN 4 /* characters of a line used as the index key */
+#define MAXNAME 64 /* register names */
+#define MAXREG 32 /* registers (bits in a register mask) */
+#define MAXDEAD 4 /* %dead lines in a pattern */
 
 int debug = 0;
+int stream = 0; /* optimize and flush the input a function at a time */
+int window = 0; /* longest rule pattern, lines kept between chunks */
+int mode = 0; /* 'S' size or 'T' time to weigh rules with a %cost */
 
 int global_again = 0; /* signalize that rule set has changed */
 #define FIRSTLAB 'L'
@@ -30,9 +40,45 @@ struct lnode {
 struct onode {
     struct lnode *o_old, *o_new;
     struct onode* o_next;
+    struct onode* o_chain; /* next rule in the same index bucket */
+    unsigned o_seq; /* position in the rule list */
+    int o_key; /* index bucket of the last pattern line or -1 */
+    int o_cost; /* 0 none, 1 worked out from the table, 2 given */
+    long o_bytes, o_cycles; /* given savings */
     long firecount;
 }* opts = 0, *activerule = 0;
 
+struct hnode {
+    char* h_str;
+    struct hnode* h_ptr;
+    unsigned long h_hash;
+};
+
+struct pblock {
+    struct pblock* b_next;
+    unsigned b_size;
+    double b_align; /* keep the data that follows aligned */
+};
+
+struct pool {
+    struct pblock* p_blk; /* blocks in use, the newest first */
+    struct pblock* p_spare; /* emptied blocks */
+    char* p_ptr;
+    unsigned p_left;
+    struct lnode* p_free; /* list nodes given back */
+    struct hnode** p_htab; /* string table for the pool */
+    unsigned p_hsize, p_hcount;
+} perm, chunk[2], *cur = &perm;
+
+struct onode* bucket[NKEY]; /* rules whose last pattern line has that key */
+struct onode* generic; /* rules that must be tried against every line */
+struct onode* effects; /* register effects of instructions */
+struct onode* costs; /* instruction sizes and timings */
+
+char* regname[MAXNAME]; /* register and register group names */
+unsigned long regmask[MAXNAME];
+int nname, nreg;
+
 void printlines(struct lnode* beg, struct lnode* end, FILE* out)
 {
     struct lnode* p;
@@ -70,37 +116,156 @@ void connect(struct lnode* p1, struct lnode* p2)
     p2->l_prev = p1;
 }
 
+/*
+ * Lines, list nodes and the string table entries for them come from pools.
+ * Rules live in a pool that is never freed. Input uses one of two chunk
+ * pools: when streaming, the lines still held after a flush are moved to
+ * the other pool and everything else in the old one goes at once.
+ */
+
+/* palloc - allocate n bytes from the current pool */
+void* palloc(unsigned n)
+{
+    struct pool* p = cur;
+    struct pblock* b;
+    unsigned size;
+    char* r;
+
+    n = (n + PALIGN - 1) & ~(PALIGN - 1);
+    if (n > p->p_left) {
+        size = n > POOLBLK ? n : POOLBLK;
+        if (size == POOLBLK && p->p_spare) {
+            b = p->p_spare;
+            p->p_spare = b->b_next;
+        } else {
+            b = (struct pblock*)malloc(sizeof(struct pblock) + size);
+            if (b == NULL)
+                error("palloc: out of memory\n");
+            b->b_size = size;
+        }
+        b->b_next = p->p_blk;
+        p->p_blk = b;
+        p->p_ptr = (char*)(b + 1);
+        p->p_left = size;
+    }
+    r = p->p_ptr;
+    p->p_ptr += n;
+    p->p_left -= n;
+    return r;
+}
+
+/* preset - empty pool p keeping its standard blocks for reuse */
+void preset(struct pool* p)
+{
+    struct pblock *b, *n;
+
+    for (b = p->p_blk; b; b = n) {
+        n = b->b_next;
+        if (b->b_size == POOLBLK) {
+            b->b_next = p->p_spare;
+            p->p_spare = b;
+        } else
+            free(b);
+    }
+    p->p_blk = 0;
+    p->p_left = 0;
+    p->p_free = 0;
+    if (p->p_hcount) {
+        memset(p->p_htab, 0, p->p_hsize * sizeof(struct hnode*));
+        p->p_hcount = 0;
+    }
+}
+
+/* hash - FNV-1a hash of a string, also returning its length */
+unsigned long hash(char* str, unsigned* len)
+{
+    unsigned long h = 2166136261UL;
+    char* s;
+
+    for (s = str; *s; s++)
+        h = ((h ^ (unsigned char)*s) * 16777619UL) & 0xFFFFFFFFUL;
+    *len = s - str;
+    return h;
+}
+
+/* lookup - find str in the string table of pool p */
+char* lookup(struct pool* p, char* str, unsigned long h)
+{
+    struct hnode* n;
+
+    if (p->p_hsize == 0)
+        return 0;
+    for (n = p->p_htab[h & (p->p_hsize - 1)]; n; n = n->h_ptr)
+        if (n->h_hash == h && strcmp(n->h_str, str) == 0)
+            return n->h_str;
+    return 0;
+}
+
+/* grow - double the string table of pool p */
+void grow(struct pool* p)
+{
+    struct hnode **t, *n, *next;
+    unsigned i, size = p->p_hsize ? 2 * p->p_hsize : HSIZE;
+
+    t = (struct hnode**)calloc(size, sizeof(struct hnode*));
+    if (t == NULL)
+        error("install: out of memory\n");
+    for (i = 0; i < p->p_hsize; i++)
+        for (n = p->p_htab[i]; n; n = next) {
+            next = n->h_ptr;
+            n->h_ptr = t[n->h_hash & (size - 1)];
+            t[n->h_hash & (size - 1)] = n;
+        }
+    free(p->p_htab);
+    p->p_htab = t;
+    p->p_hsize = size;
+}
+
 /* install - install str in string table */
 char* install(char* str)
 {
-    register struct hnode* p;
-    register char *p1, *p2, *s;
-    register int i;
-    static struct hnode {
-        char* h_str;
-        struct hnode* h_ptr;
-    } * htab[HSIZE] = { 0 };
+    struct pool* p = cur;
+    struct hnode* n;
+    unsigned long h;
+    unsigned len;
+    char* r;
+
+    /* Rule text is shared by everyone */
+    h = hash(str, &len);
+    if ((r = lookup(&perm, str, h)) != 0)
+        return r;
+    if (p != &perm && (r = lookup(p, str, h)) != 0)
+        return r;
 
-    s = str;
-    for (i = 0; *s; i += *s++)
-        ;
-    i = abs(i) % HSIZE;
+    if (p->p_hcount >= p->p_hsize)
+        grow(p);
+    n = (struct hnode*)palloc(sizeof *n + len + 1);
+    n->h_str = (char*)(n + 1);
+    memcpy(n->h_str, str, len + 1);
+    n->h_hash = h;
+    n->h_ptr = p->p_htab[h & (p->p_hsize - 1)];
+    p->p_htab[h & (p->p_hsize - 1)] = n;
+    p->p_hcount++;
+    return n->h_str;
+}
 
-    for (p = htab[i]; p; p = p->h_ptr)
-        for (p1 = str, p2 = p->h_str; *p1++ == *p2++;)
-            if (p1[-1] == '\0')
-                return (p->h_str);
+/* newline - allocate a list node from the current pool */
+struct lnode* newline(void)
+{
+    struct lnode* n = cur->p_free;
 
-    p = (struct hnode*)malloc(sizeof *p);
-    if (p == NULL)
-        error("install 1: out of memory\n");
-    p->h_str = (char*)malloc((s - str) + 1);
-    if (p->h_str == NULL)
-        error("install 2: out of memory\n");
-    strcpy(p->h_str, str);
-    p->h_ptr = htab[i];
-    htab[i] = p;
-    return (p->h_str);
+    if (n) {
+        cur->p_free = n->l_next;
+        return n;
+    }
+    return (struct lnode*)palloc(sizeof *n);
+}
+
+/* lfree - give back list node n for reuse */
+void lfree(struct lnode* n)
+{
+    n->l_next = cur->p_free;
+    cur->p_free = n;
 }
 
 /* insert - insert a new node with text s before node p */
@@ -108,9 +273,7 @@ void insert(char* s, struct lnode* p)
 {
     struct lnode* n;
 
-    n = (struct lnode*)malloc(sizeof *n);
-    if (n == NULL)
-        error("insert: out of memory\n");
+    n = newline();
     n->l_text = s;
     connect(p->l_prev, n);
     connect(n, p);
@@ -150,6 +313,64 @@ void getlst_1(FILE* fp, char* quit, struct lnode* p1, struct lnode* p2)
     }
 }
 
+/* patlen - number of input lines a rule pattern matches */
+int patlen(struct lnode* p)
+{
+    int n = 0;
+    for (; p; p = p->l_prev)
+        if (*p->l_text != '%' || p->l_text[1] == '%' || isdigit(p->l_text[1]))
+            n++;
+    return n;
+}
+
+/* key - index bucket for a line or pattern, -1 if there isn't one */
+int key(char* s, int pattern)
+{
+    unsigned h = 0;
+    int i;
+
+    for (i = 0; i < KEYLEN; i++) {
+        if (s[i] == 0 || (pattern && s[i] == '%'))
+            return -1;
+        h = h * 31 + (unsigned char)s[i];
+    }
+    return h % NKEY;
+}
+
+/* rulekey - key of the last pattern line that is matched against input */
+int rulekey(struct lnode* p)
+{
+    while (p && p->l_text[0] == '%' && p->l_text[1] != '%' && !isdigit(p->l_text[1]))
+        p = p->l_prev;
+    return p ? key(p->l_text, 1) : -1;
+}
+
+/* mkindex - rebuild the match index, keeping rule order in each bucket */
+void mkindex(void)
+{
+    struct onode *o, **tail[NKEY], **gtail;
+    unsigned seq = 0;
+    int i;
+
+    for (i = 0; i < NKEY; i++) {
+        bucket[i] = 0;
+        tail[i] = &bucket[i];
+    }
+    generic = 0;
+    gtail = &generic;
+    for (o = opts; o; o = o->o_next) {
+        o->o_seq = seq++;
+        o->o_chain = 0;
+        if (o->o_key < 0) {
+            *gtail = o;
+            gtail = &o->o_chain;
+        } else {
+            *tail[o->o_key] = o;
+            tail[o->o_key] = &o->o_chain;
+        }
+    }
+}
+
 /* init - read patterns file */
 void init(FILE* fp)
 {
@@ -164,6 +385,7 @@ void init(FILE* fp)
         if (p == NULL)
             error("init: out of memory\n");
         p->firecount = MAXFIRECOUNT;
+        p->o_cost = 0;
         getlst_1(fp, "=\n", &head, &tail);
         head.l_next->l_prev = 0;
         if (tail.l_prev)
@@ -178,11 +400,204 @@ void init(FILE* fp)
         if (head.l_next)
             head.l_next->l_prev = 0;
         p->o_new = head.l_next;
+        p->o_key = rulekey(p->o_old);
+        if (patlen(p->o_old) > window)
+            window = patlen(p->o_old);
+
+        *next = p;
+        next = &p->o_next;
+    }
+    *next = 0;
+}
+
+/*
+ * Compiled rules. These are "COPT" and a version byte, the string table as
+ * a count, a byte length and the NUL terminated strings, then a count of
+ * rules. Each rule is its index key (255 for none), the pattern and
+ * replacement line counts and a string number for each line. Everything
+ * else is 16bit little endian so the file works on any host. Bump the
+ * version if rulekey() changes.
+ */
+#define CVERSION 2
+
+char** strtab; /* strings in the compiled rules */
+unsigned nstr;
+
+void put16(unsigned v, FILE* fp)
+{
+    putc(v & 0xFF, fp);
+    putc((v >> 8) & 0xFF, fp);
+}
+
+unsigned get16(FILE* fp)
+{
+    int l = getc(fp);
+    int h = getc(fp);
+    if (l == EOF || h == EOF)
+        error("copt: compiled rules truncated\n");
+    return l | (h << 8);
+}
+
+/* strnum - number of interned string s in the string table */
+unsigned strnum(char* s)
+{
+    unsigned i;
+
+    for (i = 0; i < nstr; i++)
+        if (strtab[i] == s)
+            return i;
+    strtab = (char**)realloc(strtab, (nstr + 1) * sizeof(char*));
+    if (strtab == NULL)
+        error("strnum: out of memory\n");
+    strtab[nstr] = s;
+    return nstr++;
+}
+
+/* first - first line of a rule pattern */
+struct lnode* first(struct lnode* p)
+{
+    while (p->l_prev)
+        p = p->l_prev;
+    return p;
+}
+
+/* savebin - write out the loaded rules in compiled form */
+void savebin(char* name)
+{
+    FILE* fp;
+    struct onode* o;
+    struct lnode* p;
+    unsigned i, n, len = 0, nold, nnew;
+
+    for (n = 0, o = opts; o; o = o->o_next, n++) {
+        for (p = first(o->o_old); p; p = p->l_next)
+            strnum(p->l_text);
+        for (p = o->o_new; p; p = p->l_next)
+            strnum(p->l_text);
+    }
+    for (i = 0; i < nstr; i++)
+        len += strlen(strtab[i]) + 1;
+    if (nstr > 0xFFFF || len > 0xFFFF || n > 0xFFFF)
+        error("copt: too many rules to compile\n");
+
+    if ((fp = fopen(name, "w")) == NULL)
+        error("copt: can't create compiled rules\n");
+    fputs("COPT", fp);
+    putc(CVERSION, fp);
+    put16(nstr, fp);
+    put16(len, fp);
+    for (i = 0; i < nstr; i++)
+        fwrite(strtab[i], strlen(strtab[i]) + 1, 1, fp);
+    put16(n, fp);
+    for (o = opts; o; o = o->o_next) {
+        nold = nnew = 0;
+        for (p = first(o->o_old); p; p = p->l_next)
+            nold++;
+        for (p = o->o_new; p; p = p->l_next)
+            nnew++;
+        putc(o->o_key < 0 ? 255 : o->o_key, fp);
+        put16(nold, fp);
+        put16(nnew, fp);
+        for (p = first(o->o_old); p; p = p->l_next)
+            put16(strnum(p->l_text), fp);
+        for (p = o->o_new; p; p = p->l_next)
+            put16(strnum(p->l_text), fp);
+    }
+    if (fclose(fp))
+        error("copt: error writing compiled rules\n");
+}
+
+/* getlines - link n lines from the compiled string table between p1 and p2 */
+void getlines(FILE* fp, unsigned n, struct lnode* p1, struct lnode* p2)
+{
+    unsigned i;
+
+    connect(p1, p2);
+    while (n--) {
+        if ((i = get16(fp)) >= nstr)
+            error("copt: bad compiled rules\n");
+        insert(strtab[i], p2);
+    }
+}
 
+/* loadbin - read a compiled rules file, the magic has been checked */
+void loadbin(FILE* fp)
+{
+    struct lnode head, tail;
+    struct onode *p, **next;
+    unsigned i, len, n, nold, nnew;
+    char *buf, *s;
+    int k;
+
+    if (getc(fp) != CVERSION)
+        error("copt: compiled rules are the wrong version\n");
+    nstr = get16(fp);
+    len = get16(fp);
+    /* An empty rule set has no strings at all */
+    buf = (char*)malloc(len + 1);
+    strtab = (char**)malloc((nstr + 1) * sizeof(char*));
+    if (buf == NULL || strtab == NULL)
+        error("loadbin: out of memory\n");
+    if (len && fread(buf, len, 1, fp) != 1)
+        error("copt: compiled rules truncated\n");
+    for (s = buf, i = 0; i < nstr; i++) {
+        if (s >= buf + len)
+            error("copt: bad compiled rules\n");
+        strtab[i] = s;
+        s += strlen(s) + 1;
+    }
+
+    next = &opts;
+    while (*next)
+        next = &((*next)->o_next);
+    n = get16(fp);
+    while (n--) {
+        p = (struct onode*)malloc((unsigned)sizeof(struct onode));
+        if (p == NULL)
+            error("loadbin: out of memory\n");
+        p->firecount = MAXFIRECOUNT;
+        p->o_cost = 0;
+        k = getc(fp);
+        p->o_key = (k == 255) ? -1 : k;
+        nold = get16(fp);
+        nnew = get16(fp);
+        if (nold == 0 || k == EOF || (k != 255 && k >= NKEY))
+            error("copt: bad compiled rules\n");
+        getlines(fp, nold, &head, &tail);
+        head.l_next->l_prev = 0;
+        tail.l_prev->l_next = 0;
+        p->o_old = tail.l_prev;
+        getlines(fp, nnew, &head, &tail);
+        p->o_new = 0;
+        if (nnew) {
+            head.l_next->l_prev = 0;
+            tail.l_prev->l_next = 0;
+            p->o_new = head.l_next;
+        }
+        if (patlen(p->o_old) > window)
+            window = patlen(p->o_old);
         *next = p;
         next = &p->o_next;
     }
     *next = 0;
+    /* The strings stay in use as rule text */
+    free(strtab);
+    strtab = 0;
+    nstr = 0;
+}
+
+/* load - read a rules file in either text or compiled form */
+void load(FILE* fp)
+{
+    char magic[4];
+
+    if (fread(magic, 4, 1, fp) == 1 && memcmp(magic, "COPT", 4) == 0)
+        loadbin(fp);
+    else {
+        rewind(fp);
+        init(fp);
+    }
+    fclose(fp);
 }
 
 /* match - check conditions in rules */
@@ -343,7 +758,7 @@ struct lnode* rep(
         psav = p->l_next;
         if (debug)
             fputs(p->l_text, stderr);
-        free(p);
+        lfree(p);
     }
     connect(p1, p2);
     if (debug)
@@ -400,16 +815,361 @@ struct lnode* copylist(
     return more;
 }
 
+/*
+ * Register liveness. A rules file can declare the target registers
+ *
+ * %registers
+ * =
+ * a
+ * hl h l
+ *
+ * where a line with one name is a register and a longer line names a group
+ * of registers, and describe what instructions do to them
+ *
+ *	mov %1,%2
+ * =
+ * %effect
+ * %uses %2
+ * %sets %1
+ *
+ * A %n names every register that appears in the matched text, except that
+ * registers inside () in a %sets operand are addresses and so are used.
+ * %end means nothing is live after the instruction (eg a return).
+ *
+ * A "%dead reg..." pattern line then only matches if the registers are
+ * written before they are read on the code following that point. This is
+ * a simple forward scan within the block. Anything without an effect, such
+ * as a branch, label or helper call we know nothing about, counts as a use.
+ */
+
+/* regfind - look up a register name of length n */
+int regfind(char* s, int n)
+{
+    int i;
+
+    for (i = 0; i < nname; i++)
+        if (strncmp(regname[i], s, n) == 0 && regname[i][n] == 0)
+            return i;
+    return -1;
+}
+
+/* regadd - declare a register name, or find it if it exists */
+int regadd(char* s, int n)
+{
+    int i = regfind(s, n);
+
+    if (i >= 0)
+        return i;
+    if (nname == MAXNAME)
+        error("copt: too many register names\n");
+    regname[nname] = (char*)malloc(n + 1);
+    if (regname[nname] == NULL)
+        error("regadd: out of memory\n");
+    memcpy(regname[nname], s, n);
+    regname[nname][n] = 0;
+    regmask[nname] = 0;
+    return nname++;
+}
+
+/* regline - declare a register or a register group from "name parts..." */
+void regline(char* s)
+{
+    int i, j, n;
+
+    while (isspace(*s))
+        s++;
+    for (n = 0; s[n] && !isspace(s[n]); n++)
+        ;
+    if (n == 0)
+        return;
+    i = regadd(s, n);
+    for (s += n; *s;) {
+        while (isspace(*s))
+            s++;
+        for (n = 0; s[n] && !isspace(s[n]); n++)
+            ;
+        if (n == 0)
+            break;
+        j = regadd(s, n);
+        if (regmask[j] == 0) {
+            if (nreg == MAXREG)
+                error("copt: too many registers\n");
+            regmask[j] = 1UL << nreg++;
+        }
+        regmask[i] |= regmask[j];
+        s += n;
+    }
+    if (regmask[i] == 0) {
+        if (nreg == MAXREG)
+            error("copt: too many registers\n");
+        regmask[i] = 1UL << nreg++;
+    }
+}
+
+/* regtext - add the registers named in s to *m, or *u if they are in () */
+void regtext(char* s, unsigned long* m, unsigned long* u)
+{
+    int depth = 0, i, n;
+
+    while (*s) {
+        if (isalnum(*s) || *s == '_' || *s == '\'') {
+            for (n = 0; isalnum(s[n]) || s[n] == '_' || s[n] == '\''; n++)
+                ;
+            if ((i = regfind(s, n)) >= 0)
+                *(depth ? u : m) |= regmask[i];
+            s += n;
+            continue;
+        }
+        if (*s == '(')
+            depth++;
+        else if (*s == ')' && depth)
+            depth--;
+        s++;
+    }
+}
+
+/* regitems - add the registers and %n operands listed in s to *m */
+void regitems(char* s, char** vars, unsigned long* m, unsigned long* u)
+{
+    int i, n;
+
+    while (*s) {
+        if (isspace(*s)) {
+            s++;
+            continue;
+        }
+        for (n = 0; s[n] && !isspace(s[n]); n++)
+            ;
+        if (s[0] == '%' && isdigit(s[1]) && n == 2) {
+            if (vars[s[1] - '0'] == 0)
+                error("copt: register variable is not set\n");
+            regtext(vars[s[1] - '0'], m, u);
+        } else if ((i = regfind(s, n)) >= 0)
+            *m |= regmask[i];
+        else {
+            fprintf(stderr, "error in \"%s\": ", s);
+            error("unknown register\n");
+        }
+        s += n;
+    }
+}
+
+/* effect - find the registers instruction s uses and sets */
+int effect(char* s, unsigned long* use, unsigned long* set, int* end)
+{
+    struct onode* o;
+    struct lnode* p;
+    char *vars[10], *t;
+    int i;
+
+    *use = *set = 0;
+    *end = 0;
+    /* Blank lines do nothing */
+    for (t = s; isspace(*t); t++)
+        ;
+    if (*t == 0)
+        return 1;
+    for (o = effects; o; o = o->o_next) {
+        for (i = 0; i < 10; i++)
+            vars[i] = 0;
+        if (!match(s, o->o_old->l_text, vars))
+            continue;
+        for (p = o->o_new->l_next; p; p = p->l_next) {
+            if (strncmp(p->l_text, "%uses", 5) == 0)
+                regitems(p->l_text + 5, vars, use, use);
+            else if (strncmp(p->l_text, "%sets", 5) == 0)
+                regitems(p->l_text + 5, vars, set, use);
+            else if (strncmp(p->l_text, "%end", 4) == 0)
+                *end = 1;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/* dead - check the registers listed in s are dead before line p */
+int dead(char* s, char** vars, struct lnode* p)
+{
+    unsigned long live = 0, use, set;
+    int end;
+
+    regitems(s, vars, &live, &live);
+    /* The tail of the list has no successor and we can't see past it */
+    for (; p && p->l_next; p = p->l_next) {
+        if (!effect(p->l_text, &use, &set, &end) || (use & live))
+            return 0;
+        live &= ~set;
+        if (live == 0 || end)
+            return 1;
+    }
+    return 0;
+}
+
+/* regsetup - move register declarations and effects out of the rules */
+void regsetup(void)
+{
+    struct onode *o, **next = &opts, **etail = &effects;
+    struct lnode* p;
+
+    while ((o = *next) != 0) {
+        if (o->o_old->l_prev == 0 && strcmp(o->o_old->l_text, "%registers\n") == 0) {
+            for (p = o->o_new; p; p = p->l_next)
+                regline(p->l_text);
+        } else if (o->o_new && strcmp(o->o_new->l_text, "%effect\n") == 0) {
+            if (o->o_old->l_prev)
+                error("copt: an %effect pattern must be one line\n");
+            *etail = o;
+            etail = &o->o_next;
+        } else {
+            next = &o->o_next;
+            continue;
+        }
+        *next = o->o_next;
+    }
+    *etail = 0;
+}
+
+/*
+ * Costs. A rules file can give the size in bytes and time in cycles of
+ * instructions
+ *
+ *	ld %1,(hl)
+ * =
+ * %instr 1 7
+ *
+ * A rule that is not always a win starts its replacement with "%cost" to
+ * have the old and new lines priced from that table, or "%cost bytes cycles"
+ * to give what it saves directly. With -Os such a rule only fires if the
+ * code gets smaller, or stays the same size and gets no slower. With -O it
+ * must get faster, or stay as fast and get no bigger, and with neither it
+ * must get no bigger and no slower. An instruction without a cost stops the
+ * rule firing.
+ */
+
+/* cost - add sign times the size and time of instruction s */
+int cost(char* s, int sign, long* bytes, long* cycles)
+{
+    struct onode* o;
+    char *vars[10], *t;
+    int i;
+
+    for (t = s; isspace(*t); t++)
+        ;
+    if (*t == 0)
+        return 1;
+    for (o = costs; o; o = o->o_next) {
+        for (i = 0; i < 10; i++)
+            vars[i] = 0;
+        if (match(s, o->o_old->l_text, vars)) {
+            *bytes += sign * o->o_bytes;
+            *cycles += sign * o->o_cycles;
+            return 1;
+        }
+    }
+    if (debug)
+        fprintf(stderr, "No cost for %s", s);
+    return 0;
+}
+
+/* worth - check if rule o pays for itself replacing the lines after c to r */
+int worth(struct onode* o, struct lnode* c, struct lnode* r, char** vars)
+{
+    long bytes = o->o_bytes, cycles = o->o_cycles, gain, other;
+    struct lnode* p;
+
+    if (o->o_cost == 1) {
+        bytes = cycles = 0;
+        for (p = c->l_next; p != r->l_next; p = p->l_next)
+            if (!cost(p->l_text, 1, &bytes, &cycles))
+                return 0;
+        for (p = o->o_new; p; p = p->l_next)
+            if (strcmp(p->l_text, "%once\n") != 0
+                && !cost(subst_imp(p->l_text, vars), -1, &bytes, &cycles))
+                return 0;
+    }
+    if (debug)
+        fprintf(stderr, "Saves %ld bytes %ld cycles\n", bytes, cycles);
+    if (mode == 0)
+        return bytes >= 0 && cycles >= 0;
+    gain = mode == 'S' ? bytes : cycles;
+    other = mode == 'S' ? cycles : bytes;
+    return gain > 0 || (gain == 0 && other >= 0);
+}
+
+/* costsetup - move the cost table out of the rules and note %cost rules */
+void costsetup(void)
+{
+    struct onode *o, **next = &opts, **ctail = &costs;
+    struct lnode* p;
+
+    while ((o = *next) != 0) {
+        p = o->o_new;
+        if (p && strncmp(p->l_text, "%instr", 6) == 0) {
+            if (o->o_old->l_prev)
+                error("copt: an %instr pattern must be one line\n");
+            if (sscanf(p->l_text + 6, "%ld %ld", &o->o_bytes, &o->o_cycles) != 2)
+                error("copt: bad %instr line\n");
+            *ctail = o;
+            ctail = &o->o_next;
+            *next = o->o_next;
+            continue;
+        }
+        if (p && strncmp(p->l_text, "%cost", 5) == 0) {
+            if (sscanf(p->l_text + 5, "%ld %ld", &o->o_bytes, &o->o_cycles) == 2)
+                o->o_cost = 2;
+            else
+                o->o_cost = 1;
+            o->o_new = p->l_next;
+            if (o->o_new)
+                o->o_new->l_prev = 0;
+            lfree(p);
+        }
+        next = &o->o_next;
+    }
+    *ctail = 0;
+}
+
+/* nextrule - pick the earlier of the next bucket and next generic rule */
+struct onode* nextrule(struct onode** b, struct onode** g, int linear)
+{
+    struct onode* o;
+
+    if (linear) {
+        o = *g;
+        if (o)
+            *g = o->o_next;
+        return o;
+    }
+    if (*b && (*g == 0 || (*b)->o_seq < (*g)->o_seq)) {
+        o = *b;
+        *b = o->o_chain;
+    } else {
+        o = *g;
+        if (o)
+            *g = o->o_chain;
+    }
+    return o;
+}
+
 /* opt - replace instructions ending at r if possible */
 struct lnode* opt(struct lnode* r)
 {
     char* vars[10];
     int i, lines;
     struct lnode *c, *p;
-    struct onode* o;
+    struct onode *o, *b, *g;
+    int linear = 0;
+    char* deadpat[MAXDEAD];
+    struct lnode* deadat[MAXDEAD];
+    int ndead;
     static char* activated = "%activated ";
 
-    for (o = opts; o; o = o->o_next) {
+    /* Only rules whose last pattern line could match r need trying */
+    i = key(r->l_text, 0);
+    b = i < 0 ? 0 : bucket[i];
+    g = generic;
+
+    for (o = nextrule(&b, &g, 0); o; o = nextrule(&b, &g, linear)) {
         activerule = o;
         if (o->firecount < 1)
             continue;
@@ -424,6 +1184,7 @@ struct lnode* opt(struct lnode* r)
         for (i = 0; i < 10; i++)
             vars[i] = 0;
         lines = 0;
+        ndead = 0;
         while (p && c) {
             if (strncmp(p->l_text, "%check", 6) == 0) {
                 if (!check(p->l_text + 6, vars))
@@ -431,6 +1192,13 @@ struct lnode* opt(struct lnode* r)
             } else if ( strncmp(p->l_text, "%eval", 5) == 0 ) {
                 if (!check_eval(p->l_text + 5, vars))
                     break;
+            } else if (strncmp(p->l_text, "%dead", 5) == 0) {
+                /* Checked once the match is complete and all the
+                   variables are set */
+                if (ndead == MAXDEAD)
+                    error("error: too many %dead lines in pattern\n");
+                deadpat[ndead] = p->l_text + 5;
+                deadat[ndead++] = c->l_next;
             } else {
 //                fprintf(stderr, "Matching '%s', '%s'.\n",
 //                    c->l_text, p->l_text);
@@ -443,6 +1211,16 @@ struct lnode* opt(struct lnode* r)
         }
         if (p != 0)
             continue;
+        for (i = 0; i < ndead; i++)
+            if (!dead(deadpat[i], vars, deadat[i]))
+                break;
+        if (i < ndead)
+            continue;
+        if (o->o_cost && !worth(o, c, r, vars)) {
+            if (debug)
+                fputs("Not worth it\n", stderr);
+            continue;
+        }
 
         /* decrease firecount */
         --o->firecount;
@@ -452,7 +1230,7 @@ struct lnode* opt(struct lnode* r)
             struct lnode* tmp = o->o_new; /* delete the %once line */
             o->o_new = o->o_new->l_next;
             o->o_new->l_prev = 0;
-            free(tmp);
+            lfree(tmp);
             o->firecount = 0; /* never again */
         }
 
@@ -462,7 +1240,14 @@ struct lnode* opt(struct lnode* r)
             char signature[300];
             struct lnode* lnp;
             struct onode *nn, *last;
+            struct pool* was = cur;
             int skip = 0;
+            /* Activated rules outlive the input they came from so they
+               and the variables in the signature go in the rule pool */
+            cur = &perm;
+            for (i = 0; i < 10; i++)
+                if (vars[i])
+                    vars[i] = install(vars[i]);
             /* since we 'install()' strings, we can compare pointers */
             sprintf(signature, "%s%p%p%p%p%p%p%p%p%p%p\n",
                 activated,
@@ -476,8 +1261,10 @@ struct lnode* opt(struct lnode* r)
                 }
                 lnp = lnp->l_next;
             }
-            if (!lnp || skip)
+            if (!lnp || skip) {
+                cur = was;
                 continue;
+            }
             insert(install(signature), lnp);
 
             if (debug) {
@@ -497,7 +1284,11 @@ struct lnode* opt(struct lnode* r)
                     error("activate: out of memory\n");
                 nn->o_old = 0, nn->o_new = 0;
                 nn->firecount = MAXFIRECOUNT;
+                nn->o_cost = 0;
                 lnp = copylist(lnp, &nn->o_old, &nn->o_new, vars);
+                nn->o_key = rulekey(nn->o_old);
+                if (patlen(nn->o_old) > window)
+                    window = patlen(nn->o_old);
                 nn->o_next = last->o_next;
                 last->o_next = nn;
                 last = nn;
@@ -513,6 +1304,12 @@ struct lnode* opt(struct lnode* r)
             while (--lines && r->l_prev)
                 r = r->l_prev;
             global_again = 1; /* signalize changes */
+            /* r has moved so the index no longer applies. Try the rest
+               of the rules in order */
+            mkindex();
+            g = o->o_next;
+            linear = 1;
+            cur = was;
             continue;
         }
 
@@ -525,6 +1322,72 @@ struct lnode* opt(struct lnode* r)
     return r->l_next;
 }
 
+/* optimize - apply the rules to the lines between head and tail */
+void optimize(struct lnode* head, struct lnode* tail)
+{
+    struct lnode* p;
+    int pass = 0;
+
+    do {
+        ++pass;
+        if (debug)
+            fprintf(stderr, "\n--- pass %d ---\n", pass);
+        global_again = 0;
+        for (p = head->l_next; p != tail; p = opt(p))
+            ;
+    } while (global_again && pass < MAX_PASS);
+
+    if (global_again) {
+        fprintf(stderr, "error: maximum of %d passes exceeded\n", MAX_PASS);
+        error("       check for recursive substitutions");
+    }
+}
+
+/* flush - write out and unlink all but the last keep lines */
+void flush(struct lnode* head, struct lnode* tail, int keep)
+{
+    struct lnode *p, *e;
+
+    for (e = tail; keep-- && e->l_prev != head; e = e->l_prev)
+        ;
+    for (p = head->l_next; p != e; p = p->l_next)
+        fputs(p->l_text, stdout);
+    connect(head, e);
+}
+
+/* recycle - move the lines left after a flush to the other chunk pool */
+void recycle(struct lnode* head, struct lnode* tail)
+{
+    struct lnode *p, *n, *next;
+
+    cur = cur == &chunk[0] ? &chunk[1] : &chunk[0];
+    preset(cur);
+    for (p = head->l_next; p != tail; p = next) {
+        next = p->l_next;
+        n = newline();
+        n->l_text = install(p->l_text);
+        connect(p->l_prev, n);
+        connect(n, next);
+    }
+}
+
+/* getchunk - append lines from fp to the list up to a function boundary */
+int getchunk(FILE* fp, struct lnode* tail)
+{
+    char lin[MAXLINE];
+
+    while (fgets(lin, MAXLINE, fp) != NULL) {
+        insert(install(lin), tail);
+        /* C symbols are the only labels that start with an underscore.
+           Cut before each one so a chunk is at most one function or
+           data object. We keep the last 'window' lines around when
+           flushing so no rule can tell the difference */
+        if (*lin == '_')
+            return 1;
+    }
+    return 0;
+}
+
 /* #define _TESTING */
 
 /* main - peephole optimizer */
@@ -532,37 +1395,53 @@ int main(int argc, char** argv)
 {
     FILE* fp;
 
-    int i, pass;
-    struct lnode head, *p, tail;
+    int i, more;
+    struct lnode head, tail;
+    char* compile = 0;
 
     for (i = 1; i < argc; i++)
         if (strcasecmp(argv[i], "-D") == 0)
             debug = 1;
+        else if (strcasecmp(argv[i], "-s") == 0)
+            stream = 1;
+        else if (strcmp(argv[i], "-Os") == 0)
+            mode = 'S';
+        else if (strncmp(argv[i], "-O", 2) == 0)
+            mode = 'T';
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            compile = argv[++i];
         else if ((fp = fopen(argv[i], "r")) == NULL)
             error("copt: can't open patterns file\n");
         else
-            init(fp);
+            load(fp);
 
-    getlst(stdin, "", &head, &tail);
+    /* copt -c out rules... just compiles the rules */
+    if (compile) {
+        savebin(compile);
+        exit(0);
+    }
+    regsetup();
+    costsetup();
+    mkindex();
+    cur = &chunk[0];
 
     head.l_text = tail.l_text = "";
+    head.l_prev = tail.l_next = 0;
 
-    pass = 0;
-    do {
-        ++pass;
-        if (debug)
-            fprintf(stderr, "\n--- pass %d ---\n", pass);
-        global_again = 0;
-        for (p = head.l_next; p != &tail; p = opt(p))
-            ;
-    } while (global_again && pass < MAX_PASS);
-
-    if (global_again) {
-        fprintf(stderr, "error: maximum of %d passes exceeded\n", MAX_PASS);
-        error("       check for recursive substitutions");
+    if (stream == 0) {
+        getlst(stdin, "", &head, &tail);
+        optimize(&head, &tail);
+        flush(&head, &tail, 0);
+        exit(0);
     }
 
-    printlines(head.l_next, &tail, stdout);
+    connect(&head, &tail);
+    do {
+        more = getchunk(stdin, &tail);
+        optimize(&head, &tail);
+        flush(&head, &tail, more ? window : 0);
+        recycle(&head, &tail);
+    } while (more);
     exit(0);
     return 1; /* make compiler happy */
 }
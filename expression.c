@@ -148,6 +148,10 @@ struct node *function_call(register struct node *n)
 	type = func_return(n->type);
 	argt = func_args(n->type);
 
+	/* Record the call so we can tell if this function may be re-entered.
+	   A call through a pointer has no name */
+	note_call(n->op == T_NAME ? n->snum : 0);
+
 	if (!argt)
 		fatal("narg");
 	narg = *argt;
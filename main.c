@@ -62,6 +62,8 @@ int main(int argc, char *argv[])
 #endif
 	while (token != T_EOF)
 		toplevel();
+	/* Now we know who calls whom, decide which frames can be static */
+	static_frames();
 	/* No write out any uninitialized variables */
 	write_bss();
 	out_write();
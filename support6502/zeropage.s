@@ -1,8 +1,14 @@
 	.export sp
 	.export tmp
 	.export tmp1
+	.export reg
 
 	.zp
 sp:	.word	0
 tmp:	.word	0
 tmp1:	.word	0
+;
+;	Register variables. The compiler uses a word per register
+;	(NUM_ZPREG in target-6502.c)
+;
+reg:	.ds	8
@@ -22,6 +22,13 @@ __shrdeu:
 		mov	a,e
 		ani	15
 		rz		; no work to do
+		cpi	8
+		jc	shrbit
+		mov	l,h	; shift 8 bits in one go
+		mvi	h,0
+		sui	8
+		rz
+shrbit:
 		mov	e,a
 shrlp:
 		mov	a,h
@@ -39,6 +46,13 @@ __shrdeneg:
 		mov	a,e
 		ani	15
 		rz
+		cpi	8
+		jc	shrnbit
+		mov	l,h
+		mvi	h,255
+		sui	8
+		rz
+shrnbit:
 		mov	e,a
 shrnlp:
 		mov	a,h
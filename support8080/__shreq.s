@@ -24,6 +24,21 @@ __shreq:
 	push	b
 	mov	c,a
 
+	cpi	8
+	jc	nobyte
+
+	mov	e,d	; Shift 8 bits in one go
+	mvi	d,0
+	mov	a,e
+	ora	a
+	jp	pve
+	dcr	d
+pve:
+	mov	a,c
+	sui	8
+	jz	shdone
+	mov	c,a
+nobyte:
 	mov	a,d
 	ora	a
 	jm	sh1
@@ -28,8 +28,8 @@ __shrequ:
 	mvi	d,0
 
 	sui	8
+	jz	store
 nobyte:
-	rz
 	push	b
 	mov	c,a
 shuffle:
@@ -43,12 +43,11 @@ shuffle:
 
 	dcr	c
 	jnz	shuffle
-
+	pop	b	; Recover B
+store:
 	mov	m,d	; Store back into HL
 	dcx	h
 	mov	m,e
-
-	pop	b	; Recover B
 nowork:
 	xchg		; Value is the return
 	ret
@@ -0,0 +1,18 @@
+;
+;	Return from a function using the register calling convention that
+;	has more arguments than are worth popping inline. DE is the number
+;	of bytes of arguments, HL (and hireg) the return value.
+;
+		.export __cleanup
+		.setcpu 8080
+		.code
+
+__cleanup:
+	xthl			; return value on the stack
+	shld	__retaddr
+	pop	h
+	xchg			; HL = bytes to drop, DE = return value
+	dad	sp
+	sphl
+	xchg
+	jmp	__ret
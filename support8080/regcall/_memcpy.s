@@ -0,0 +1,42 @@
+;
+;	memcpy (register call)
+;
+		.export _memcpy
+		.setcpu 8080
+		.code
+_memcpy:
+	xchg		; DE = first argument
+	pop	h	; return address
+	xthl		; HL = second argument, return address back
+	push	h
+	lxi	h,4
+	dad	sp
+	mov	a,m	; swap BC with the third argument so that
+	mov	m,c	; its stack slot holds the saved BC
+	mov	c,a
+	inx	h
+	mov	a,m
+	mov	m,b
+	mov	b,a
+	pop	h
+	xchg		; HL = destination, DE = source, BC = count
+
+	push	h	; return the destination
+	mov	a,c
+	ora	b
+	jz	done
+loop:
+	ldax	d
+	inx	d
+	mov	m,a
+	inx	h
+	dcx	b
+	mov	a,b
+	ora	c
+	jnz	loop
+done:
+	pop	h
+	pop	d
+	pop	b	; recover BC and drop the argument
+	push	d
+	ret
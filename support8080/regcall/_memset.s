@@ -0,0 +1,41 @@
+;
+;	Memset (register call)
+;
+		.export _memset
+		.setcpu 8080
+		.code
+_memset:
+	xchg		; DE = first argument
+	pop	h	; return address
+	xthl		; HL = second argument, return address back
+	push	h
+	lxi	h,4
+	dad	sp
+	mov	a,m	; swap BC with the third argument so that
+	mov	m,c	; its stack slot holds the saved BC
+	mov	c,a
+	inx	h
+	mov	a,m
+	mov	m,b
+	mov	b,a
+	pop	h
+	; DE is the pointer, L the fill byte, BC the length
+	push	d		; Return is the passed pointer
+	mov	a,l
+	xchg			; now have HL as the pointer and E as the fill byte
+	mov	e,a
+	jmp	loopin
+
+loop:
+	mov	m,e
+	inx	h
+	dcx	b
+loopin:
+	mov	a,b
+	ora	c
+	jnz	loop
+	pop	h		; Address passed in
+	pop	d
+	pop	b	; recover BC and drop the argument
+	push	d
+	ret
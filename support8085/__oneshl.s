@@ -0,0 +1,67 @@
+;
+;	1 << n and x & (1 << n) by table rather than a shift loop
+;
+		.export __oneshl
+		.export __bitand
+		.export __bitandde
+		.setcpu 8085
+		.code
+
+; HL = 1 << (L & 15)
+__oneshl:
+		mov	a,l
+		mov	h,a
+		call	bitmask
+		mov	l,a
+		mov	a,h
+		ani	8
+		mvi	h,0
+		rz
+		mov	h,l
+		mvi	l,0
+		ret
+
+; TOS & (1 << HL)
+__bitand:
+		xchg
+		pop	h
+		xthl
+; HL &= 1 << (E & 15)
+__bitandde:
+		mov	a,e
+		ani	8
+		mov	a,e
+		jnz	bithigh
+		call	bitmask
+		ana	l
+		mov	l,a
+		mvi	h,0
+		ret
+bithigh:
+		call	bitmask
+		ana	h
+		mov	h,a
+		mvi	l,0
+		ret
+
+; A = 1 << (A & 7), uses DE
+bitmask:
+		ani	7
+		lxi	d,bittab
+		add	e
+		mov	e,a
+		jnc	bitm1
+		inr	d
+bitm1:
+		ldax	d
+		ret
+
+bittab:
+		.byte	1
+		.byte	2
+		.byte	4
+		.byte	8
+		.byte	16
+		.byte	32
+		.byte	64
+		.byte	128
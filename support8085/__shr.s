@@ -8,12 +8,4 @@ __shr:
 		xchg
 		pop	h
 		xthl
-		mov	a,e
-		ani	15
-		rz
-shift1:
-		arhl
-		dcr	e
-		jnz	shift1
-		ret
-
+		jmp	__shrde
@@ -18,6 +18,17 @@ __shrde:
 		mov	a,e
 		ani	15
 		rz		; no work to do
+		cpi	8
+		jc	shrpl
+		mov	d,a	; save count
+		mov	l,h	; shift 8 bits in one go
+		mov	a,h
+		ral
+		sbb	a	; and sign extend
+		mov	h,a
+		mov	a,d	; restore count
+		sui	8
+		rz
 shrpl:
 		arhl
 shnext:
@@ -32,6 +43,14 @@ shrneg:
 		mov	a,e
 		ani	15
 		rz		; no work to do
+		cpi	8
+		jc	shrnbit
+		mov	l,h	; shift 8 bits in one go, now positive
+		mvi	h,0
+		sui	8
+		rz
+		jmp	shrpl
+shrnbit:
 		arhl
 		mov	d,a	; save count
 		mov	a,h
@@ -19,14 +19,26 @@ __shreq:
 	ani	15
 	rz
 
-	rz
 	push	b
 	mov	c,a
+
+	cpi	8
+	jc	shuffle
+
+	mov	l,h	; Shift 8 bits in one go
+	mov	a,h
+	ral
+	sbb	a	; and sign extend
+	mov	h,a
+	mov	a,c
+	sui	8
+	jz	shdone
+	mov	c,a
 shuffle:
 	arhl
 	dcr	c
 	jnz	shuffle
-
+shdone:
 	pop	b
 	shlx
 	ret
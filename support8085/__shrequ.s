@@ -26,8 +26,8 @@ __shrequ:
 	mvi	h,0
 
 	sui	8
+	jz	store
 nobyte:
-	rz
 	push	b
 	mov	c,a
 shuffle:
@@ -43,5 +43,6 @@ shuffle:
 	jnz	shuffle
 
 	pop	b
+store:
 	shlx
 	ret
@@ -0,0 +1,10 @@
+;
+;	Call via a pointer when HL holds the first argument
+;
+		.export __callde
+		.setcpu 8085
+		.code
+
+__callde:
+	push	d
+	ret
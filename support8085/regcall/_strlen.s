@@ -0,0 +1,17 @@
+;
+;	strlen (register call)
+;
+		.export _strlen
+		.setcpu 8080
+		.code
+
+_strlen:
+	xchg
+	lxi	h,0
+loop:
+	ldax	d
+	inx	d
+	ora	a
+	rz
+	inx	h
+	jmp	loop
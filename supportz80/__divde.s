@@ -28,7 +28,9 @@ __divde:
 
 		ld	a,c
 		rra
-		call	c,negate
+		jr	nc,divpos
+		call	negate
+divpos:
 		pop	bc
 		ret
 
@@ -52,7 +54,9 @@ __remde:
 
 		ld	a,c
 		rra
-		call	c,negate
+		jr	nc,rempos
+		call	negate
+rempos:
 		pop	bc
 		ret
 
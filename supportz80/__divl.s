@@ -159,7 +159,9 @@ smaller:			; 3f
 		ld	a,b
 		rra
 		ld	hl,__tmp2	; complement quotient if divisor
-		call	c,compl		; and dividend have different signs
+		jr	nc,quopos	; and dividend have different signs
+		call	compl
+quopos:
 		ld	hl,(__tmp2+2)	; quotient high
 		ld	(__hireg),hl		; into hireg
 		ld	hl,(__tmp2)
@@ -171,7 +173,9 @@ remainder:
 		ld	a,b
 		add	a,a
 		ld 	hl,__tmp3
-		call	c,compl		; negate remainder if dividend was negative
+		jr	nc,rempos	; negate remainder if dividend was negative
+		call	compl
+rempos:
 		ld	hl,(__tmp3+2)
 		ld	(__hireg),hl
 		ld	hl,(__tmp3)
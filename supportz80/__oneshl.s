@@ -0,0 +1,64 @@
+;
+;	1 << n and x & (1 << n) by table rather than a shift loop
+;
+		.export __oneshl
+		.export __bitand
+		.export __bitandde
+		.code
+
+; HL = 1 << (L & 15)
+__oneshl:
+		ld	a,l
+		ld	h,a
+		call	bitmask
+		bit	3,h
+		ld	l,a
+		ld	h,0
+		ret	z
+		ld	h,l
+		ld	l,0
+		ret
+
+; TOS & (1 << HL)
+__bitand:
+		ex	de,hl
+		pop	hl
+		ex	(sp),hl
+; HL &= 1 << (E & 15)
+__bitandde:
+		ld	a,e
+		bit	3,a
+		jr	nz,bithigh
+		call	bitmask
+		and	l
+		ld	l,a
+		ld	h,0
+		ret
+bithigh:
+		call	bitmask
+		and	h
+		ld	h,a
+		ld	l,0
+		ret
+
+; A = 1 << (A & 7), uses DE
+bitmask:
+		and	7
+		ld	de,bittab
+		add	a,e
+		ld	e,a
+		jr	nc,bitm1
+		inc	d
+bitm1:
+		ld	a,(de)
+		ret
+
+bittab:
+		.byte	1
+		.byte	2
+		.byte	4
+		.byte	8
+		.byte	16
+		.byte	32
+		.byte	64
+		.byte	128
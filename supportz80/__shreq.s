@@ -18,8 +18,20 @@ __shreq:
 
 		; No work to do
 		and	15
-		ret	z
+		jr	z,done
 
+		cp	8
+		jr	c,nobyte
+
+		ld	e,d		; Shift 8 bits in one go
+		ld	d,0
+		bit	7,e
+		jr	z,pve
+		dec	d
+pve:
+		sub	8
+		jr	z,store
+nobyte:
 		push	bc
 		ld	b,a
 
@@ -27,10 +39,11 @@ shuffle:
 		sra	d
 		rr	e
 		djnz	shuffle
-shdone:
 		pop	bc
+store:
 		ld	(hl),d
 		dec	hl
 		ld	(hl),e
+done:
 		ex	de,hl
 		ret
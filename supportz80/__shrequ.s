@@ -18,7 +18,7 @@ __shrequ:
 
 		; No work to do
 		and	15
-		ret	z
+		jr	z,done
 
 		cp	8
 		jr	c,nobyte
@@ -27,18 +27,19 @@ __shrequ:
 		ld	d,0
 
 		sub	8
+		jr	z,store
 nobyte:
-		ret	z
 		push	bc
 		ld	b,a
 shuffle:
 		srl	d
 		rr	e
 		djnz	shuffle
-
+		pop	bc
+store:
 		ld	(hl),d
 		dec	hl
 		ld	(hl),e
-
-		pop	bc
+done:
+		ex	de,hl
 		ret
@@ -0,0 +1,22 @@
+;
+;	strlen (Rabbit has no cpir)
+;
+		.export _strlen
+		.code
+
+_strlen:
+		pop	de
+		pop	hl
+		push	hl
+		push	de
+		ld	de,0
+strlenl:
+		ld	a,(hl)
+		or	a
+		jr	z,strlend
+		inc	hl
+		inc	de
+		jr	strlenl
+strlend:
+		ex	de,hl
+		ret
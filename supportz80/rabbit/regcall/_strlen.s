@@ -0,0 +1,18 @@
+;
+;	strlen (register call, Rabbit has no cpir)
+;
+		.export _strlen
+		.code
+
+_strlen:
+		ld	de,0
+strlenl:
+		ld	a,(hl)
+		or	a
+		jr	z,strlend
+		inc	hl
+		inc	de
+		jr	strlenl
+strlend:
+		ex	de,hl
+		ret
@@ -0,0 +1,9 @@
+;
+;	Call via a pointer when HL holds the first argument
+;
+		.export __callde
+		.code
+
+__callde:
+		push	de
+		ret
@@ -0,0 +1,17 @@
+;
+;	Return from a function using the register calling convention that
+;	has more arguments than are worth popping inline. DE is the number
+;	of bytes of arguments, HL (and hireg) the return value.
+;
+		.export __cleanup
+		.code
+
+__cleanup:
+		ex	(sp),hl		; return value on the stack
+		ld	(__retaddr),hl
+		pop	hl
+		ex	de,hl		; HL = bytes to drop, DE = return value
+		add	hl,sp
+		ld	sp,hl
+		ex	de,hl
+		jp	__ret
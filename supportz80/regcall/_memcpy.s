@@ -0,0 +1,32 @@
+;
+;	memcpy (register call)
+;
+		.export _memcpy
+		.code
+_memcpy:
+		ex	de,hl	; DE = first argument
+		pop	hl	; return address
+		ex	(sp),hl	; HL = second argument, return address back
+		push	hl
+		ld	hl,4
+		add	hl,sp
+		ld	a,(hl)	; swap BC with the third argument so that
+		ld	(hl),c	; its stack slot holds the saved BC
+		ld	c,a
+		inc	hl
+		ld	a,(hl)
+		ld	(hl),b
+		ld	b,a
+		pop	hl
+		; DE is the destination, HL the source, BC the count
+		push	de	; return the destination
+		ld	a,b
+		or	c
+		jr	z,done
+		ldir
+done:
+		pop	hl
+		pop	de
+		pop	bc	; recover BC and drop the argument
+		push	de
+		ret
@@ -0,0 +1,40 @@
+;
+;	Memset (register call)
+;
+		.export _memset
+		.code
+_memset:
+		ex	de,hl	; DE = first argument
+		pop	hl	; return address
+		ex	(sp),hl	; HL = second argument, return address back
+		push	hl
+		ld	hl,4
+		add	hl,sp
+		ld	a,(hl)	; swap BC with the third argument so that
+		ld	(hl),c	; its stack slot holds the saved BC
+		ld	c,a
+		inc	hl
+		ld	a,(hl)
+		ld	(hl),b
+		ld	b,a
+		pop	hl
+		; DE is the pointer, L the fill byte, BC the length
+		push	de		; Return is the passed pointer
+		ld	a,l
+		ex	de,hl		; now have HL as the pointer and E as the fill byte
+		ld	e,a
+		jp	loopin
+
+loop:
+		ld	(hl),e
+		inc	hl
+		dec	bc
+loopin:
+		ld	a,b
+		or	c
+		jr	nz,loop
+		pop	hl		; Address passed in
+		pop	de
+		pop	bc	; recover BC and drop the argument
+		push	de
+		ret
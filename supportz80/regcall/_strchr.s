@@ -0,0 +1,24 @@
+;
+;	String scan for C (register call)
+;
+		.export _strchr
+
+_strchr:
+	pop	de	; return address
+	ex	(sp),hl	; string on the stack, HL is the symbol we want
+	ld	a,l
+	pop	hl	; string
+	push	de
+	ld	e,a
+
+next:
+	ld	a,(hl)
+	or	a
+	jr	z, end
+	cp	e
+	ret	z		; HL points to match
+	inc	hl
+	jp	next
+end:
+	ld	hl,0
+	ret
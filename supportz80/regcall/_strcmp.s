@@ -0,0 +1,28 @@
+;
+;	strcmp (register call)
+;
+		.export _strcmp
+		.code
+_strcmp:
+		pop	de	; return address
+		ex	(sp),hl	; HL = source 2, source 1 on the stack
+		ex	de,hl
+		ex	(sp),hl	; HL = source 1, return address back
+
+next:
+		ld	a,(de)		; get src 2
+		cp	(hl)		; check v src 1
+		jr	nz, mismatch	; and C if src2 < src1
+
+		or	a		; matched end of string ?
+		jr	z, ret0
+		inc	de
+		inc	hl
+		jr	next
+mismatch:
+		ld	hl,1
+		ret	c
+		ld	hl,-1
+		ret
+ret0:		ld	hl,0
+		ret
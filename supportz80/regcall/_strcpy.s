@@ -0,0 +1,24 @@
+;
+;	String copy for C (register call)
+;
+		.export _strcpy
+
+_strcpy:
+	pop	de	; return address
+	ex	(sp),hl	; HL = source, destination on the stack
+	ex	de,hl
+	ex	(sp),hl	; HL = destination, return address back
+	push	hl
+	ex	de,hl	; HL = source, DE = destination
+
+	; copy from HL to DE, return current DE
+copy:
+	ld	a,(hl)
+	ld	(de),a
+	inc	hl
+	inc	de
+	or	a
+	jr	nz, copy
+
+	pop	hl
+	ret
@@ -0,0 +1,56 @@
+;
+;	String cat for C (register call)
+;
+		.export _strlcat
+
+_strlcat:
+		ex	de,hl	; DE = first argument
+		pop	hl	; return address
+		ex	(sp),hl	; HL = second argument, return address back
+		push	hl
+		ld	hl,4
+		add	hl,sp
+		ld	a,(hl)	; swap BC with the third argument so that
+		ld	(hl),c	; its stack slot holds the saved BC
+		ld	c,a
+		inc	hl
+		ld	a,(hl)
+		ld	(hl),b
+		ld	b,a
+		pop	hl
+		ex	de,hl	; HL = destination, DE = source, BC = limit
+
+		; copy from DE to HL limit length BC
+		push	bc	; limit size - needed for return value
+find:
+		ld	a,(hl)
+		or	a
+		jr	z, copy
+		inc	hl
+		dec	bc
+		ld	a,b
+		or	c
+		jr	nz, find
+		pop	hl	; All space used so return length given
+		jr	out
+copy:
+		ld	a,(de)
+		ld	(hl),a
+		inc	hl
+		inc	de
+		or	a
+		jr	z, done
+		dec	bc
+		ld	a,b
+		or	c
+		jr	nz, copy
+done:
+		; Hit the end
+		pop	hl
+		or	a
+		sbc	hl,bc
+out:
+		pop	de
+		pop	bc	; recover BC and drop the argument
+		push	de
+		ret
@@ -0,0 +1,16 @@
+;
+;	strlen (register call)
+;
+		.export _strlen
+		.code
+
+_strlen:
+		push	bc
+		xor	a
+		ld	b,a
+		ld	c,a
+		cpir
+		ld	hl,-1
+		sbc	hl,bc	; C is always clear here
+		pop	bc
+		ret
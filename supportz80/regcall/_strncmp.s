@@ -0,0 +1,48 @@
+;
+;	strncmp (register call)
+;
+		.export _strncmp
+		.code
+_strncmp:
+		ex	de,hl	; DE = first argument
+		pop	hl	; return address
+		ex	(sp),hl	; HL = second argument, return address back
+		push	hl
+		ld	hl,4
+		add	hl,sp
+		ld	a,(hl)	; swap BC with the third argument so that
+		ld	(hl),c	; its stack slot holds the saved BC
+		ld	c,a
+		inc	hl
+		ld	a,(hl)
+		ld	(hl),b
+		ld	b,a
+		pop	hl
+		ex	de,hl	; HL = source 1, DE = source 2, BC = count
+
+next:
+		ld	a,b
+		or	c
+		jr	z,ret0
+
+		ld	a,(de)		; get src 2
+		cp	(hl)		; check v src 1
+		jr	nz, mismatch	; and C if src2 < src1
+
+		or	a		; matched end of string ?
+		jr	z, ret0
+		inc	de
+		inc	hl
+		dec	bc
+		jr	next
+mismatch:
+		ld	hl,1
+		jr	c, out
+		ld	hl,-1
+		jr	out
+ret0:		ld	hl,0
+out:
+		pop	de
+		pop	bc	; recover BC and drop the argument
+		push	de
+		ret
@@ -0,0 +1,33 @@
+;
+;	String scan for C (register call)
+;
+		.export _strrchr
+
+_strrchr:
+	pop	de	; return address
+	ex	(sp),hl	; string on the stack, HL is the symbol we want
+	ld	a,l
+	pop	hl	; string
+	push	de
+	ld	e,a
+	push	bc
+	ld	bc,0	; Return NULL by default
+
+next:
+	ld	a,(hl)
+	or	a
+	jr	z, end
+	cp	e
+	jr	nz, nomatch
+	; Save the match
+	ld	b,h
+	ld	c,l
+	; Keep scanning as we want the right most
+nomatch:
+	inc	hl
+	jp	next
+end:
+	ld	l,c
+	ld	h,b
+	pop	bc
+	ret
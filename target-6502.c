@@ -77,11 +77,29 @@ unsigned target_type_remap(unsigned type)
 	return type;
 }
 
+/*
+ *	Register variables live in a block of zero page (reg in zeropage.s)
+ *	with a word per register. The called function saves any it uses.
+ */
+#define NUM_ZPREG	4
+
+static unsigned zpreg_next;
+
 unsigned target_register(unsigned type, unsigned storage)
 {
-	return 0;
+	if (type >= CLONG && !PTR(type))
+		return 0;
+	if (zpreg_next > NUM_ZPREG)
+		return 0;
+	/* Tell the backend what is allocated */
+	if (storage == S_AUTO)
+		func_flags |= F_REG(zpreg_next);
+	else
+		arg_flags |= F_REG(zpreg_next);
+	return zpreg_next++;
 }
 
 void target_reginit(void)
 {
+	zpreg_next = 1;
 }
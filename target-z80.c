@@ -86,6 +86,7 @@ unsigned target_type_remap(unsigned type)
 static unsigned bc_free;
 static unsigned ix_free;
 static unsigned iy_free;
+static unsigned alt_free;	/* Alternate registers free (4-6) */
 
 static unsigned ralloc(unsigned storage, unsigned n)
 {
@@ -113,12 +114,13 @@ unsigned target_register(unsigned type, unsigned storage)
 		}
 	}
 	/* BC is good for 8 and 16 bit maths or byte pointers, but prefer ix/iy for pointers */
-	if (bc_free == 0)
-		return 0;
-	if (PTR(type) == 0 || (PTR(type) == 1 && type < CSHORT)) {
+	if (bc_free && (PTR(type) == 0 || (PTR(type) == 1 && type < CSHORT))) {
 		bc_free = 0;
 		return ralloc(storage, 1);
 	}
+	/* Once BC is gone integer locals can live in hl' de' and bc' */
+	if (alt_free && alt_free < 7 && PTR(type) == 0 && storage == S_AUTO)
+		return ralloc(storage, alt_free++);
 	return 0;
 }
 
@@ -129,4 +131,8 @@ void target_reginit(void)
 		ix_free = 1;
 	if (!(cpufeat & 4))	/* --no-iy */
 		iy_free = 1;
+	if (cpufeat & 16)	/* -mz80-exx */
+		alt_free = 4;
+	else
+		alt_free = 0;
 }
@@ -14,6 +14,9 @@
 static uint8_t ram[65536];
 static Z80Context cpu_z80;
 static unsigned trace;
+static unsigned ez80;		/* Run the eZ80 (Z80 mode) extra instructions */
+static unsigned cycles;		/* Report the clocks used at exit */
+static unsigned long tstates;
 
 static uint8_t mem_read(int unused, uint16_t addr)
 {
@@ -43,6 +46,8 @@ static void io_write(int unused, uint16_t port, uint8_t value)
     case 0xFF:
         if (value)
             fprintf(stderr, "***FAIL %d\n", value);
+        if (cycles)
+            fprintf(stderr, "%lu cycles\n", tstates + cpu_z80.tstates);
         exit(value);
     default:
         fprintf(stderr, "***BAD PORT %d\n", port);
@@ -90,17 +95,126 @@ static void z80_trace(unsigned unused)
 		cpu_z80.R1.wr.IX, cpu_z80.R1.wr.IY, cpu_z80.R1.wr.SP);
 }
 
+/*
+ *	The eZ80 in Z80 mode adds 16bit loads and stores via (HL) and
+ *	(IX/IY + d) along with LEA and PEA. These sit in holes in the Z80
+ *	opcode map so we run them here before the Z80 core sees them. The
+ *	timings are Z80 style estimates so the totals stay comparable.
+ */
+
+static uint16_t *ez80_pair(uint8_t op)
+{
+    switch(op & 0xF0) {
+    case 0x00:
+        return &cpu_z80.R1.wr.BC;
+    case 0x10:
+        return &cpu_z80.R1.wr.DE;
+    case 0x20:
+        return &cpu_z80.R1.wr.HL;
+    }
+    return NULL;
+}
+
+static uint16_t ez80_read16(uint16_t addr)
+{
+    return mem_read(0, addr) | (mem_read(0, addr + 1) << 8);
+}
+
+static void ez80_write16(uint16_t addr, uint16_t val)
+{
+    mem_write(0, addr, val);
+    mem_write(0, addr + 1, val >> 8);
+}
+
+static unsigned ez80_op(void)
+{
+    uint16_t pc = cpu_z80.PC;
+    uint8_t p = mem_read(0, pc);
+    uint8_t op = mem_read(0, pc + 1);
+    uint16_t *rp = ez80_pair(op);
+    uint16_t *ip;
+    uint16_t addr;
+    int8_t d = mem_read(0, pc + 2);
+
+    if (p == 0xED) {
+        switch(op) {
+        case 0x07: case 0x17: case 0x27:	/* ld rr,(hl) */
+            *rp = ez80_read16(cpu_z80.R1.wr.HL);
+            cpu_z80.tstates += 14;
+            cpu_z80.PC += 2;
+            return 1;
+        case 0x0F: case 0x1F: case 0x2F:	/* ld (hl),rr */
+            ez80_write16(cpu_z80.R1.wr.HL, *rp);
+            cpu_z80.tstates += 14;
+            cpu_z80.PC += 2;
+            return 1;
+        case 0x02: case 0x12: case 0x22:	/* lea rr,ix+d */
+            *rp = cpu_z80.R1.wr.IX + d;
+            cpu_z80.tstates += 16;
+            cpu_z80.PC += 3;
+            return 1;
+        case 0x03: case 0x13: case 0x23:	/* lea rr,iy+d */
+            *rp = cpu_z80.R1.wr.IY + d;
+            cpu_z80.tstates += 16;
+            cpu_z80.PC += 3;
+            return 1;
+        case 0x65:				/* pea ix+d */
+        case 0x66:				/* pea iy+d */
+            addr = (op == 0x65 ? cpu_z80.R1.wr.IX : cpu_z80.R1.wr.IY) + d;
+            cpu_z80.R1.wr.SP -= 2;
+            ez80_write16(cpu_z80.R1.wr.SP, addr);
+            cpu_z80.tstates += 22;
+            cpu_z80.PC += 3;
+            return 1;
+        }
+        return 0;
+    }
+    if (p != 0xDD && p != 0xFD)
+        return 0;
+    ip = p == 0xDD ? &cpu_z80.R1.wr.IX : &cpu_z80.R1.wr.IY;
+    addr = *ip + d;
+    switch(op) {
+    case 0x07: case 0x17: case 0x27:		/* ld rr,(ix/iy + d) */
+        *rp = ez80_read16(addr);
+        break;
+    case 0x0F: case 0x1F: case 0x2F:		/* ld (ix/iy + d),rr */
+        ez80_write16(addr, *rp);
+        break;
+    default:
+        return 0;
+    }
+    cpu_z80.tstates += 22;
+    cpu_z80.PC += 3;
+    return 1;
+}
+
+static void z80_step(void)
+{
+    if (ez80 && ez80_op()) {
+        if (trace)
+            fprintf(stderr, "%04X: eZ80 op\n", cpu_z80.PC);
+        return;
+    }
+    Z80Execute(&cpu_z80);
+}
 
 int main(int argc, char *argv[])
 {
     int fd;
-    if (argc == 4 && strcmp(argv[1], "-d") == 0) {
+    while (argc > 3 && *argv[1] == '-') {
+        if (strcmp(argv[1], "-d") == 0)
+            trace = 1;
+        else if (strcmp(argv[1], "-e") == 0)
+            ez80 = 1;
+        else if (strcmp(argv[1], "-c") == 0)
+            cycles = 1;
+        else
+            break;
         argv++;
         argc--;
-        trace = 1;
     }
     if (argc != 3) {
-        fprintf(stderr, "emu85: test map.\n");
+        fprintf(stderr, "emuz80: [-d] [-e] [-c] test map.\n");
         exit(1);
     }
     fd = open(argv[1], O_RDONLY);
@@ -121,6 +235,10 @@ int main(int argc, char *argv[])
     cpu_z80.memWrite = mem_write;
     cpu_z80.trace = z80_trace;
 
-    while(1)
-        Z80ExecuteTStates(&cpu_z80, 1000);
+    while(1) {
+        cpu_z80.tstates = 0;
+        while (cpu_z80.tstates < 1000)
+            z80_step();
+        tstates += cpu_z80.tstates;
+    }
 }
@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+#	Check copt loads compiled rule sets, including an empty one
+#
+T=/tmp/copt.$$
+fail=0
+
+: > $T.rules
+printf '\tld a,b\n\tld b,a\n=\n\tld a,b\n' > $T.one
+printf '\tnop\n\tld a,b\n\tld b,a\n' > $T.in
+
+for r in $T.rules $T.one
+do
+	../copt -c $r.bin $r || fail=1
+	../copt $r < $T.in > $T.text || fail=1
+	../copt $r.bin < $T.in > $T.bin || fail=1
+	cmp -s $T.text $T.bin || fail=1
+done
+# The empty set leaves the input alone, the other removes the reload
+cmp -s $T.in $T.text && fail=1
+../copt $T.rules.bin < $T.in | cmp -s - $T.in || fail=1
+
+rm -f $T.*
+if [ $fail = 1 ]; then
+	echo "copt: FAIL"
+	exit 1
+fi
+echo "copt: ok"
@@ -34,6 +34,50 @@ unsigned xoreq(unsigned a, unsigned b)
     return a ^= b;
 }
 
+unsigned char flags;
+
+/* Single bit set, clear and test on bytes in memory */
+unsigned bytebits(unsigned char *p)
+{
+    unsigned char c = 0x0F;
+    unsigned n = 0;
+
+    flags |= 0x40;
+    flags &= ~0x01;
+    flags ^= 0x80;
+    p[1] |= 0x10;
+    *p &= ~0x02;
+    c &= ~0x04;
+    if (flags & 0x40)
+        n++;
+    if (!(flags & 0x01))
+        n += 2;
+    if (p[1] & 0x10)
+        n += 4;
+    if (*p & 0x02)
+        n += 8;
+    if (c & 0x04)
+        n += 16;
+    if ((c & 0x08) && !(*p & 0x04))
+        n += 32;
+    return n;
+}
+
+unsigned w;
+
+/* Logic ops that only change one byte of a word */
+unsigned wordbits(void)
+{
+    w |= 0x0100;
+    w &= ~0x0004;
+    w ^= 0x8000;
+    if (w & 0x0200)
+        return 1;
+    if (!(w & 0x0100))
+        return 2;
+    return w;
+}
+
 int main(int argc, char *argv[])
 {
     if (and(4, 5) != 4)
@@ -50,5 +94,19 @@ int main(int argc, char *argv[])
         return 6;
     if (oreq(0x55, 0xAA) != 0xFF)
         return 7;
+    {
+        unsigned char b[2];
+        b[0] = 0x03;
+        b[1] = 0;
+        flags = 0x81;
+        /* 1 + 2 + 4 + 32 */
+        if (bytebits(b) != 39)
+            return 8;
+        if (flags != 0x40 || b[0] != 0x01 || b[1] != 0x10)
+            return 9;
+    }
+    w = 0x0006;
+    if (wordbits() != 0x8102)
+        return 10;
     return 0;
 }
\ No newline at end of file
@@ -25,6 +25,16 @@ int rshifts(int x, unsigned y)
     return x >> y;
 }
 
+int onebit(unsigned y)
+{
+    return 1 << y;
+}
+
+int testbit(unsigned x, unsigned y)
+{
+    return x & (1 << y);
+}
+
 unsigned uint;
 int sint;
 unsigned char uchr;
@@ -76,6 +86,30 @@ int main(int argc, char *argv[])
     uchr >>= 4;
     if (uchr != 0x0C)
         return 15;
+    if (onebit(0) != 1)
+        return 20;
+    if (onebit(9) != 0x200)
+        return 21;
+    if (onebit(15) != 0x8000)
+        return 22;
+    if (testbit(0x8421, 10) != 0x400)
+        return 23;
+    if (testbit(0x8421, 11) != 0)
+        return 24;
+    if (testbit(0x8421, 0) != 1)
+        return 25;
+    if (rshifts(0x8000, 8) != 0xFF80)
+        return 26;
+    if (rshiftu(0x8000, 9) != 0x40)
+        return 27;
+    sint = 0x8000;
+    sint >>= 9;
+    if (sint != 0xFFC0)
+        return 28;
+    uint = 0x8000;
+    uint >>= 8;
+    if (uint != 0x80)
+        return 29;
     return 0;
 
     sint = 4;
@@ -1,6 +1,19 @@
-
 unsigned int x[6] = { 11, 335, 4481, -22, 86, 5 };
 
+char area[512];
+unsigned base;
+
+/* The low byte of the address is set just before the byte load */
+int pageload(void)
+{
+    return *(char *)(base & 0xFF00);
+}
+
+int pageshift(unsigned n)
+{
+    return *(char *)(n << 8);
+}
+
 int main(int argc, char *argv[])
 {
     unsigned int *p = x;
@@ -16,5 +29,9 @@ int main(int argc, char *argv[])
         n += *p++;
     if (n != 4918)
         return 2;
+    base = (unsigned)area + 255;
+    area[(base & 0xFF00) - (unsigned)area] = 42;
+    if (pageload() != 42 || pageshift(base >> 8) != 42)
+        return 3;
     return 0;
 }
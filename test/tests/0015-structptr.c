@@ -0,0 +1,75 @@
+/*
+ *	Structure access via pointers
+ */
+
+struct s {
+    int a;
+    long l;
+    char c;
+    int d;
+};
+
+struct s g;
+struct s *gp;
+int x, y, z;
+
+int sum(struct s *p)
+{
+    return p->a + p->d;
+}
+
+int copy(struct s *p, int *a, int i)
+{
+    p->a = p->d - p->a;
+    a[i] = a[i] + 1;
+    return p->c + p->a;
+}
+
+int update(struct s *p, int v)
+{
+    p->d++;
+    p->a -= v;
+    p->c += 5;
+    p->d -= 7;
+    p->a |= v;
+    return p->d++ + gp->a--;
+}
+
+int main(int argc, char *argv[])
+{
+    struct s t;
+
+    gp = &g;
+    gp->a = 1;
+    gp->l = 0x10002L;
+    gp->c = 3;
+    gp->d = 0;
+    if (g.a != 1 || g.l != 0x10002L || g.c != 3 || g.d)
+        return 1;
+    gp->d = 2;
+    if (sum(gp) != 3)
+        return 2;
+    t.a = 12;
+    t.l = 0;
+    t.c = 250;
+    t.d = 10;
+    /* d 11 -> 4, a 12 - 3 = 9 | 3 = 11, c wraps to 255 */
+    if (update(&t, 3) != 5)
+        return 3;
+    if (t.a != 11 || t.d != 5 || (unsigned char)t.c != 255)
+        return 4;
+    if (g.a != 0)
+        return 5;
+    t.a = 3;
+    t.c = 4;
+    t.d = 10;
+    z = 7;
+    /* a 10 - 3 = 7, z 8 */
+    if (copy(&t, &z, 0) != 11 || t.a != 7 || z != 8)
+        return 6;
+    x = 1;
+    z = 5;
+    if (x + (y = z) != 6 || y != 5)
+        return 7;
+    return 0;
+}
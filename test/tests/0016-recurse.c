@@ -0,0 +1,98 @@
+/*
+ *	Functions that call each other, directly or through a pointer. Their
+ *	locals must survive the inner calls
+ */
+
+int odd(int n);
+
+int even(int n)
+{
+    int k = n;
+    int r;
+
+    if (n == 0)
+        return 1;
+    r = odd(n - 1);
+    if (k != n)
+        return 100;
+    return r;
+}
+
+int odd(int n)
+{
+    int k = n;
+    int r;
+
+    if (n == 0)
+        return 0;
+    r = even(n - 1);
+    if (k != n)
+        return 100;
+    return r;
+}
+
+int third(int n);
+
+int first(int n)
+{
+    int k = n * 2;
+
+    if (n > 0)
+        third(n - 1);
+    return k - n;
+}
+
+int second(int n)
+{
+    int k = n + 1;
+
+    first(n);
+    return k;
+}
+
+int third(int n)
+{
+    int k = n;
+
+    second(n);
+    return k;
+}
+
+int walk(int (*fp)(int), int n)
+{
+    return fp(n);
+}
+
+int down(int n)
+{
+    int k = n;
+
+    if (n)
+        walk(down, n - 1);
+    return k;
+}
+
+int sum(int a, int b)
+{
+    int t = a;
+
+    t += b;
+    return t;
+}
+
+int main(int argc, char *argv[])
+{
+    if (even(6) != 1 || even(5) != 0)
+        return 1;
+    if (odd(7) != 1 || odd(4) != 0)
+        return 2;
+    if (first(5) != 5)
+        return 3;
+    if (third(4) != 4)
+        return 4;
+    if (walk(down, 5) != 5)
+        return 5;
+    if (sum(2, 3) != 5)
+        return 6;
+    return 0;
+}
@@ -43,7 +43,46 @@ long rshifteql(long a, unsigned long b)
     return a;
 }
 
-/* TODO - should test shifts by optimized paths 8,16,24 based */
+/* Byte and word based constant shift paths */
+unsigned long left8(unsigned long x)
+{
+    return x << 8;
+}
+
+unsigned long left17(unsigned long x)
+{
+    return x << 17;
+}
+
+unsigned long left26(unsigned long x)
+{
+    return x << 26;
+}
+
+unsigned long right16u(unsigned long x)
+{
+    return x >> 16;
+}
+
+long right9(long x)
+{
+    return x >> 9;
+}
+
+long right16(long x)
+{
+    return x >> 16;
+}
+
+long right24(long x)
+{
+    return x >> 24;
+}
+
+int righti8(int x)
+{
+    return x >> 8;
+}
 
 int main(int argc, char *argv[])
 {
@@ -82,5 +121,26 @@ int main(int argc, char *argv[])
         return 16;
     if (rshifteql(0x10001, 9) != 0x80)
         return 17;
+
+    if (left8(0x12345678) != 0x34567800)
+        return 18;
+    if (left17(0x12345678) != 0xACF00000)
+        return 19;
+    if (left26(0x12345671) != 0xC4000000)
+        return 20;
+    if (right16u(0x87654321) != 0x8765)
+        return 21;
+    if (right9(0x12345678) != 0x91A2B)
+        return 22;
+    if (right9(-0x12345678) != -0x91A2C)
+        return 23;
+    if (right16(0x87654321) != 0xFFFF8765)
+        return 24;
+    if (right24(0x87654321) != 0xFFFFFF87)
+        return 25;
+    if (right24(0x47654321) != 0x47)
+        return 26;
+    if (righti8(-0x1234) != -0x13)
+        return 27;
     return 0;
 }
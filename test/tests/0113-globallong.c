@@ -0,0 +1,41 @@
+/*
+ *	Loads and stores of global and static longs
+ */
+
+long g;
+unsigned long ug;
+static long s;
+
+long get_g(void)
+{
+    return g;
+}
+
+int main(int argc, char *argv[])
+{
+    static long ls;
+    long t;
+
+    g = 0x12345678L;
+    if (get_g() != 0x12345678L)
+        return 1;
+    ug = 0xFFFF0001UL;
+    if (ug != 0xFFFF0001UL)
+        return 2;
+    s = g;
+    if (s != 0x12345678L)
+        return 3;
+    ls = 0x00010001L;
+    if (ls != 0x00010001L)
+        return 4;
+    t = (s = -1L);
+    if (t != -1L || s != -1L)
+        return 5;
+    ls = s = 0;
+    if (ls || s)
+        return 6;
+    g = ug;
+    if (g != (long)0xFFFF0001UL)
+        return 7;
+    return 0;
+}
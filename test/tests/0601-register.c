@@ -38,6 +38,44 @@ int test_cast(void)
     return buf;
 }
 
+/* Bit operations and tests on register variables */
+static unsigned regbits(unsigned v)
+{
+    register unsigned r = v;
+    register unsigned char c = 0x0F;
+    unsigned n = 0;
+
+    r |= 0x0800;
+    r &= ~0x0001;
+    c ^= 0x80;
+    c &= ~0x02;
+    if (r & 0x0800)
+        n++;
+    if (!(r & 0x0001))
+        n += 2;
+    if (c & 0x80)
+        n += 4;
+    if (c & 0x02)
+        n += 8;
+    return n + r + c;
+}
+
+/* Enough register variables that some end up in the alternate registers
+   (-mz80-exx), with adds and subtracts too big for inc and dec */
+static int manyregs(void)
+{
+    register int a = 1;
+    register int b = 2;
+    register int c = 3;
+    register int m = 1000;
+    register int k = 10;
+
+    m -= 200;
+    k += 300;
+    m -= a + b + c;
+    return m + k;
+}
+
 int main(int argc, char *argv[])
 {
     register int x = 0;
@@ -54,5 +92,10 @@ int main(int argc, char *argv[])
         return 5;
     if (test_cast() != 0x1234)
         return 6;
+    /* 7 + 0x0802 + 0x8D */
+    if (regbits(3) != 2198)
+        return 7;
+    if (manyregs() != 1104)
+        return 8;
     return 0;
 }